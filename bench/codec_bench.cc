@@ -0,0 +1,133 @@
+/* encode/decode cost of ContestMessage (copying) vs. ContestMessageView (in place) */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "contest_message.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+/* count every heap allocation in the program */
+static uint64_t allocations = 0;
+
+void * operator new( size_t size )
+{
+  allocations++;
+  void * const ret = malloc( size );
+  if ( not ret ) {
+    throw bad_alloc();
+  }
+  return ret;
+}
+
+void operator delete( void * ptr ) noexcept
+{
+  free( ptr );
+}
+
+/* same size as the datagrump sender's payloads */
+static const string payload( 1424, 'x' );
+
+/* (so the compiler can't skip the work) */
+static volatile uint64_t sink;
+
+/* time `iterations` calls of `body`, and print ns and allocations per call */
+template <typename Body>
+static void measure( const string & name, const unsigned int iterations, const Body & body )
+{
+  const uint64_t allocations_before = allocations;
+  const auto start = steady_clock::now();
+
+  for ( unsigned int i = 0; i < iterations; i++ ) {
+    body( i );
+  }
+
+  const double ns = duration<double, nano>( steady_clock::now() - start ).count();
+  cout << name << " " << ns / iterations
+       << " " << double( allocations - allocations_before ) / iterations << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [ITERATIONS]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned int iterations = argc == 2 ? stoul( argv[ 1 ] ) : 1000000;
+
+  try {
+    const string wire = ContestMessage( 42, payload ).to_string();
+    string buffer;
+
+    cout << "operation ns_per_message allocations_per_message" << endl;
+
+    measure( "encode_string", iterations, [&] ( const unsigned int i ) {
+	ContestMessage message( i, payload );
+	message.set_send_timestamp();
+	sink = message.to_string().size();
+      } );
+
+    measure( "encode_view", iterations, [&] ( const unsigned int i ) {
+	ContestMessageView message( i, payload.data(), payload.size() );
+	message.set_send_timestamp();
+	message.serialize( buffer );
+	sink = buffer.size();
+      } );
+
+    measure( "decode_string", iterations, [&] ( const unsigned int ) {
+	const ContestMessage message( wire );
+	sink = message.header.sequence_number + message.payload.size();
+      } );
+
+    measure( "decode_view", iterations, [&] ( const unsigned int ) {
+	const ContestMessageView message( wire.data(), wire.size() );
+	sink = message.header.sequence_number + message.payload_length;
+      } );
+
+    measure( "ack_string", iterations, [&] ( const unsigned int i ) {
+	ContestMessage message( wire );
+	message.transform_into_ack( i, 0 );
+	sink = message.to_string().size();
+      } );
+
+    measure( "ack_view", iterations, [&] ( const unsigned int i ) {
+	ContestMessageView message( wire.data(), wire.size() );
+	message.transform_into_ack( i, 0 );
+	message.serialize( buffer );
+	sink = buffer.size();
+      } );
+
+    /* (each message acks 32 datagrams) */
+    RangeAck range_ack;
+    string range_wire;
+    measure( "range_ack_encode", iterations / 32, [&] ( const unsigned int i ) {
+	range_ack.clear();
+	for ( unsigned int j = 0; j < 32; j++ ) {
+	  range_ack.add( i * 32 + j, i + j );
+	}
+	range_ack.serialize( range_wire );
+	sink = range_wire.size();
+      } );
+
+    measure( "range_ack_decode", iterations / 32, [&] ( const unsigned int ) {
+	range_ack.parse( range_wire.data(), range_wire.size() );
+	sink = range_ack.datagrams().back().recv_timestamp;
+      } );
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,254 @@
+/* microbenchmark suite (run by `make bench`), for comparing commits:
+   one "name ns_per_op allocations_per_op" line per benchmark, each the
+   median of several runs */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "contest_message.hh"
+#include "poller.hh"
+#include "socket.hh"
+#include "timestamp.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace std::chrono;
+using namespace PollerShortNames;
+
+/* count every heap allocation in the program */
+static uint64_t allocations = 0;
+
+void * operator new( size_t size )
+{
+  allocations++;
+  void * const ret = malloc( size );
+  if ( not ret ) {
+    throw bad_alloc();
+  }
+  return ret;
+}
+
+void operator delete( void * ptr ) noexcept
+{
+  free( ptr );
+}
+
+/* (so the compiler can't skip the work) */
+static volatile uint64_t sink;
+
+/* how many times to run each benchmark (the median is reported) */
+static const unsigned int REPETITIONS = 5;
+
+/* time `operations` calls of `body`, in batches of `batch_size` with an
+   untimed call to `setup` before each batch, and print the median run */
+template <typename Setup, typename Body>
+static void measure( const string & name, const unsigned int operations, const unsigned int batch_size,
+		     const Setup & setup, const Body & body )
+{
+  /* (ns per op, allocations per op) for each run */
+  vector<pair<double, double>> runs;
+
+  for ( unsigned int run = 0; run < REPETITIONS; run++ ) {
+    double ns = 0;
+    uint64_t allocation_count = 0;
+
+    for ( unsigned int done = 0; done < operations; done += batch_size ) {
+      setup();
+
+      const uint64_t allocations_before = allocations;
+      const auto start = steady_clock::now();
+      for ( unsigned int i = done; i < done + batch_size; i++ ) {
+	body( i );
+      }
+      ns += duration<double, nano>( steady_clock::now() - start ).count();
+      allocation_count += allocations - allocations_before;
+    }
+
+    const unsigned int performed = ( operations + batch_size - 1 ) / batch_size * batch_size;
+    runs.emplace_back( ns / performed, double( allocation_count ) / performed );
+  }
+
+  sort( runs.begin(), runs.end() );
+  const auto & median = runs[ REPETITIONS / 2 ];
+  cout << name << " " << median.first << " " << median.second << endl;
+}
+
+/* ... without the setup */
+template <typename Body>
+static void measure( const string & name, const unsigned int operations, const Body & body )
+{
+  measure( name, operations, operations, [] () {}, body );
+}
+
+/* make sure we can open enough fds for the biggest Poller test */
+static void raise_fd_limit()
+{
+  rlimit limit;
+  SystemCall( "getrlimit", getrlimit( RLIMIT_NOFILE, &limit ) );
+  limit.rlim_cur = limit.rlim_max;
+  SystemCall( "setrlimit", setrlimit( RLIMIT_NOFILE, &limit ) );
+}
+
+static FileDescriptor make_eventfd()
+{
+  return FileDescriptor( SystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK ) ) );
+}
+
+/* one fd made ready and polled, with `fd_count - 1` others registered but idle */
+static void measure_poller( const string & name, const Poller::Backend backend,
+			    const size_t fd_count, const unsigned int operations )
+{
+  Poller poller( backend );
+
+  vector<unique_ptr<FileDescriptor>> idle;
+  for ( size_t i = 1; i < fd_count; i++ ) {
+    idle.emplace_back( new FileDescriptor( make_eventfd() ) );
+    poller.add_action( Action( *idle.back(), Direction::In, [] () -> Result {
+	  throw runtime_error( "idle fd became ready" );
+	} ) );
+  }
+
+  FileDescriptor active = make_eventfd();
+  const string one( "\x01\0\0\0\0\0\0\0", 8 );
+  poller.add_action( Action( active, Direction::In, [&] () {
+	active.read( 8 );
+	return ResultType::Continue;
+      } ) );
+
+  measure( name + "_" + to_string( fd_count ), operations, [&] ( const unsigned int ) {
+      active.write( one );
+      if ( poller.poll( -1 ).result != PollResult::Success ) {
+	throw runtime_error( "unexpected poll result" );
+      }
+    } );
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [ITERATIONS]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned int iterations = argc == 2 ? stoul( argv[ 1 ] ) : 1000000;
+
+  /* (the system-call benchmarks are run a tenth as many times) */
+  const unsigned int slow_iterations = max( 1u, iterations / 10 );
+
+  try {
+    cout << "benchmark ns_per_op allocations_per_op" << endl;
+
+    /* clock */
+    measure( "timestamp_ns", iterations, [&] ( const unsigned int ) {
+	sink = timestamp_ns();
+      } );
+
+    measure( "timestamp_ms", iterations, [&] ( const unsigned int ) {
+	sink = timestamp_ms();
+      } );
+
+    /* Address */
+    const Address ipv4( "127.0.0.1", 9191 ), ipv6( "2001:db8::1", 9191 );
+    measure( "address_to_string_ipv4", slow_iterations, [&] ( const unsigned int ) {
+	sink = ipv4.to_string().size();
+      } );
+
+    measure( "address_to_string_ipv6", slow_iterations, [&] ( const unsigned int ) {
+	sink = ipv6.to_string().size();
+      } );
+
+    /* ContestMessage (a full-size datagram, as the sender sends) */
+    const string payload( 1424, 'x' );
+    const string wire = ContestMessage( 42, payload ).to_string();
+    string buffer;
+
+    measure( "contest_message_encode", iterations, [&] ( const unsigned int i ) {
+	ContestMessage message( i, payload );
+	message.set_send_timestamp();
+	sink = message.to_string().size();
+      } );
+
+    measure( "contest_message_decode", iterations, [&] ( const unsigned int ) {
+	const ContestMessage message( wire );
+	sink = message.header.sequence_number + message.payload.size();
+      } );
+
+    measure( "contest_message_view_encode", iterations, [&] ( const unsigned int i ) {
+	ContestMessageView message( i, payload.data(), payload.size() );
+	message.set_send_timestamp();
+	message.serialize( buffer );
+	sink = buffer.size();
+      } );
+
+    measure( "contest_message_view_decode", iterations, [&] ( const unsigned int ) {
+	const ContestMessageView message( wire.data(), wire.size() );
+	sink = message.header.sequence_number + message.payload_length;
+      } );
+
+    /* UDPSocket over loopback, in batches small enough for the receive buffer */
+    const unsigned int batch = 32;
+    UDPSocket receiver;
+    receiver.bind( Address( "::1", 0 ) );
+    UDPSocket sender;
+    sender.connect( receiver.local_address() );
+
+    const auto fill = [&] () {
+      for ( unsigned int i = 0; i < batch; i++ ) {
+	sender.send( wire );
+      }
+    };
+
+    const auto drain = [&] () {
+      for ( unsigned int received = 0; received < batch; ) {
+	received += receiver.recv_batch( batch ).size();
+      }
+    };
+
+    /* (each batch is drained before the next; the first drains this one) */
+    fill();
+    measure( "udp_send", slow_iterations, batch, drain, [&] ( const unsigned int ) {
+	sender.send( wire );
+      } );
+    drain();
+
+    measure( "udp_recv", slow_iterations, batch, fill, [&] ( const unsigned int ) {
+	sink = receiver.recv().payload.size();
+      } );
+
+    /* (per datagram, received `batch` at a time) */
+    measure( "udp_recv_batch", slow_iterations, batch, fill, [&] ( const unsigned int i ) {
+	if ( i % batch == 0 ) {
+	  drain();
+	}
+      } );
+
+    /* Poller, with one ready fd among many */
+    raise_fd_limit();
+    for ( const size_t fd_count : { 1, 16, 256, 1024 } ) {
+      /* (poll() takes time in proportion to the fds, so do fewer of the big ones) */
+      const unsigned int operations = max( size_t( 1 ), slow_iterations * 16 / max( size_t( 16 ), fd_count ) );
+      measure_poller( "poller_poll", Poller::Backend::Poll, fd_count, operations );
+      measure_poller( "poller_epoll", Poller::Backend::Epoll, fd_count, operations );
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
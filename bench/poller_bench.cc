@@ -0,0 +1,97 @@
+/* wakeup latency of Poller backends vs. number of registered fds */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "poller.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace std::chrono;
+using namespace PollerShortNames;
+
+/* make sure we can open enough fds for the biggest test */
+static void raise_fd_limit()
+{
+  rlimit limit;
+  SystemCall( "getrlimit", getrlimit( RLIMIT_NOFILE, &limit ) );
+  limit.rlim_cur = limit.rlim_max;
+  SystemCall( "setrlimit", setrlimit( RLIMIT_NOFILE, &limit ) );
+}
+
+static FileDescriptor make_eventfd()
+{
+  return FileDescriptor( SystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK ) ) );
+}
+
+/* average ns from signalling one fd to its callback running,
+   with `idle_count` other fds registered but never ready */
+static double wakeup_ns( const Poller::Backend backend, const size_t idle_count,
+			 const unsigned int iterations )
+{
+  Poller poller( backend );
+
+  vector<unique_ptr<FileDescriptor>> idle;
+  for ( size_t i = 0; i < idle_count; i++ ) {
+    idle.emplace_back( new FileDescriptor( make_eventfd() ) );
+    poller.add_action( Action( *idle.back(), Direction::In, [] () -> Result {
+	  throw runtime_error( "idle fd became ready" );
+	} ) );
+  }
+
+  FileDescriptor active = make_eventfd();
+  const string one( "\x01\0\0\0\0\0\0\0", 8 );
+  poller.add_action( Action( active, Direction::In, [&] () {
+	active.read( 8 );
+	return ResultType::Continue;
+      } ) );
+
+  const auto start = steady_clock::now();
+  for ( unsigned int i = 0; i < iterations; i++ ) {
+    active.write( one );
+    if ( poller.poll( -1 ).result != PollResult::Success ) {
+      throw runtime_error( "unexpected poll result" );
+    }
+  }
+
+  return duration<double, nano>( steady_clock::now() - start ).count() / iterations;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [ITERATIONS]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned int iterations = argc == 2 ? stoul( argv[ 1 ] ) : 20000;
+
+  try {
+    raise_fd_limit();
+
+    cout << "registered_fds poll_ns epoll_ns epoll_et_ns" << endl;
+    for ( const size_t count : { 1, 10, 100, 1000, 10000 } ) {
+      cout << count
+	   << " " << wakeup_ns( Poller::Backend::Poll, count - 1, iterations )
+	   << " " << wakeup_ns( Poller::Backend::Epoll, count - 1, iterations )
+	   << " " << wakeup_ns( Poller::Backend::EpollEdgeTriggered, count - 1, iterations )
+	   << endl;
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+/* stream reads: FileDescriptor::read() into a new string vs. into the
+   caller's buffer vs. a RingBuffer refilled with readv() */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "file_descriptor.hh"
+#include "ring_buffer.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+/* count every heap allocation in the program */
+static uint64_t allocations = 0;
+
+void * operator new( size_t size )
+{
+  allocations++;
+  void * const ret = malloc( size );
+  if ( not ret ) {
+    throw bad_alloc();
+  }
+  return ret;
+}
+
+void operator delete( void * ptr ) noexcept
+{
+  free( ptr );
+}
+
+/* (so the compiler can't skip the work) */
+static volatile uint64_t sink;
+
+/* push `total` bytes through a pipe in `chunk`-byte writes, and time the
+   reader's `read_some` (which returns how many bytes it consumed) */
+template <typename ReadSome>
+static void measure( const string & name, const uint64_t total, const size_t chunk,
+		     const ReadSome & read_some )
+{
+  int fds[ 2 ];
+  SystemCall( "pipe", pipe( fds ) );
+  FileDescriptor reader( fds[ 0 ] ), writer( fds[ 1 ] );
+
+  const string data( chunk, 'x' );
+  thread writer_thread( [&] () {
+      for ( uint64_t sent = 0; sent < total; sent += chunk ) {
+	writer.write( data );
+      }
+    } );
+
+  const uint64_t allocations_before = allocations;
+  const auto start = steady_clock::now();
+
+  uint64_t received = 0, reads = 0;
+  while ( received < total ) {
+    received += read_some( reader );
+    reads++;
+  }
+
+  const double ns = duration<double, nano>( steady_clock::now() - start ).count();
+  const uint64_t reader_allocations = allocations - allocations_before;
+  writer_thread.join();
+
+  /* (the writer thread's allocations are counted too, but it makes none
+     after startup) */
+  cout << name << " " << chunk << " " << ns / reads
+       << " " << double( reader_allocations ) / reads
+       << " " << total / ( ns / 1e9 ) / 1e6 << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [MEGABYTES]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const uint64_t total = ( argc == 2 ? stoul( argv[ 1 ] ) : 1024 ) * 1024 * 1024;
+
+  try {
+    cout << "reader write_size ns_per_read allocations_per_read megabytes_per_s" << endl;
+
+    for ( const size_t chunk : { 64, 1500, 65536 } ) {
+      measure( "string", total, chunk, [] ( FileDescriptor & fd ) {
+	  const string data = fd.read();
+	  sink = data.back();
+	  return data.size();
+	} );
+
+      char buffer[ 65536 ];
+      measure( "caller_buffer", total, chunk, [&] ( FileDescriptor & fd ) {
+	  const size_t length = fd.read( buffer, sizeof( buffer ) );
+	  sink = buffer[ length - 1 ];
+	  return length;
+	} );
+
+      /* (consumed in 1000-byte records, so a partial one is left
+	 behind and the reads wrap around) */
+      RingBuffer ring;
+      measure( "ring_buffer", total, chunk, [&] ( FileDescriptor & fd ) {
+	  const size_t length = ring.read_from( fd );
+	  while ( ring.size() >= 1000 ) {
+	    const RingBuffer::Span span = ring.front();
+	    const size_t usable = min( span.length, ring.size() - ring.size() % 1000 );
+	    sink = span.data[ usable - 1 ];
+	    ring.pop( usable );
+	  }
+	  return length;
+	} );
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
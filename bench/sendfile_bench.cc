@@ -0,0 +1,160 @@
+/* bulk TCP transmission: read() + write() vs. sendfile vs. splice vs. MSG_ZEROCOPY */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "socket.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+/* CPU time used by the calling thread */
+static double thread_cpu_seconds()
+{
+  rusage usage;
+  SystemCall( "getrusage", getrusage( RUSAGE_THREAD, &usage ) );
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+    + ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1e6;
+}
+
+/* wait until the kernel is done with every zerocopy send
+   (completions arrive on the error queue, which polls as POLLERR) */
+static void wait_for_zerocopy( TCPSocket & socket )
+{
+  socket.reap_zerocopy();
+  while ( socket.zerocopy_pending() ) {
+    pollfd error_queue = { socket.fd_num(), 0, 0 };
+    SystemCall( "poll", poll( &error_queue, 1, -1 ) );
+    socket.reap_zerocopy();
+  }
+}
+
+/* a scratch file of `size` bytes (unlinked, so it goes away with the fd) */
+static FileDescriptor make_file( const size_t size )
+{
+  char name[] = "/tmp/sendfile_bench.XXXXXX";
+  FileDescriptor file( SystemCall( "mkstemp", mkstemp( name ) ) );
+  SystemCall( "unlink", unlink( name ) );
+
+  const string block( 1 << 20, 'x' );
+  for ( size_t written = 0; written < size; written += block.size() ) {
+    file.write( block );
+  }
+
+  return file;
+}
+
+/* connect a sender to a thread that reads and discards `total` bytes,
+   then time `send_all` and print its throughput and CPU cost */
+template <typename SendAll>
+static void measure( const string & name, const size_t total, const SendAll & send_all )
+{
+  TCPSocket listener;
+  listener.bind( Address( "::1", "0" ) );
+  listener.listen();
+
+  thread receiver( [&] () {
+      TCPSocket connection = listener.accept();
+      char buffer[ 1 << 16 ];
+      size_t received = 0;
+      while ( received < total and not connection.eof() ) {
+	received += connection.read( buffer, sizeof( buffer ) );
+      }
+    } );
+
+  TCPSocket sender;
+  sender.connect( listener.local_address() );
+
+  const double cpu_before = thread_cpu_seconds();
+  const auto start = steady_clock::now();
+
+  const string note = send_all( sender );
+
+  const double seconds = duration<double>( steady_clock::now() - start ).count();
+  const double cpu = thread_cpu_seconds() - cpu_before;
+  receiver.join();
+
+  cout << name << " " << total / seconds / 1e6
+       << " " << cpu * 1e9 / ( total / 1e6 ) << note << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [MEGABYTES]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const size_t total = ( argc == 2 ? stoul( argv[ 1 ] ) : 256 ) << 20;
+
+  try {
+    FileDescriptor file = make_file( total );
+
+    cout << "method megabytes_per_s sender_cpu_ns_per_megabyte" << endl;
+
+    measure( "read_write", total, [&] ( TCPSocket & socket ) {
+	SystemCall( "lseek", lseek( file.fd_num(), 0, SEEK_SET ) );
+	for ( size_t sent = 0; sent < total; ) {
+	  const string block = file.read( 1 << 16 );
+	  socket.write( block );
+	  sent += block.size();
+	}
+	return string();
+      } );
+
+    measure( "sendfile", total, [&] ( TCPSocket & socket ) {
+	socket.send_file( file, 0, total );
+	return string();
+      } );
+
+    /* (file to pipe to socket, so the bytes never leave the kernel) */
+    measure( "splice", total, [&] ( TCPSocket & socket ) {
+	int fds[ 2 ];
+	SystemCall( "pipe", pipe( fds ) );
+	FileDescriptor pipe_out( fds[ 0 ] ), pipe_in( fds[ 1 ] );
+
+	loff_t position = 0;
+	while ( size_t( position ) < total ) {
+	  const ssize_t filled = SystemCall( "splice", splice( file.fd_num(), &position, pipe_in.fd_num(),
+							       nullptr, total - position, SPLICE_F_MOVE ) );
+	  socket.splice_from( pipe_out, filled );
+	}
+	return string();
+      } );
+
+    /* (one buffer, reused once the kernel says it's done with it) */
+    measure( "zerocopy", total, [&] ( TCPSocket & socket ) {
+	if ( not socket.enable_zerocopy() ) {
+	  socket.write( string( total, 'x' ) );
+	  return string( " (not supported: plain write)" );
+	}
+
+	const string buffer( 1 << 20, 'x' );
+	for ( size_t sent = 0; sent < total; sent += buffer.size() ) {
+	  wait_for_zerocopy( socket );
+	  socket.send_zerocopy( buffer );
+	}
+	wait_for_zerocopy( socket );
+	return string( socket.zerocopy_copied() ? " (kernel copied)" : "" );
+      } );
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+/* connection scaling: TCPServer's event-loop workers vs. a thread per connection */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "socket.hh"
+#include "tcp_server.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+/* make sure we can open enough fds for the biggest test */
+static void raise_fd_limit()
+{
+  rlimit limit;
+  SystemCall( "getrlimit", getrlimit( RLIMIT_NOFILE, &limit ) );
+  limit.rlim_cur = limit.rlim_max;
+  SystemCall( "setrlimit", setrlimit( RLIMIT_NOFILE, &limit ) );
+}
+
+/* an echo server the way examples/tcpserver.cc used to do it:
+   one detached thread per accepted connection */
+class ThreadPerConnectionServer
+{
+private:
+  TCPSocket listener_;
+  atomic<bool> stopping_;
+  atomic<unsigned int> live_;
+  thread acceptor_;
+
+public:
+  ThreadPerConnectionServer()
+    : listener_(), stopping_( false ), live_( 0 ), acceptor_()
+  {
+    listener_.bind( Address( "::1", "0" ) );
+    listener_.listen( SOMAXCONN );
+
+    acceptor_ = thread( [&] () {
+	while ( true ) {
+	  TCPSocket client = listener_.accept();
+	  if ( stopping_ ) {
+	    return;
+	  }
+
+	  live_++;
+	  thread( [&] ( TCPSocket connection ) {
+	      try {
+		while ( true ) {
+		  const string chunk = connection.read();
+		  if ( connection.eof() ) {
+		    break;
+		  }
+		  connection.write( chunk );
+		}
+	      } catch ( const exception & ) {}
+	      live_--;
+	    }, move( client ) ).detach();
+	}
+      } );
+  }
+
+  ~ThreadPerConnectionServer()
+  {
+    /* wake the acceptor with one last connection */
+    stopping_ = true;
+    TCPSocket( ).connect( listener_.local_address() );
+    acceptor_.join();
+
+    /* the connection threads end as their clients close */
+    while ( live_ ) {
+      this_thread::sleep_for( milliseconds( 1 ) );
+    }
+  }
+
+  Address local_address() const { return listener_.local_address(); }
+};
+
+/* an echo server on TCPServer */
+class EventLoopServer
+{
+private:
+  TCPServer server_;
+
+  static TCPServer::Handlers echo()
+  {
+    TCPServer::Handlers handlers;
+    handlers.on_data = [] ( TCPServer::Connection & connection, const string & chunk ) {
+      connection.send( chunk );
+    };
+    return handlers;
+  }
+
+public:
+  EventLoopServer() : server_( Address( "::1", "0" ), echo() ) {}
+
+  Address local_address() const { return server_.local_address(); }
+};
+
+struct Measurement
+{
+  double connect_ns;  /* per connection */
+  double request_ns;  /* per request, with every connection busy at once */
+};
+
+/* open `count` connections, then do `rounds` of one small request on each */
+template <class Server>
+static Measurement measure( const size_t count, const unsigned int rounds )
+{
+  Server server;
+  const Address address = server.local_address();
+  const string request( 64, 'x' );
+
+  vector<unique_ptr<TCPSocket>> clients;
+  const auto connect_start = steady_clock::now();
+  for ( size_t i = 0; i < count; i++ ) {
+    clients.emplace_back( new TCPSocket );
+    clients.back()->connect( address );
+  }
+  const auto connect_end = steady_clock::now();
+
+  for ( unsigned int round = 0; round < rounds; round++ ) {
+    for ( auto & client : clients ) {
+      client->write( request );
+    }
+    for ( auto & client : clients ) {
+      size_t received = 0;
+      while ( received < request.size() ) {
+	received += client->read( request.size() - received ).size();
+	if ( client->eof() ) {
+	  throw runtime_error( "server closed the connection" );
+	}
+      }
+    }
+  }
+  const auto requests_end = steady_clock::now();
+
+  clients.clear();
+
+  return { duration<double, nano>( connect_end - connect_start ).count() / count,
+	   duration<double, nano>( requests_end - connect_end ).count() / ( count * rounds ) };
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [ROUNDS]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned int rounds = argc == 2 ? stoul( argv[ 1 ] ) : 20;
+
+  try {
+    raise_fd_limit();
+
+    cout << "connections thread_connect_ns thread_request_ns"
+	 << " eventloop_connect_ns eventloop_request_ns" << endl;
+    for ( const size_t count : { 1, 10, 100, 1000, 5000 } ) {
+      const Measurement threads = measure<ThreadPerConnectionServer>( count, rounds );
+      const Measurement loops = measure<EventLoopServer>( count, rounds );
+      cout << count
+	   << " " << threads.connect_ns << " " << threads.request_ns
+	   << " " << loops.connect_ns << " " << loops.request_ns << endl;
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,86 @@
+/* cost per event of the sender's debug output: cerr (as the controllers
+   used to print it) vs. the EventTrace ring, both going to /dev/null */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <fcntl.h>
+
+#include "event_trace.hh"
+#include "timestamp.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+/* time `iterations` calls of `body`, and print ns per call */
+template <typename Body>
+static void measure( const string & name, const unsigned int iterations, const Body & body )
+{
+  const auto start = steady_clock::now();
+
+  for ( unsigned int i = 0; i < iterations; i++ ) {
+    body( i );
+  }
+
+  const double ns = duration<double, nano>( steady_clock::now() - start ).count();
+  cout << name << " " << ns / iterations;
+}
+
+/* (so the compiler can't skip the work) */
+static volatile uint64_t sink;
+
+static FileDescriptor dev_null()
+{
+  return FileDescriptor( SystemCall( "open /dev/null", open( "/dev/null", O_WRONLY ) ) );
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [ITERATIONS]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned int iterations = argc == 2 ? stoul( argv[ 1 ] ) : 1000000;
+
+  try {
+    cout << "output ns_per_event dropped_events" << endl;
+
+    /* (an unbuffered stream, like cerr, flushed by endl each time) */
+    ofstream stream( "/dev/null" );
+    stream.rdbuf()->pubsetbuf( nullptr, 0 );
+    measure( "ostream_endl", iterations, [&] ( const unsigned int i ) {
+	stream << "At time " << timestamp_ns() << " received ack for datagram " << i
+	       << " (send @ time " << i << ", received @ time " << i << " by receiver's clock)"
+	       << endl;
+      } );
+    cout << " 0" << endl;
+
+    /* (the clock read that each event includes) */
+    measure( "timestamp_only", iterations, [&] ( const unsigned int ) {
+	sink = timestamp_ns();
+      } );
+    cout << " 0" << endl;
+
+    /* (with room for every event: a loop this tight outruns the drainer) */
+    for ( const bool text : { false, true } ) {
+      EventTrace trace( dev_null(), text, iterations );
+      measure( text ? "trace_text" : "trace_binary", iterations, [&] ( const unsigned int i ) {
+	  trace.acked( timestamp_ns(), i, i, i );
+	} );
+      cout << " " << trace.dropped() << endl;
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+/* loopback benchmark of UDP segmentation/receive offload (GSO/GRO) */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "socket.hh"
+#include "poller.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace std::chrono;
+using namespace PollerShortNames;
+
+/* same size as the datagrump sender's datagrams (including header) */
+static const size_t DATAGRAM_SIZE = 1472;
+
+/* how many datagrams to hand to each send_batch() */
+static const size_t BURST_SIZE = 64;
+
+/* CPU time (user + system, all threads) used so far, in seconds */
+static double cpu_seconds()
+{
+  rusage usage;
+  SystemCall( "getrusage", getrusage( RUSAGE_SELF, &usage ) );
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+    + ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1.0e6;
+}
+
+static void run( const size_t count, const bool gso, const bool gro )
+{
+  UDPSocket receiver, sender;
+  receiver.bind( Address( "::1", 0 ) );
+  sender.connect( receiver.local_address() );
+
+  const bool gso_ok = gso ? sender.enable_gso() : false;
+  const bool gro_ok = gro ? receiver.enable_gro() : false;
+
+  const double cpu_before = cpu_seconds();
+  const auto start = steady_clock::now();
+  auto last_receipt = start;
+  size_t received = 0;
+
+  /* receive until the socket has been idle for a while */
+  thread receiver_thread( [&] () {
+      Poller poller;
+      poller.add_action( Action( receiver, Direction::In, [&] () {
+	    received += receiver.recv_batch( BURST_SIZE ).size();
+	    last_receipt = steady_clock::now();
+	    return ResultType::Continue;
+	  } ) );
+
+      while ( poller.poll( 200 ).result == PollResult::Success ) {}
+    } );
+
+  const vector<string> burst( BURST_SIZE, string( DATAGRAM_SIZE, 'x' ) );
+  size_t sent = 0;
+  while ( sent < count ) {
+    sender.send_batch( burst );
+    sent += burst.size();
+  }
+
+  receiver_thread.join();
+
+  const double elapsed = duration<double>( last_receipt - start ).count();
+  const double cpu = cpu_seconds() - cpu_before;
+
+  cout << "gso=" << (gso ? (gso_ok and sender.gso_enabled() ? "on" : "refused") : "off")
+       << " gro=" << (gro ? (gro_ok ? "on" : "refused") : "off")
+       << " sent=" << sent
+       << " received=" << received
+       << " packets_per_sec=" << received / elapsed
+       << " cpu_ns_per_packet=" << ( received ? cpu * 1.0e9 / received : 0 )
+       << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [DATAGRAMS]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const size_t count = argc == 2 ? stoul( argv[ 1 ] ) : 1000000;
+
+  try {
+    run( count, false, false );
+    run( count, true, false );
+    run( count, false, true );
+    run( count, true, true );
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
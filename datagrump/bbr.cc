@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cmath>
+
+#include "bbr.hh"
+#include "event_trace.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+/* 2/ln(2): the smallest gain that doubles the delivery rate every round */
+static const double HIGH_GAIN = 2.885;
+
+/* ProbeBW spends one min_rtt at each of these pacing gains, in turn */
+static const double GAIN_CYCLE[] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+static const unsigned int GAIN_CYCLE_LENGTH = sizeof( GAIN_CYCLE ) / sizeof( GAIN_CYCLE[ 0 ] );
+static const double PROBE_BW_WINDOW_GAIN = 2;
+
+/* how long each estimate lasts */
+static const uint64_t BANDWIDTH_WINDOW_ROUNDS = 10;
+static const uint64_t MIN_RTT_WINDOW_NS = 10000000000;
+
+/* Startup is over once three rounds go by without 25% more bandwidth */
+static const double FULL_BANDWIDTH_GROWTH = 1.25;
+static const unsigned int FULL_BANDWIDTH_ROUNDS = 3;
+
+/* ProbeRTT drains the queue to this window for at least this long */
+static const unsigned int MIN_WINDOW = 4;
+static const uint64_t PROBE_RTT_DURATION_NS = 200000000;
+
+/* before there is a model */
+static const unsigned int INITIAL_WINDOW = 50;
+static const unsigned int MAX_WINDOW = 100000;
+
+/* must be a power of two, and bigger than MAX_WINDOW */
+static const size_t SEND_STATE_SLOTS = 1 << 17;
+
+BBR::BBR( const ControllerOptions & options )
+  : trace_( options.trace ),
+    send_states_( SEND_STATE_SLOTS, SendState { uint64_t( -1 ), 0, 0, 0 } ),
+    delivered_( 0 ),
+    delivered_time_( 0 ),
+    first_sent_time_( 0 ),
+    next_sequence_number_( 0 ),
+    next_ack_expected_( 0 ),
+    round_count_( 0 ),
+    next_round_delivered_( 0 ),
+    max_bandwidth_( BANDWIDTH_WINDOW_ROUNDS ),
+    min_rtt_ns_( 0 ),
+    min_rtt_stamp_( 0 ),
+    mode_( Mode::Startup ),
+    pacing_gain_( HIGH_GAIN ),
+    window_gain_( HIGH_GAIN ),
+    full_bandwidth_( 0 ),
+    full_bandwidth_rounds_( 0 ),
+    cycle_index_( 0 ),
+    cycle_stamp_( 0 ),
+    probe_rtt_done_stamp_( 0 ),
+    probe_rtt_round_done_( false ),
+    rtt_()
+{}
+
+/* bandwidth-delay product, in datagrams */
+uint64_t BBR::bdp() const
+{
+  return ceil( bandwidth() * min_rtt_ns_ / 1e9 );
+}
+
+void BBR::datagram_was_sent( const uint64_t sequence_number,
+			     const uint64_t send_timestamp,
+			     const bool /* after_timeout */ )
+{
+  /* after an idle period, measure delivery from now rather than from
+     the last ack (which would make the rate look too low) */
+  if ( inflight() == 0 ) {
+    delivered_time_ = first_sent_time_ = send_timestamp;
+  }
+
+  send_states_[ sequence_number & ( SEND_STATE_SLOTS - 1 ) ]
+    = { sequence_number, delivered_, delivered_time_, first_sent_time_ };
+
+  next_sequence_number_ = max( next_sequence_number_, sequence_number + 1 );
+}
+
+void BBR::ack_received( const uint64_t sequence_number_acked,
+			const uint64_t send_timestamp_acked,
+			const uint64_t /* recv_timestamp_acked */,
+			const uint64_t timestamp_ack_received )
+{
+  const uint64_t now = timestamp_ack_received;
+
+  rtt_.update( now - send_timestamp_acked );
+
+  next_ack_expected_ = max( next_ack_expected_, sequence_number_acked + 1 );
+  delivered_++;
+  delivered_time_ = now;
+  first_sent_time_ = send_timestamp_acked;
+
+  /* ignore acks for datagrams whose state has been overwritten */
+  const SendState & state = send_states_[ sequence_number_acked & ( SEND_STATE_SLOTS - 1 ) ];
+  if ( state.sequence_number != sequence_number_acked ) {
+    return;
+  }
+
+  /* has a round trip gone by? */
+  const bool round_start = state.delivered >= next_round_delivered_;
+  if ( round_start ) {
+    next_round_delivered_ = delivered_;
+    round_count_++;
+  }
+
+  /* has the min_rtt estimate expired (before this sample)? */
+  const bool min_rtt_expired = min_rtt_ns_ and now > min_rtt_stamp_ + MIN_RTT_WINDOW_NS;
+
+  update_model( state, send_timestamp_acked, now, min_rtt_expired );
+  update_mode( now, round_start, min_rtt_expired );
+}
+
+/* add this ack's delivery-rate and RTT samples to the model */
+void BBR::update_model( const SendState & state, const uint64_t send_timestamp,
+			const uint64_t now, const bool min_rtt_expired )
+{
+  /* delivery rate since this datagram was sent: the slower of the send
+     and ack rates over the interval (so that neither a burst of sends
+     nor a burst of acks can inflate it) */
+  const uint64_t send_elapsed = send_timestamp - state.first_sent_time;
+  const uint64_t ack_elapsed = now - state.delivered_time;
+  const uint64_t interval = max( send_elapsed, ack_elapsed );
+
+  if ( interval > 0 ) {
+    const double rate = ( delivered_ - state.delivered ) * 1e9 / interval;
+    max_bandwidth_.update( round_count_, rate );
+  }
+
+  const uint64_t rtt = now - send_timestamp;
+  if ( min_rtt_ns_ == 0 or rtt <= min_rtt_ns_ or min_rtt_expired ) {
+    min_rtt_ns_ = max( rtt, uint64_t( 1 ) );
+    min_rtt_stamp_ = now;
+  }
+}
+
+void BBR::enter_mode( const Mode mode, const uint64_t now )
+{
+  mode_ = mode;
+
+  if ( trace_ ) {
+    trace_->mode_changed( now, static_cast<unsigned int>( mode_ ), bandwidth(), min_rtt_ns_ );
+  }
+
+  switch ( mode ) {
+  case Mode::Startup:
+    pacing_gain_ = window_gain_ = HIGH_GAIN;
+    break;
+  case Mode::Drain:
+    /* (the window, too, so that the queue drains even if we aren't paced) */
+    pacing_gain_ = 1 / HIGH_GAIN;
+    window_gain_ = 1;
+    break;
+  case Mode::ProbeBW:
+    /* start anywhere in the cycle except the draining phase
+       (so that competing flows don't probe in lockstep) */
+    cycle_index_ = round_count_ % ( GAIN_CYCLE_LENGTH - 1 );
+    cycle_index_ += cycle_index_ >= 1;
+    cycle_stamp_ = now;
+    pacing_gain_ = GAIN_CYCLE[ cycle_index_ ];
+    window_gain_ = PROBE_BW_WINDOW_GAIN;
+    break;
+  case Mode::ProbeRTT:
+    pacing_gain_ = window_gain_ = 1;
+    probe_rtt_done_stamp_ = 0;
+    probe_rtt_round_done_ = false;
+    break;
+  }
+}
+
+/* move through the state machine */
+void BBR::update_mode( const uint64_t now, const bool round_start, const bool min_rtt_expired )
+{
+  switch ( mode_ ) {
+  case Mode::Startup:
+    if ( round_start ) {
+      if ( bandwidth() >= full_bandwidth_ * FULL_BANDWIDTH_GROWTH ) {
+	full_bandwidth_ = bandwidth();
+	full_bandwidth_rounds_ = 0;
+      } else if ( ++full_bandwidth_rounds_ >= FULL_BANDWIDTH_ROUNDS ) {
+	enter_mode( Mode::Drain, now );
+      }
+    }
+    break;
+
+  case Mode::Drain:
+    /* drain the queue that Startup built */
+    if ( inflight() <= bdp() ) {
+      enter_mode( Mode::ProbeBW, now );
+    }
+    break;
+
+  case Mode::ProbeBW:
+    /* spend a min_rtt at each gain (but stop draining once the queue is gone) */
+    if ( now - cycle_stamp_ > min_rtt_ns_
+	 or ( pacing_gain_ < 1 and inflight() <= bdp() ) ) {
+      cycle_index_ = ( cycle_index_ + 1 ) % GAIN_CYCLE_LENGTH;
+      cycle_stamp_ = now;
+      pacing_gain_ = GAIN_CYCLE[ cycle_index_ ];
+    }
+    break;
+
+  case Mode::ProbeRTT:
+    /* once the window is down to the minimum, hold it there for
+       PROBE_RTT_DURATION_NS and at least one round trip */
+    if ( probe_rtt_done_stamp_ == 0 and inflight() <= MIN_WINDOW ) {
+      probe_rtt_done_stamp_ = now + PROBE_RTT_DURATION_NS;
+      next_round_delivered_ = delivered_;
+    } else if ( probe_rtt_done_stamp_ ) {
+      probe_rtt_round_done_ = probe_rtt_round_done_ or round_start;
+      if ( probe_rtt_round_done_ and now >= probe_rtt_done_stamp_ ) {
+	min_rtt_stamp_ = now;
+	enter_mode( full_bandwidth_rounds_ >= FULL_BANDWIDTH_ROUNDS ? Mode::ProbeBW : Mode::Startup, now );
+      }
+    }
+    return;
+  }
+
+  /* re-measure the propagation delay if it hasn't been seen for a while */
+  if ( min_rtt_expired ) {
+    enter_mode( Mode::ProbeRTT, now );
+  }
+}
+
+/* the window: a multiple of the bandwidth-delay product */
+unsigned int BBR::window_size()
+{
+  unsigned int the_window_size = INITIAL_WINDOW;
+  if ( mode_ == Mode::ProbeRTT ) {
+    the_window_size = MIN_WINDOW;
+  } else if ( not max_bandwidth_.empty() ) {
+    the_window_size = min( uint64_t( MAX_WINDOW ),
+			   max( uint64_t( MIN_WINDOW ), uint64_t( ceil( window_gain_ * bdp() ) ) ) );
+  }
+
+  return the_window_size;
+}
@@ -0,0 +1,109 @@
+#ifndef BBR_HH
+#define BBR_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "controller.hh"
+#include "rtt_estimator.hh"
+#include "windowed_filter.hh"
+
+/* Model-based congestion control after BBR (Cardwell et al., 2016):
+   estimate the bottleneck bandwidth (windowed max of the delivery rate)
+   and the propagation delay (windowed min of the RTT), then pace at the
+   bandwidth and cap the window at a multiple of their product, cycling
+   the gains to probe for more bandwidth and to drain the queue.
+
+   Same interface as Controller. All updates take constant time, and
+   nothing is allocated after construction. Bandwidths are in datagrams
+   per second. */
+class BBR
+{
+public:
+  enum class Mode { Startup, Drain, ProbeBW, ProbeRTT };
+
+private:
+  EventTrace * trace_; /* for mode changes (if tracing) */
+
+  /* what we knew when each datagram was sent (indexed by sequence
+     number, modulo the size; big enough for any window we'll use) */
+  struct SendState
+  {
+    uint64_t sequence_number;
+    uint64_t delivered;       /* datagrams acked before this one was sent */
+    uint64_t delivered_time;  /* when the most recent of those was acked */
+    uint64_t first_sent_time; /* ... and when it had been sent */
+  };
+
+  std::vector<SendState> send_states_;
+
+  /* delivery accounting */
+  uint64_t delivered_, delivered_time_, first_sent_time_;
+  uint64_t next_sequence_number_, next_ack_expected_;
+
+  /* round trips are counted by the delivered count: a round ends when a
+     datagram sent after the previous round's end is acked */
+  uint64_t round_count_, next_round_delivered_;
+
+  /* the model */
+  WindowedMaxFilter<double> max_bandwidth_; /* (over rounds) */
+  uint64_t min_rtt_ns_, min_rtt_stamp_;
+
+  /* the state machine */
+  Mode mode_;
+  double pacing_gain_, window_gain_;
+
+  /* Startup ends when the bandwidth stops growing */
+  double full_bandwidth_;
+  unsigned int full_bandwidth_rounds_;
+
+  /* ProbeBW gain cycle */
+  unsigned int cycle_index_;
+  uint64_t cycle_stamp_;
+
+  /* ProbeRTT */
+  uint64_t probe_rtt_done_stamp_;
+  bool probe_rtt_round_done_;
+
+  /* for the timeout */
+  RTTEstimator rtt_;
+
+  uint64_t bdp() const; /* bandwidth-delay product, in datagrams */
+  uint64_t inflight() const { return next_sequence_number_ - next_ack_expected_; }
+
+  void enter_mode( const Mode mode, const uint64_t now );
+  void update_model( const SendState & state, const uint64_t send_timestamp,
+		     const uint64_t now, const bool min_rtt_expired );
+  void update_mode( const uint64_t now, const bool round_start, const bool min_rtt_expired );
+
+public:
+  BBR( const ControllerOptions & options );
+
+  /* the window: a multiple of the bandwidth-delay product */
+  unsigned int window_size();
+
+  /* the pacing rate: a multiple of the bandwidth (or 0 before there's an estimate) */
+  double pacing_rate() { return pacing_gain_ * bandwidth(); }
+
+  /* timestamps are in nanoseconds (see timestamp.hh) */
+  void datagram_was_sent( const uint64_t sequence_number,
+			  const uint64_t send_timestamp,
+			  const bool after_timeout );
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received );
+
+  unsigned int timeout_ms() { return rtt_.timeout_ms(); }
+
+  /* accessors */
+  Mode mode() const { return mode_; }
+  double bandwidth() const { return max_bandwidth_.empty() ? 0 : max_bandwidth_.best(); }
+  uint64_t min_rtt_ns() const { return min_rtt_ns_; }
+
+  /* forbid copying */
+  BBR( const BBR & other ) = delete;
+  const BBR & operator=( const BBR & other ) = delete;
+};
+
+#endif /* BBR_HH */
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 #include "contest_message.hh"
@@ -5,58 +7,71 @@
 
 using namespace std;
 
+const size_t ContestMessage::Header::wire_size;
+
 /* helper to get the nth uint64_t field (in network byte order) */
-uint64_t get_header_field( const size_t n, const string & str )
+static uint64_t get_header_field( const size_t n, const char * data, const size_t length )
 {
-  if ( str.size() < (n + 1) * sizeof( uint64_t ) ) {
+  if ( length < (n + 1) * sizeof( uint64_t ) ) {
     throw runtime_error( "contest message too small to contain header" );
   }
 
-  const uint64_t * const data_ptr
-    = reinterpret_cast<const uint64_t *>( str.data() ) + n;
-
-  return be64toh( *data_ptr );
+  uint64_t network_order;
+  memcpy( &network_order, data + n * sizeof( uint64_t ), sizeof( network_order ) );
+  return be64toh( network_order );
 }
 
+/* Parse header in place from the start of a buffer */
+ContestMessage::Header::Header( const char * data, const size_t length )
+  : sequence_number( get_header_field( 0, data, length ) ),
+    send_timestamp( get_header_field( 1, data, length ) ),
+    ack_sequence_number( get_header_field( 2, data, length ) ),
+    ack_send_timestamp( get_header_field( 3, data, length ) ),
+    ack_recv_timestamp( get_header_field( 4, data, length ) ),
+    ack_payload_length( get_header_field( 5, data, length ) )
+{}
+
 /* Parse header from wire */
 ContestMessage::Header::Header( const string & str )
-  : sequence_number( get_header_field( 0, str ) ),
-    send_timestamp( get_header_field( 1, str ) ),
-    ack_sequence_number( get_header_field( 2, str ) ),
-    ack_send_timestamp( get_header_field( 3, str ) ),
-    ack_recv_timestamp( get_header_field( 4, str ) ),
-    ack_payload_length( get_header_field( 5, str ) )
+  : Header( str.data(), str.size() )
 {}
 
 /* Parse incoming message from wire */
 ContestMessage::ContestMessage( const string & str )
   : header( str ),
-    payload( str.begin() + sizeof( header ), str.end() )
+    payload( str.begin() + Header::wire_size, str.end() )
 {}
 
 /* Fill in the send_timestamp for an outgoing message */
 void ContestMessage::set_send_timestamp()
 {
-  header.send_timestamp = timestamp_ms();
+  header.send_timestamp = timestamp_ns();
 }
 
 /* helper to put a uint64_t field (in network byte order) */
-string put_header_field( const uint64_t n )
+static void put_header_field( const size_t n, const uint64_t value, char * buffer )
+{
+  const uint64_t network_order = htobe64( value );
+  memcpy( buffer + n * sizeof( uint64_t ), &network_order, sizeof( network_order ) );
+}
+
+/* Write wire representation of header into a buffer */
+void ContestMessage::Header::serialize( char * buffer ) const
 {
-  const uint64_t network_order = htobe64( n );
-  return string( reinterpret_cast<const char *>( &network_order ),
-		 sizeof( network_order ) );
+  put_header_field( 0, sequence_number, buffer );
+  put_header_field( 1, send_timestamp, buffer );
+  put_header_field( 2, ack_sequence_number, buffer );
+  put_header_field( 3, ack_send_timestamp, buffer );
+  put_header_field( 4, ack_recv_timestamp, buffer );
+  put_header_field( 5, ack_payload_length, buffer );
 }
 
 /* Make wire representation of header */
 string ContestMessage::Header::to_string() const
 {
-  return put_header_field( sequence_number )
-    + put_header_field( send_timestamp )
-    + put_header_field( ack_sequence_number )
-    + put_header_field( ack_send_timestamp )
-    + put_header_field( ack_recv_timestamp )
-    + put_header_field( ack_payload_length );
+  string ret( wire_size, 0 );
+  serialize( &ret[ 0 ] );
+  return ret;
 }
 
 /* Make wire representation of message */
@@ -65,20 +80,28 @@ string ContestMessage::to_string() const
   return header.to_string() + payload;
 }
 
-/* Transform into an ack of the ContestMessage */
-void ContestMessage::transform_into_ack( const uint64_t sequence_number,
-					 const uint64_t recv_timestamp )
+/* Transform into the header of an ack of this message */
+void ContestMessage::Header::transform_into_ack( const uint64_t s_sequence_number,
+						 const uint64_t recv_timestamp,
+						 const uint64_t payload_length )
 {
   /* ack the old sequence number */
-  header.ack_sequence_number = header.sequence_number;
+  ack_sequence_number = sequence_number;
 
   /* now assign a new sequence number for the outgoing ack */
-  header.sequence_number = sequence_number;
+  sequence_number = s_sequence_number;
 
   /* ack the other fields */
-  header.ack_send_timestamp = header.send_timestamp;
-  header.ack_recv_timestamp = recv_timestamp;
-  header.ack_payload_length = payload.length();
+  ack_send_timestamp = send_timestamp;
+  ack_recv_timestamp = recv_timestamp;
+  ack_payload_length = payload_length;
+}
+
+/* Transform into an ack of the ContestMessage */
+void ContestMessage::transform_into_ack( const uint64_t sequence_number,
+					 const uint64_t recv_timestamp )
+{
+  header.transform_into_ack( sequence_number, recv_timestamp, payload.length() );
 
   /* delete the payload */
   payload.clear();
@@ -101,8 +124,224 @@ ContestMessage::Header::Header( const uint64_t s_sequence_number )
     ack_payload_length( -1 )
 {}
 
+/* Is this the header of an ack? */
+bool ContestMessage::Header::is_ack() const
+{
+  return ack_sequence_number != uint64_t( -1 );
+}
+
 /* Is this message an ack? */
 bool ContestMessage::is_ack() const
 {
-  return header.ack_sequence_number != uint64_t( -1 );
+  return header.is_ack();
+}
+
+/* New message (with a payload owned by the caller) */
+ContestMessageView::ContestMessageView( const uint64_t s_sequence_number,
+					const char * s_payload, const size_t s_payload_length )
+  : header( s_sequence_number ),
+    payload( s_payload ),
+    payload_length( s_payload_length )
+{}
+
+/* Parse incoming datagram in place */
+ContestMessageView::ContestMessageView( const char * data, const size_t length )
+  : header( data, length ),
+    payload( data + ContestMessage::Header::wire_size ),
+    payload_length( length - ContestMessage::Header::wire_size )
+{}
+
+/* Fill in the send_timestamp for an outgoing message */
+void ContestMessageView::set_send_timestamp()
+{
+  header.send_timestamp = timestamp_ns();
+}
+
+/* Write wire representation into a buffer */
+void ContestMessageView::serialize( char * buffer ) const
+{
+  header.serialize( buffer );
+  memcpy( buffer + ContestMessage::Header::wire_size, payload, payload_length );
+}
+
+/* Write wire representation into a string (reusing its storage) */
+void ContestMessageView::serialize( string & out ) const
+{
+  out.resize( wire_size() );
+  serialize( &out[ 0 ] );
+}
+
+/* Transform into an ack (with no payload) */
+void ContestMessageView::transform_into_ack( const uint64_t sequence_number,
+					     const uint64_t recv_timestamp )
+{
+  header.transform_into_ack( sequence_number, recv_timestamp, payload_length );
+
+  /* drop the payload */
+  payload_length = 0;
+}
+
+/* first 4 bytes of a RangeAck (a ContestMessage starts with its sequence
+   number, whose top byte is zero) */
+static const uint32_t RANGE_ACK_MARKER = 0xDA7A4ACC;
+
+/* marker, range count, (unused), earliest arrival */
+static const size_t RANGE_ACK_HEADER_SIZE = 4 + 2 + 2 + 8;
+
+/* first sequence number and count, for each range */
+static const size_t RANGE_SIZE = 8 + 4;
+
+/* helpers to put and get big-endian integers */
+static void put_u16( const uint16_t value, char * buffer )
+{
+  const uint16_t network_order = htobe16( value );
+  memcpy( buffer, &network_order, sizeof( network_order ) );
+}
+
+static void put_u32( const uint32_t value, char * buffer )
+{
+  const uint32_t network_order = htobe32( value );
+  memcpy( buffer, &network_order, sizeof( network_order ) );
+}
+
+static void put_u64( const uint64_t value, char * buffer )
+{
+  const uint64_t network_order = htobe64( value );
+  memcpy( buffer, &network_order, sizeof( network_order ) );
+}
+
+static uint16_t get_u16( const char * data )
+{
+  uint16_t network_order;
+  memcpy( &network_order, data, sizeof( network_order ) );
+  return be16toh( network_order );
+}
+
+static uint32_t get_u32( const char * data )
+{
+  uint32_t network_order;
+  memcpy( &network_order, data, sizeof( network_order ) );
+  return be32toh( network_order );
+}
+
+static uint64_t get_u64( const char * data )
+{
+  uint64_t network_order;
+  memcpy( &network_order, data, sizeof( network_order ) );
+  return be64toh( network_order );
+}
+
+const size_t RangeAck::MAX_DATAGRAMS;
+const uint64_t RangeAck::MAX_SPAN_NS;
+
+/* Note a datagram's arrival */
+void RangeAck::add( const uint64_t sequence_number, const uint64_t recv_timestamp )
+{
+  if ( full() ) {
+    throw runtime_error( "RangeAck: too many datagrams" );
+  }
+
+  datagrams_.push_back( { sequence_number, recv_timestamp } );
+}
+
+/* Does this datagram hold a RangeAck? */
+bool RangeAck::is_range_ack( const char * data, const size_t length )
+{
+  return length >= RANGE_ACK_HEADER_SIZE and get_u32( data ) == RANGE_ACK_MARKER;
+}
+
+/* Write wire representation into a string */
+void RangeAck::serialize( string & out )
+{
+  if ( datagrams_.empty() ) {
+    throw runtime_error( "RangeAck: nothing to ack" );
+  }
+
+  /* in order, keeping the first arrival of any duplicate
+     (sort rather than stable_sort, which would allocate) */
+  sort( datagrams_.begin(), datagrams_.end(), [] ( const Datagram & a, const Datagram & b ) {
+      return a.sequence_number < b.sequence_number
+	or ( a.sequence_number == b.sequence_number and a.recv_timestamp < b.recv_timestamp );
+    } );
+  datagrams_.erase( unique( datagrams_.begin(), datagrams_.end(),
+			    [] ( const Datagram & a, const Datagram & b ) {
+			      return a.sequence_number == b.sequence_number; } ),
+		    datagrams_.end() );
+
+  size_t range_count = 1;
+  uint64_t earliest = datagrams_.front().recv_timestamp;
+  for ( size_t i = 1; i < datagrams_.size(); i++ ) {
+    if ( datagrams_[ i ].sequence_number != datagrams_[ i - 1 ].sequence_number + 1 ) {
+      range_count++;
+    }
+    earliest = min( earliest, datagrams_[ i ].recv_timestamp );
+  }
+
+  out.resize( RANGE_ACK_HEADER_SIZE + range_count * RANGE_SIZE + datagrams_.size() * sizeof( uint32_t ) );
+  char * buffer = &out[ 0 ];
+
+  put_u32( RANGE_ACK_MARKER, buffer );
+  put_u16( range_count, buffer + 4 );
+  put_u16( 0, buffer + 6 );
+  put_u64( earliest, buffer + 8 );
+  buffer += RANGE_ACK_HEADER_SIZE;
+
+  /* the ranges */
+  for ( size_t first = 0; first < datagrams_.size(); ) {
+    size_t last = first;
+    while ( last + 1 < datagrams_.size()
+	    and datagrams_[ last + 1 ].sequence_number == datagrams_[ last ].sequence_number + 1 ) {
+      last++;
+    }
+
+    put_u64( datagrams_[ first ].sequence_number, buffer );
+    put_u32( last - first + 1, buffer + 8 );
+    buffer += RANGE_SIZE;
+    first = last + 1;
+  }
+
+  /* then each arrival time, in the same order */
+  for ( const auto & datagram : datagrams_ ) {
+    const uint64_t offset = datagram.recv_timestamp - earliest;
+    if ( offset > MAX_SPAN_NS ) {
+      throw runtime_error( "RangeAck: arrivals too far apart" );
+    }
+    put_u32( offset, buffer );
+    buffer += sizeof( uint32_t );
+  }
+}
+
+/* Replace the contents with an ack parsed from the wire */
+void RangeAck::parse( const char * data, const size_t length )
+{
+  if ( not is_range_ack( data, length ) ) {
+    throw runtime_error( "not a RangeAck" );
+  }
+
+  const size_t range_count = get_u16( data + 4 );
+  const uint64_t earliest = get_u64( data + 8 );
+
+  const char * range = data + RANGE_ACK_HEADER_SIZE;
+  const char * offset = range + range_count * RANGE_SIZE;
+  const char * const end = data + length;
+  if ( offset > end ) {
+    throw runtime_error( "RangeAck too small to contain its ranges" );
+  }
+
+  datagrams_.clear();
+  for ( size_t i = 0; i < range_count; i++, range += RANGE_SIZE ) {
+    const uint64_t first = get_u64( range );
+    const uint32_t count = get_u32( range + 8 );
+    if ( count > size_t( end - offset ) / sizeof( uint32_t ) ) {
+      throw runtime_error( "RangeAck too small to contain its arrival times" );
+    }
+
+    for ( uint32_t j = 0; j < count; j++, offset += sizeof( uint32_t ) ) {
+      datagrams_.push_back( { first + j, earliest + get_u32( offset ) } );
+    }
+  }
+
+  if ( offset != end ) {
+    throw runtime_error( "RangeAck has trailing bytes" );
+  }
 }
@@ -3,9 +3,11 @@
 
 #include <string>
 #include <cstdint>
+#include <vector>
 
 struct ContestMessage
 {
+  /* all timestamps are in nanoseconds (each on its own host's clock) */
   struct Header {
     uint64_t sequence_number;
     uint64_t send_timestamp;
@@ -15,14 +17,32 @@ struct ContestMessage
     uint64_t ack_recv_timestamp;
     uint64_t ack_payload_length;
 
+    /* size of the header on the wire */
+    static const size_t wire_size = 6 * sizeof( uint64_t );
+
     /* Header for new message */
     Header( const uint64_t s_sequence_number );
 
     /* Parse header from wire */
     Header( const std::string & str );
 
+    /* Parse header in place from the start of a buffer */
+    Header( const char * data, const size_t length );
+
     /* Make wire representation of header */
     std::string to_string() const;
+
+    /* Write wire representation of header into a buffer
+       (which must have room for wire_size bytes) */
+    void serialize( char * buffer ) const;
+
+    /* Transform into the header of an ack of this message */
+    void transform_into_ack( const uint64_t sequence_number,
+			     const uint64_t recv_timestamp,
+			     const uint64_t payload_length );
+
+    /* Is this the header of an ack? */
+    bool is_ack() const;
   } header;
 
   std::string payload;
@@ -48,4 +68,86 @@ struct ContestMessage
   bool is_ack() const;
 };
 
+/* A message that doesn't own its payload: for encoding and decoding
+   datagrams without copying them or allocating memory. The payload
+   points into someone else's buffer and is valid only as long as it is. */
+struct ContestMessageView
+{
+  ContestMessage::Header header;
+
+  const char * payload;
+  size_t payload_length;
+
+  /* New message (with a payload owned by the caller) */
+  ContestMessageView( const uint64_t s_sequence_number,
+		      const char * s_payload, const size_t s_payload_length );
+
+  /* Parse incoming datagram in place */
+  ContestMessageView( const char * data, const size_t length );
+
+  /* Fill in the send_timestamp for an outgoing datagram */
+  void set_send_timestamp();
+
+  /* Size of the wire representation */
+  size_t wire_size() const { return ContestMessage::Header::wire_size + payload_length; }
+
+  /* Write wire representation into a buffer with room for wire_size() bytes */
+  void serialize( char * buffer ) const;
+
+  /* Write wire representation into a string (reusing its storage) */
+  void serialize( std::string & out ) const;
+
+  /* Transform into an ack (with no payload) */
+  void transform_into_ack( const uint64_t sequence_number,
+			   const uint64_t recv_timestamp );
+
+  /* Is this message an ack? */
+  bool is_ack() const { return header.is_ack(); }
+};
+
+/* A coalesced ack of several datagrams: their sequence numbers, as
+   ranges, and when each arrived, as an offset from the earliest. On
+   the wire that is 16 bytes, plus 12 per range and 4 per datagram
+   (instead of a 48-byte ack apiece). It doesn't echo the send
+   timestamps, since the sender has those already. */
+class RangeAck
+{
+public:
+  struct Datagram
+  {
+    uint64_t sequence_number;
+    uint64_t recv_timestamp;
+  };
+
+  /* most datagrams in one ack (so it stays well under an MTU) */
+  static const size_t MAX_DATAGRAMS = 64;
+
+  /* most time between the first and last arrival (so the offsets fit in 32 bits) */
+  static const uint64_t MAX_SPAN_NS = UINT32_MAX;
+
+private:
+  std::vector<Datagram> datagrams_;
+
+public:
+  RangeAck() : datagrams_() {}
+
+  /* note a datagram's arrival (ignoring duplicates when serialized) */
+  void add( const uint64_t sequence_number, const uint64_t recv_timestamp );
+
+  /* write the wire representation into a string (reusing its storage),
+     sorting the datagrams by sequence number */
+  void serialize( std::string & out );
+
+  /* replace the contents with an ack parsed from the wire */
+  void parse( const char * data, const size_t length );
+
+  /* does this datagram hold a RangeAck (rather than a ContestMessage)? */
+  static bool is_range_ack( const char * data, const size_t length );
+
+  void clear() { datagrams_.clear(); }
+  bool empty() const { return datagrams_.empty(); }
+  bool full() const { return datagrams_.size() >= MAX_DATAGRAMS; }
+  const std::vector<Datagram> & datagrams() const { return datagrams_; }
+};
+
 #endif /* CONTEST_MESSAGE_HH */
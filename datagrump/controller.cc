@@ -1,64 +1,49 @@
-#include <iostream>
-
 #include "controller.hh"
-#include "timestamp.hh"
 
 using namespace std;
 
 /* Default constructor */
-Controller::Controller( const bool debug )
-  : debug_( debug )
+Controller::Controller( const ControllerOptions & /* options */ )
 {}
 
 /* Get current window size, in datagrams */
 unsigned int Controller::window_size()
 {
-  /* Default: fixed window size of 100 outstanding datagrams */
+  /* Default: fixed window size of 50 outstanding datagrams */
   unsigned int the_window_size = 50;
 
-  if ( debug_ ) {
-    cerr << "At time " << timestamp_ms()
-	 << " window size is " << the_window_size << endl;
-  }
-
   return the_window_size;
 }
 
+/* Get target sending rate, in datagrams per second */
+double Controller::pacing_rate()
+{
+  /* Default: no pacing */
+  return 0;
+}
+
 /* A datagram was sent */
-void Controller::datagram_was_sent( const uint64_t sequence_number,
+void Controller::datagram_was_sent( const uint64_t /* sequence_number */,
 				    /* of the sent datagram */
-				    const uint64_t send_timestamp,
-                                    /* in milliseconds */
-				    const bool after_timeout
+				    const uint64_t /* send_timestamp */,
+                                    /* in nanoseconds */
+				    const bool /* after_timeout */
 				    /* datagram was sent because of a timeout */ )
 {
-  /* Default: take no action */
-
-  if ( debug_ ) {
-    cerr << "At time " << send_timestamp
-	 << " sent datagram " << sequence_number << " (timeout = " << after_timeout << ")\n";
-  }
+  /* Default: take no action (the sender logs each send when debugging) */
 }
 
 /* An ack was received */
-void Controller::ack_received( const uint64_t sequence_number_acked,
+void Controller::ack_received( const uint64_t /* sequence_number_acked */,
 			       /* what sequence number was acknowledged */
-			       const uint64_t send_timestamp_acked,
-			       /* when the acknowledged datagram was sent (sender's clock) */
-			       const uint64_t recv_timestamp_acked,
-			       /* when the acknowledged datagram was received (receiver's clock)*/
-			       const uint64_t timestamp_ack_received )
-                               /* when the ack was received (by sender) */
+			       const uint64_t /* send_timestamp_acked */,
+			       /* when the acknowledged datagram was sent (sender's clock, ns) */
+			       const uint64_t /* recv_timestamp_acked */,
+			       /* when the acknowledged datagram was received (receiver's clock, ns) */
+			       const uint64_t /* timestamp_ack_received */ )
+                               /* when the ack was received (by sender, ns) */
 {
   /* Default: take no action */
-
-  if ( debug_ ) {
-    cerr << "At time " << timestamp_ack_received
-	 << " received ack for datagram " << sequence_number_acked
-	 << " (send @ time " << send_timestamp_acked
-	 << ", received @ time " << recv_timestamp_acked << " by receiver's clock)"
-	 << endl;
-  }
 }
 
 /* How long to wait (in milliseconds) if there are no acks
@@ -3,13 +3,22 @@
 
 #include <cstdint>
 
+class EventTrace;
+
+/* Settings given to every congestion controller (see controller_registry.hh) */
+
+struct ControllerOptions
+{
+  EventTrace * trace = nullptr; /* for the controller's own events, if the
+				   sender is tracing or debugging (see event_trace.hh) */
+  uint64_t delay_target_ns = 100000000; /* for controllers that aim for a delay */
+};
+
 /* Congestion controller interface */
 
 class Controller
 {
 private:
-  bool debug_; /* Enables debugging output */
-
   /* Add member variables here */
 
 public:
@@ -18,17 +27,21 @@ public:
      the call site as well (in sender.cc) */
 
   /* Default constructor */
-  Controller( const bool debug );
+  Controller( const ControllerOptions & options );
 
   /* Get current window size, in datagrams */
   unsigned int window_size();
 
-  /* A datagram was sent */
+  /* Get target sending rate, in datagrams per second
+     (0 means send as soon as the window allows) */
+  double pacing_rate();
+
+  /* A datagram was sent (timestamps are in nanoseconds; see timestamp.hh) */
   void datagram_was_sent( const uint64_t sequence_number,
 			  const uint64_t send_timestamp,
 			  const bool after_timeout );
 
-  /* An ack was received */
+  /* An ack was received (timestamps are in nanoseconds) */
   void ack_received( const uint64_t sequence_number_acked,
 		     const uint64_t send_timestamp_acked,
 		     const uint64_t recv_timestamp_acked,
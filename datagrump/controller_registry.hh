@@ -0,0 +1,26 @@
+#ifndef CONTROLLER_REGISTRY_HH
+#define CONTROLLER_REGISTRY_HH
+
+#include "controller.hh"
+#include "delay_controller.hh"
+#include "bbr.hh"
+
+/* The congestion controllers the sender can run, by name.
+
+   Each is a class with Controller's interface (constructed from
+   ControllerOptions). Instead of choosing one through a virtual base
+   class, the caller's visitor is instantiated once per class, so the
+   sender's per-datagram and per-ack calls are direct (and inlinable).
+
+   The visitor needs a member template
+     template <class ControllerType> void visit( const char * name, const char * description );
+   To add a controller, include its header and add a line below. */
+template <class Visitor>
+void for_each_controller( Visitor & visitor )
+{
+  visitor.template visit<Controller>( "fixed", "fixed window (the default)" );
+  visitor.template visit<DelayController>( "delay", "keep the queueing delay near a target" );
+  visitor.template visit<BBR>( "bbr", "model the path's bandwidth and delay, and pace" );
+}
+
+#endif /* CONTROLLER_REGISTRY_HH */
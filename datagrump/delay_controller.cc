@@ -0,0 +1,149 @@
+#include <algorithm>
+
+#include "delay_controller.hh"
+#include "event_trace.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+/* where the window starts, and its bounds */
+static const double INITIAL_WINDOW = 50, MIN_WINDOW = 2, MAX_WINDOW = 100000;
+
+/* how long the empty-queue delay estimate lasts before it must be re-measured */
+static const uint64_t MIN_DELAY_WINDOW_NS = 10000000000;
+
+/* re-measure it (by draining the queue) well before it expires */
+static const uint64_t DRAIN_INTERVAL_NS = MIN_DELAY_WINDOW_NS / 2;
+
+/* per round trip, the window grows by up to INCREASE_GAIN of itself
+   when the queue is empty, and shrinks by DECREASE_GAIN of itself for
+   each target's worth of excess delay (but never more than halves);
+   growth is slow because its effect only shows a round trip later */
+static const double INCREASE_GAIN = 0.1, DECREASE_GAIN = 0.5;
+
+/* loss means the queue overflowed before its delay showed up */
+static const double LOSS_DECREASE = 0.7;
+
+DelayController::DelayController( const ControllerOptions & options )
+  : trace_( options.trace ),
+    delay_target_ns_( options.delay_target_ns ),
+    window_( INITIAL_WINDOW ),
+    min_one_way_delay_( MIN_DELAY_WINDOW_NS ),
+    min_delay_refreshed_ns_( 0 ),
+    draining_( false ),
+    window_before_drain_( 0 ),
+    drain_end_sequence_number_( 0 ),
+    round_max_queueing_delay_( 0 ),
+    round_end_sequence_number_( 0 ),
+    next_sequence_number_( 0 ),
+    next_ack_expected_( 0 ),
+    round_saw_loss_( false ),
+    rtt_()
+{}
+
+/* Get current window size, in datagrams */
+unsigned int DelayController::window_size()
+{
+  const unsigned int the_window_size = window_;
+
+  return the_window_size;
+}
+
+/* A datagram was sent */
+void DelayController::datagram_was_sent( const uint64_t sequence_number,
+					 const uint64_t /* send_timestamp */,
+					 const bool after_timeout )
+{
+  next_sequence_number_ = max( next_sequence_number_, sequence_number + 1 );
+
+  /* a timeout means the window was far too big (or everything was lost) */
+  if ( after_timeout ) {
+    window_ = max( MIN_WINDOW, window_ / 2 );
+    window_before_drain_ = max( MIN_WINDOW, window_before_drain_ / 2 );
+  }
+}
+
+/* An ack was received */
+void DelayController::ack_received( const uint64_t sequence_number_acked,
+				    const uint64_t send_timestamp_acked,
+				    const uint64_t recv_timestamp_acked,
+				    const uint64_t timestamp_ack_received )
+{
+  rtt_.update( timestamp_ack_received - send_timestamp_acked );
+
+  /* queueing delay: how far the one-way delay is above its recent minimum */
+  const int64_t one_way_delay = recv_timestamp_acked - send_timestamp_acked;
+  min_one_way_delay_.update( timestamp_ack_received, one_way_delay );
+  if ( one_way_delay <= min_one_way_delay_.best() ) {
+    min_delay_refreshed_ns_ = timestamp_ack_received;
+  }
+  round_max_queueing_delay_ = max( round_max_queueing_delay_,
+				   one_way_delay - min_one_way_delay_.best() );
+
+  if ( sequence_number_acked > next_ack_expected_ ) {
+    round_saw_loss_ = true;
+  }
+  next_ack_expected_ = max( next_ack_expected_, sequence_number_acked + 1 );
+
+  if ( draining_ ) {
+    /* the datagrams sent since the window shrank went through an
+       empty queue, so the estimate is fresh (the filter has them) */
+    if ( sequence_number_acked >= drain_end_sequence_number_ ) {
+      draining_ = false;
+      window_ = window_before_drain_;
+      min_delay_refreshed_ns_ = timestamp_ack_received;
+      start_round();
+    }
+    return;
+  }
+
+  if ( timestamp_ack_received - min_delay_refreshed_ns_ > DRAIN_INTERVAL_NS ) {
+    start_drain();
+    return;
+  }
+
+  if ( sequence_number_acked >= round_end_sequence_number_ ) {
+    end_round( timestamp_ack_received );
+  }
+}
+
+/* let the queue empty: hold the smallest window until the datagrams
+   sent from now on have been acked */
+void DelayController::start_drain()
+{
+  draining_ = true;
+  window_before_drain_ = window_;
+  window_ = MIN_WINDOW;
+  drain_end_sequence_number_ = next_sequence_number_ + MIN_WINDOW;
+}
+
+/* once per round trip, move the window towards the delay target */
+void DelayController::end_round( const uint64_t now )
+{
+  const double target = delay_target_ns_;
+  const double peak_delay = round_max_queueing_delay_;
+
+  if ( round_saw_loss_ ) {
+    window_ *= LOSS_DECREASE;
+  } else if ( peak_delay < target ) {
+    /* grow in proportion to the headroom (by at least one datagram) */
+    window_ += max( 1.0, window_ * INCREASE_GAIN * ( target - peak_delay ) / target );
+  } else {
+    window_ *= max( 0.5, 1 - DECREASE_GAIN * ( peak_delay - target ) / target );
+  }
+  window_ = min( MAX_WINDOW, max( MIN_WINDOW, window_ ) );
+
+  if ( trace_ ) {
+    trace_->round_ended( now, peak_delay, target, window_, round_saw_loss_ );
+  }
+
+  start_round();
+}
+
+/* the next round ends once everything sent so far has been acked */
+void DelayController::start_round()
+{
+  round_end_sequence_number_ = next_sequence_number_;
+  round_max_queueing_delay_ = 0;
+  round_saw_loss_ = false;
+}
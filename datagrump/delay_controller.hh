@@ -0,0 +1,82 @@
+#ifndef DELAY_CONTROLLER_HH
+#define DELAY_CONTROLLER_HH
+
+#include <cstdint>
+
+#include "controller.hh"
+#include "rtt_estimator.hh"
+#include "windowed_filter.hh"
+
+/* Delay-based congestion control: once per round trip, steer the
+   window to keep the queueing delay at or under a target
+   (same interface as Controller) */
+class DelayController
+{
+private:
+  EventTrace * trace_; /* for the end of each round (if tracing) */
+
+  uint64_t delay_target_ns_;
+
+  double window_; /* in datagrams */
+
+  /* one-way delay with an empty queue (each sample includes the
+     unknown offset between the two hosts' clocks, which cancels out) */
+  WindowedMinFilter<int64_t> min_one_way_delay_;
+  uint64_t min_delay_refreshed_ns_; /* when a sample last matched it */
+
+  /* while the queue we are holding hides the empty-queue delay, shrink
+     the window for a moment to let it drain (like BBR's ProbeRTT) */
+  bool draining_;
+  double window_before_drain_;
+  uint64_t drain_end_sequence_number_; /* the drain ends when this is acked */
+
+  void start_drain();
+
+  /* the largest queueing delay seen during the current round trip
+     (holding this to the target keeps nearly every datagram under it,
+     where the smallest would let the rest spread far above) */
+  int64_t round_max_queueing_delay_;
+  uint64_t round_end_sequence_number_; /* the round ends when this is acked */
+  uint64_t next_sequence_number_;      /* one past the latest datagram sent */
+
+  /* a gap in the acked sequence numbers means a datagram was lost
+     (the receiver acks everything, and reordering is rare) */
+  uint64_t next_ack_expected_;
+  bool round_saw_loss_;
+
+  RTTEstimator rtt_;
+
+  /* once per round trip, move the window towards the delay target */
+  void end_round( const uint64_t now );
+  void start_round();
+
+public:
+  DelayController( const ControllerOptions & options );
+
+  /* Get current window size, in datagrams */
+  unsigned int window_size();
+
+  /* Not paced */
+  double pacing_rate() { return 0; }
+
+  /* A datagram was sent (timestamps are in nanoseconds; see timestamp.hh) */
+  void datagram_was_sent( const uint64_t sequence_number,
+			  const uint64_t send_timestamp,
+			  const bool after_timeout );
+
+  /* An ack was received (timestamps are in nanoseconds) */
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received );
+
+  /* How long to wait (in milliseconds) if there are no acks
+     before sending one more datagram */
+  unsigned int timeout_ms() { return rtt_.timeout_ms(); }
+
+  /* forbid copying */
+  DelayController( const DelayController & other ) = delete;
+  const DelayController & operator=( const DelayController & other ) = delete;
+};
+
+#endif /* DELAY_CONTROLLER_HH */
@@ -0,0 +1,195 @@
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#include "event_trace.hh"
+#include "timestamp.hh"
+#include "util.hh"
+
+using namespace std;
+
+const string EventTrace::MAGIC = string( "DGTRACE" ) + char( 1 );
+
+/* e.g. "20.125" */
+static string milliseconds( const uint64_t ns )
+{
+  const string micros = to_string( ns / 1000 % 1000 );
+  return to_string( ns / 1000000 ) + "." + string( 3 - micros.size(), '0' ) + micros;
+}
+
+static size_t round_up_to_power_of_two( const size_t n )
+{
+  size_t ret = 1;
+  while ( ret < n ) {
+    ret *= 2;
+  }
+  return ret;
+}
+
+EventTrace::EventTrace( FileDescriptor && output, const bool text, const size_t capacity )
+  : ring_( round_up_to_power_of_two( capacity ) ),
+    head_( 0 ),
+    cached_tail_( 0 ),
+    last_window_( numeric_limits<uint32_t>::max() ),
+    producer_padding_(),
+    tail_( 0 ),
+    consumer_padding_(),
+    dropped_( 0 ),
+    output_( move( output ) ),
+    text_( text ),
+    buffer_(),
+    stopping_( false ),
+    drainer_()
+{
+  if ( capacity == 0 ) {
+    throw runtime_error( "EventTrace: capacity must be positive" );
+  }
+
+  if ( not text_ ) {
+    output_.write( MAGIC );
+  }
+
+  drainer_ = thread( [&] () {
+      try {
+	while ( not stopping_.load( memory_order_acquire ) ) {
+	  if ( not drain() ) {
+	    this_thread::sleep_for( chrono::milliseconds( 10 ) );
+	  }
+	}
+      } catch ( const exception & e ) {
+	print_exception( e ); /* (the trace stops, but not the sender) */
+      }
+    } );
+}
+
+EventTrace::~EventTrace()
+{
+  stopping_.store( true, memory_order_release );
+  drainer_.join();
+
+  try {
+    drain();
+  } catch ( const exception & e ) {
+    print_exception( e );
+  }
+
+  if ( dropped() ) {
+    cerr << "Event trace dropped " << dropped() << " events (ring full)" << endl;
+  }
+}
+
+void EventTrace::window( const unsigned int size )
+{
+  if ( size != last_window_ ) {
+    last_window_ = size;
+    push( { timestamp_ns(), Type::Window, size, { 0, 0, 0, 0 } } );
+  }
+}
+
+bool EventTrace::drain()
+{
+  const uint64_t head = head_.load( memory_order_acquire );
+  uint64_t tail = tail_.load( memory_order_relaxed );
+  if ( tail == head ) {
+    return false;
+  }
+
+  /* (the producer doesn't touch a slot until the tail moves past it) */
+  buffer_.clear();
+  for ( ; tail < head; tail++ ) {
+    const Record & record = ring_[ tail & ( ring_.size() - 1 ) ];
+    if ( text_ ) {
+      append_text( record, buffer_ );
+    } else {
+      buffer_.append( reinterpret_cast<const char *>( &record ), sizeof( record ) );
+    }
+  }
+  tail_.store( tail, memory_order_release );
+
+  output_.write( buffer_ );
+  return true;
+}
+
+void EventTrace::append_text( const Record & record, string & out )
+{
+  /* (as the controllers used to print them) */
+  out += "At time " + to_string( record.timestamp ) + " ";
+
+  switch ( record.type ) {
+  case Type::Send:
+    out += "sent datagram " + to_string( record.fields[ 0 ] )
+      + " (timeout = " + to_string( record.value ) + ")\n";
+    break;
+  case Type::Ack:
+    out += "received ack for datagram " + to_string( record.fields[ 0 ] )
+      + " (send @ time " + to_string( record.fields[ 1 ] )
+      + ", received @ time " + to_string( record.fields[ 2 ] )
+      + " by receiver's clock)\n";
+    break;
+  case Type::Window:
+    out += "window size is " + to_string( record.value ) + "\n";
+    break;
+  case Type::Loss:
+    out += "declared " + to_string( record.fields[ 0 ] ) + " datagrams lost ("
+      + to_string( record.fields[ 1 ] ) + " in all, "
+      + to_string( record.fields[ 2 ] ) + " acked after all)\n";
+    break;
+  case Type::Timeout:
+    out += "timed out with " + to_string( record.fields[ 0 ] ) + " datagrams in flight\n";
+    break;
+  case Type::Round:
+    out += "round ended with peak queueing delay " + milliseconds( record.fields[ 0 ] )
+      + " ms (target " + milliseconds( record.fields[ 1 ] ) + " ms)"
+      + ( record.value ? " and loss" : "" )
+      + "; window now " + to_string( record.fields[ 2 ] ) + "\n";
+    break;
+  case Type::Mode:
+    out += "entering mode " + to_string( record.value )
+      + " (bandwidth " + to_string( record.fields[ 0 ] )
+      + " datagrams/s, min RTT " + milliseconds( record.fields[ 1 ] ) + " ms)\n";
+    break;
+  default:
+    throw runtime_error( "EventTrace: unknown event type "
+			 + to_string( static_cast<uint32_t>( record.type ) ) );
+  }
+}
+
+string EventTrace::csv_header()
+{
+  return "time_ns,event,sequence_number,send_timestamp_ns,recv_timestamp_ns,value\n";
+}
+
+void EventTrace::append_csv( const Record & record, string & out )
+{
+  const string time = to_string( record.timestamp ) + ",";
+
+  switch ( record.type ) {
+  case Type::Send:
+    out += time + "send," + to_string( record.fields[ 0 ] ) + ","
+      + to_string( record.timestamp ) + ",," + to_string( record.value ) + "\n";
+    break;
+  case Type::Ack:
+    out += time + "ack," + to_string( record.fields[ 0 ] ) + ","
+      + to_string( record.fields[ 1 ] ) + "," + to_string( record.fields[ 2 ] ) + ",\n";
+    break;
+  case Type::Window:
+    out += time + "window,,,," + to_string( record.value ) + "\n";
+    break;
+  case Type::Loss:
+    out += time + "loss,,,," + to_string( record.fields[ 0 ] ) + "\n";
+    break;
+  case Type::Timeout:
+    out += time + "timeout,,,," + to_string( record.fields[ 0 ] ) + "\n";
+    break;
+  case Type::Round:
+    out += time + "round,,,," + to_string( record.fields[ 0 ] ) + "\n";
+    break;
+  case Type::Mode:
+    out += time + "mode,,,," + to_string( record.value ) + "\n";
+    break;
+  default:
+    throw runtime_error( "EventTrace: unknown event type "
+			 + to_string( static_cast<uint32_t>( record.type ) ) );
+  }
+}
@@ -0,0 +1,140 @@
+#ifndef EVENT_TRACE_HH
+#define EVENT_TRACE_HH
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "file_descriptor.hh"
+
+/* Per-packet event log for the sender: each event is a fixed-size
+   record put on a preallocated ring (by one thread, without locks or
+   system calls), and a background thread drains the ring to a file,
+   either as binary records (see trace-decode) or as text. If the ring
+   fills up, new events are dropped and counted rather than waited on. */
+class EventTrace
+{
+public:
+  enum class Type : uint32_t { Send = 1, Ack, Window, Loss, Timeout, Round, Mode };
+
+  struct Record
+  {
+    uint64_t timestamp; /* ns (see timestamp.hh) */
+    Type type;
+    uint32_t value;     /* Send: after a timeout?  Window: size  Round: any loss?  Mode: which */
+    uint64_t fields[ 4 ];
+    /* Send: sequence number
+       Ack: sequence number, send timestamp, receive timestamp (receiver's clock)
+       Loss: datagrams lost, lost in all, acked after all
+       Timeout: datagrams in flight
+       Round: peak queueing delay (ns), delay target (ns), new window
+       Mode: bandwidth (datagrams/s), min RTT (ns) */
+  };
+
+  /* start of a binary trace file (followed by the records, in host byte order) */
+  static const std::string MAGIC;
+
+private:
+  std::vector<Record> ring_; /* size is a power of 2 */
+
+  /* written only by the producer (and padded so that the two threads
+     don't share a cache line) */
+  std::atomic<uint64_t> head_;
+  uint64_t cached_tail_;
+  uint32_t last_window_;
+  char producer_padding_[ 64 ];
+
+  /* written only by the drainer */
+  std::atomic<uint64_t> tail_;
+  char consumer_padding_[ 64 ];
+
+  std::atomic<uint64_t> dropped_;
+
+  FileDescriptor output_;
+  bool text_;
+  std::string buffer_; /* the drainer's output, reused */
+
+  std::atomic<bool> stopping_;
+  std::thread drainer_;
+
+  void push( const Record & record )
+  {
+    const uint64_t head = head_.load( std::memory_order_relaxed );
+    if ( head - cached_tail_ >= ring_.size() ) {
+      cached_tail_ = tail_.load( std::memory_order_acquire );
+      if ( head - cached_tail_ >= ring_.size() ) {
+	dropped_.fetch_add( 1, std::memory_order_relaxed );
+	return;
+      }
+    }
+
+    ring_[ head & ( ring_.size() - 1 ) ] = record;
+    head_.store( head + 1, std::memory_order_release );
+  }
+
+  /* write out everything on the ring (returns false if it was empty) */
+  bool drain();
+
+public:
+  /* trace to `output` (binary records, or text if `text`), with room
+     for `capacity` events (rounded up to a power of 2) between drains */
+  EventTrace( FileDescriptor && output, const bool text, const size_t capacity = 1 << 16 );
+
+  /* drain what's left and stop the drainer */
+  ~EventTrace();
+
+  /* the events (call from one thread only) */
+  void sent( const uint64_t timestamp, const uint64_t sequence_number, const bool after_timeout )
+  {
+    push( { timestamp, Type::Send, after_timeout, { sequence_number, 0, 0, 0 } } );
+  }
+
+  void acked( const uint64_t timestamp, const uint64_t sequence_number,
+	      const uint64_t send_timestamp, const uint64_t recv_timestamp )
+  {
+    push( { timestamp, Type::Ack, 0, { sequence_number, send_timestamp, recv_timestamp, 0 } } );
+  }
+
+  /* (recorded only when the size changes) */
+  void window( const unsigned int size );
+
+  void lost( const uint64_t timestamp, const uint64_t count, const uint64_t lost_count,
+	     const uint64_t spurious_count )
+  {
+    push( { timestamp, Type::Loss, 0, { count, lost_count, spurious_count, 0 } } );
+  }
+
+  void timed_out( const uint64_t timestamp, const uint64_t in_flight )
+  {
+    push( { timestamp, Type::Timeout, 0, { in_flight, 0, 0, 0 } } );
+  }
+
+  /* controllers' own events (see ControllerOptions::trace) */
+  void round_ended( const uint64_t timestamp, const uint64_t peak_delay, const uint64_t delay_target,
+		    const unsigned int window, const bool loss )
+  {
+    push( { timestamp, Type::Round, loss, { peak_delay, delay_target, window, 0 } } );
+  }
+
+  void mode_changed( const uint64_t timestamp, const unsigned int mode,
+		     const uint64_t bandwidth, const uint64_t min_rtt )
+  {
+    push( { timestamp, Type::Mode, mode, { bandwidth, min_rtt, 0, 0 } } );
+  }
+
+  /* events dropped because the ring was full */
+  uint64_t dropped() const { return dropped_.load( std::memory_order_relaxed ); }
+
+  /* a record as a line of text, or of CSV (see csv_header()) */
+  static void append_text( const Record & record, std::string & out );
+  static void append_csv( const Record & record, std::string & out );
+  static std::string csv_header();
+
+  /* forbid copying */
+  EventTrace( const EventTrace & other ) = delete;
+  const EventTrace & operator=( const EventTrace & other ) = delete;
+};
+
+#endif /* EVENT_TRACE_HH */
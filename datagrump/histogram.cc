@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "histogram.hh"
+
+using namespace std;
+
+const unsigned int Histogram::SUB_BUCKET_BITS;
+const size_t Histogram::HALF_SUB_BUCKETS;
+const size_t Histogram::BUCKET_COUNT;
+
+Histogram::Histogram()
+  : buckets_(),
+    count_( 0 ),
+    sum_( 0 )
+{
+  for ( auto & bucket : buckets_ ) {
+    bucket.store( 0, memory_order_relaxed );
+  }
+}
+
+uint64_t Histogram::highest_value_in( const size_t bucket )
+{
+  if ( bucket >= BUCKET_COUNT ) {
+    throw out_of_range( "Histogram: no bucket " + to_string( bucket ) );
+  }
+
+  if ( bucket < 2 * HALF_SUB_BUCKETS ) {
+    return bucket;
+  }
+
+  const unsigned int shift = bucket / HALF_SUB_BUCKETS - 1;
+  const uint64_t lowest = uint64_t( bucket - shift * HALF_SUB_BUCKETS ) << shift;
+  return lowest + ( ( uint64_t( 1 ) << shift ) - 1 );
+}
+
+void Histogram::snapshot( Snapshot & out ) const
+{
+  /* (the totals first, so a record that lands in between shows up in
+     a bucket but not yet in the count, rather than the other way around) */
+  out.count = count_.load( memory_order_relaxed );
+  out.sum = sum_.load( memory_order_relaxed );
+  for ( size_t i = 0; i < BUCKET_COUNT; i++ ) {
+    out.counts[ i ] = buckets_[ i ].load( memory_order_relaxed );
+  }
+}
+
+uint64_t Histogram::Snapshot::percentile( const double fraction ) const
+{
+  if ( count == 0 ) {
+    return 0;
+  }
+
+  /* the rank of the value (at least the first) */
+  const uint64_t rank = std::max( 1.0, ceil( fraction * count ) );
+
+  uint64_t seen = 0;
+  size_t last_nonempty = 0;
+  for ( size_t i = 0; i < BUCKET_COUNT; i++ ) {
+    if ( counts[ i ] ) {
+      seen += counts[ i ];
+      last_nonempty = i;
+      if ( seen >= rank ) {
+	return highest_value_in( i );
+      }
+    }
+  }
+
+  /* (a snapshot taken while a value was being recorded can come up short) */
+  return highest_value_in( last_nonempty );
+}
+
+Histogram::Snapshot & Histogram::Snapshot::operator+=( const Snapshot & other )
+{
+  for ( size_t i = 0; i < BUCKET_COUNT; i++ ) {
+    counts[ i ] += other.counts[ i ];
+  }
+  count += other.count;
+  sum += other.sum;
+  return *this;
+}
+
+Histogram::Snapshot & Histogram::Snapshot::operator-=( const Snapshot & other )
+{
+  for ( size_t i = 0; i < BUCKET_COUNT; i++ ) {
+    counts[ i ] -= other.counts[ i ];
+  }
+  count -= other.count;
+  sum -= other.sum;
+  return *this;
+}
@@ -0,0 +1,115 @@
+#ifndef HISTOGRAM_HH
+#define HISTOGRAM_HH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/* Constant-memory histogram of 64-bit values in the style of
+   HdrHistogram: exact below 128, and above that, 64 buckets per power
+   of two (so each bucket is within 1/64 of its values). One thread
+   records, with plain (relaxed atomic) loads and stores and no locked
+   instructions; any other thread may take a snapshot at any time. */
+class Histogram
+{
+public:
+  static const unsigned int SUB_BUCKET_BITS = 7;
+  static const size_t HALF_SUB_BUCKETS = size_t( 1 ) << ( SUB_BUCKET_BITS - 1 );
+  static const size_t BUCKET_COUNT = ( 66 - SUB_BUCKET_BITS ) * HALF_SUB_BUCKETS;
+
+  static size_t bucket_of( const uint64_t value )
+  {
+    if ( value < 2 * HALF_SUB_BUCKETS ) {
+      return value;
+    }
+
+    /* keep the top SUB_BUCKET_BITS bits */
+    const unsigned int shift = 63 - __builtin_clzll( value ) - ( SUB_BUCKET_BITS - 1 );
+    return shift * HALF_SUB_BUCKETS + ( value >> shift );
+  }
+
+  /* the largest value that falls in a bucket */
+  static uint64_t highest_value_in( const size_t bucket );
+
+  /* counts at one moment (or, after subtracting an earlier snapshot, over an interval) */
+  struct Snapshot
+  {
+    std::vector<uint64_t> counts = std::vector<uint64_t>( BUCKET_COUNT );
+    uint64_t count = 0, sum = 0;
+
+    /* the value at or below which `fraction` of the values fall (0 if empty) */
+    uint64_t percentile( const double fraction ) const;
+
+    uint64_t max() const { return percentile( 1 ); }
+    double mean() const { return count ? double( sum ) / count : 0; }
+
+    Snapshot & operator+=( const Snapshot & other );
+    Snapshot & operator-=( const Snapshot & other );
+  };
+
+private:
+  std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_;
+  std::atomic<uint64_t> count_, sum_;
+
+  static void bump( std::atomic<uint64_t> & counter, const uint64_t amount )
+  {
+    counter.store( counter.load( std::memory_order_relaxed ) + amount, std::memory_order_relaxed );
+  }
+
+public:
+  Histogram();
+
+  /* (call from one thread only) */
+  void record( const uint64_t value )
+  {
+    bump( buckets_[ bucket_of( value ) ], 1 );
+    bump( count_, 1 );
+    bump( sum_, value );
+  }
+
+  /* (call from any thread) */
+  void snapshot( Snapshot & out ) const;
+};
+
+/* an event counter with the same rules: one thread adds, any thread reads */
+class Counter
+{
+private:
+  std::atomic<uint64_t> value_;
+
+public:
+  Counter() : value_( 0 ) {}
+
+  void add( const uint64_t amount = 1 )
+  {
+    value_.store( value_.load( std::memory_order_relaxed ) + amount, std::memory_order_relaxed );
+  }
+
+  uint64_t value() const { return value_.load( std::memory_order_relaxed ); }
+};
+
+/* One-way delay as far as it can be known without synchronized clocks
+   (each program counts time from its own start): how far each datagram's
+   apparent delay is above the smallest seen so far */
+class OneWayDelay
+{
+private:
+  int64_t min_apparent_delay_;
+  bool any_;
+
+public:
+  OneWayDelay() : min_apparent_delay_( 0 ), any_( false ) {}
+
+  uint64_t above_minimum( const uint64_t send_timestamp, const uint64_t recv_timestamp )
+  {
+    const int64_t apparent_delay = recv_timestamp - send_timestamp;
+    if ( not any_ or apparent_delay < min_apparent_delay_ ) {
+      min_apparent_delay_ = apparent_delay;
+      any_ = true;
+    }
+    return apparent_delay - min_apparent_delay_;
+  }
+};
+
+#endif /* HISTOGRAM_HH */
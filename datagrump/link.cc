@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "link.hh"
+
+using namespace std;
+
+LinkTrace::LinkTrace( const string & filename )
+  : opportunities_ns_(), period_ns_( 0 )
+{
+  ifstream file( filename );
+  if ( not file.is_open() ) {
+    throw runtime_error( "could not open trace " + filename );
+  }
+
+  uint64_t ms;
+  while ( file >> ms ) {
+    if ( not opportunities_ns_.empty() and ms * 1000000 < opportunities_ns_.back() ) {
+      throw runtime_error( "trace " + filename + " goes backwards in time" );
+    }
+    opportunities_ns_.push_back( ms * 1000000 );
+  }
+
+  if ( not file.eof() ) {
+    throw runtime_error( "trace " + filename + " has something other than times in it" );
+  }
+
+  if ( opportunities_ns_.empty() or opportunities_ns_.back() == 0 ) {
+    throw runtime_error( "trace " + filename + " must last at least 1 ms" );
+  }
+
+  period_ns_ = opportunities_ns_.back();
+}
+
+/* the time of opportunity number `index` (counting through repeats) */
+uint64_t LinkTrace::opportunity( const uint64_t index ) const
+{
+  const uint64_t repeat = index / opportunities_ns_.size();
+  return repeat * period_ns_ + opportunities_ns_[ index % opportunities_ns_.size() ];
+}
+
+/* average capacity, in bits per second */
+double LinkTrace::capacity_bps() const
+{
+  return opportunities_ns_.size() * Link::MTU * 8 * 1e9 / period_ns_;
+}
+
+LinkQueue::LinkQueue()
+  : packets_(), bytes_( 0 ), dropped_packets_( 0 ), dropped_bytes_( 0 )
+{}
+
+void LinkQueue::drop( const LinkPacket & packet )
+{
+  dropped_packets_++;
+  dropped_bytes_ += packet.size;
+}
+
+LinkPacket LinkQueue::pop_front()
+{
+  LinkPacket packet = move( packets_.front() );
+  packets_.pop_front();
+  bytes_ -= packet.size;
+  return packet;
+}
+
+/* how many packets and bytes were dropped since the last call */
+pair<uint64_t, uint64_t> LinkQueue::take_drops()
+{
+  const auto ret = make_pair( dropped_packets_, dropped_bytes_ );
+  dropped_packets_ = dropped_bytes_ = 0;
+  return ret;
+}
+
+unique_ptr<LinkQueue> LinkQueue::make( const string & name,
+				       const uint64_t packets, const uint64_t bytes )
+{
+  if ( name == "infinite" ) {
+    return unique_ptr<LinkQueue>( new DropTailQueue( 0, 0 ) );
+  } else if ( name == "droptail" ) {
+    return unique_ptr<LinkQueue>( new DropTailQueue( packets, bytes ) );
+  } else if ( name == "codel" ) {
+    return unique_ptr<LinkQueue>( new CoDelQueue( packets, bytes ) );
+  }
+
+  throw runtime_error( "unknown queue type " + name + " (expected infinite, droptail or codel)" );
+}
+
+DropTailQueue::DropTailQueue( const uint64_t packet_limit, const uint64_t byte_limit )
+  : packet_limit_( packet_limit ), byte_limit_( byte_limit )
+{}
+
+bool DropTailQueue::enqueue( LinkPacket && packet, const uint64_t )
+{
+  if ( ( packet_limit_ and packets_.size() + 1 > packet_limit_ )
+       or ( byte_limit_ and bytes_ + packet.size > byte_limit_ ) ) {
+    drop( packet );
+    return false;
+  }
+
+  bytes_ += packet.size;
+  packets_.push_back( move( packet ) );
+  return true;
+}
+
+bool DropTailQueue::dequeue( LinkPacket & packet, const uint64_t )
+{
+  if ( packets_.empty() ) {
+    return false;
+  }
+
+  packet = pop_front();
+  return true;
+}
+
+string DropTailQueue::to_string() const
+{
+  if ( packet_limit_ == 0 and byte_limit_ == 0 ) {
+    return "infinite";
+  }
+
+  string ret = "droptail [";
+  if ( packet_limit_ ) {
+    ret += "packets=" + std::to_string( packet_limit_ );
+  }
+  if ( byte_limit_ ) {
+    ret += string( packet_limit_ ? ", " : "" ) + "bytes=" + std::to_string( byte_limit_ );
+  }
+  return ret + "]";
+}
+
+CoDelQueue::CoDelQueue( const uint64_t packet_limit, const uint64_t byte_limit,
+			const uint64_t target_ns, const uint64_t interval_ns )
+  : DropTailQueue( packet_limit, byte_limit ),
+    target_ns_( target_ns ),
+    interval_ns_( interval_ns ),
+    first_above_time_( 0 ),
+    drop_next_( 0 ),
+    count_( 0 ),
+    last_count_( 0 ),
+    dropping_( false )
+{}
+
+/* when to drop next: sooner the more drops it has taken so far */
+uint64_t CoDelQueue::control_law( const uint64_t t ) const
+{
+  return t + interval_ns_ / sqrt( count_ );
+}
+
+/* dequeue one packet, and say whether CoDel would drop it
+   (the packet has been above target for at least an interval) */
+bool CoDelQueue::dequeue_and_judge( LinkPacket & packet, const uint64_t now, bool & ok_to_drop )
+{
+  ok_to_drop = false;
+
+  if ( not DropTailQueue::dequeue( packet, now ) ) {
+    first_above_time_ = 0;
+    return false;
+  }
+
+  const uint64_t sojourn_time = now - packet.arrival_time;
+  if ( sojourn_time < target_ns_ or bytes_ <= Link::MTU ) {
+    /* went below target, or there's too little queue to matter */
+    first_above_time_ = 0;
+  } else if ( first_above_time_ == 0 ) {
+    first_above_time_ = now + interval_ns_;
+  } else if ( now >= first_above_time_ ) {
+    ok_to_drop = true;
+  }
+
+  return true;
+}
+
+/* RFC 8289's dequeue() */
+bool CoDelQueue::dequeue( LinkPacket & packet, const uint64_t now )
+{
+  bool ok_to_drop;
+  if ( not dequeue_and_judge( packet, now, ok_to_drop ) ) {
+    dropping_ = false;
+    return false;
+  }
+
+  if ( dropping_ ) {
+    if ( not ok_to_drop ) {
+      /* sojourn time below target: leave the dropping state */
+      dropping_ = false;
+    }
+
+    /* drop packets until the next one is in the future */
+    while ( dropping_ and now >= drop_next_ ) {
+      drop( packet );
+      count_++;
+      if ( not dequeue_and_judge( packet, now, ok_to_drop ) ) {
+	dropping_ = false;
+	return false;
+      }
+      if ( not ok_to_drop ) {
+	dropping_ = false;
+      } else {
+	drop_next_ = control_law( drop_next_ );
+      }
+    }
+  } else if ( ok_to_drop ) {
+    /* enter the dropping state, starting from about where we left off
+       if it was recently */
+    drop( packet );
+    const bool have_packet = dequeue_and_judge( packet, now, ok_to_drop );
+    dropping_ = true;
+    const uint64_t delta = count_ - last_count_;
+    const bool recently = now < drop_next_ or now - drop_next_ < 16 * interval_ns_;
+    count_ = ( delta > 1 and recently ) ? delta : 1;
+    drop_next_ = control_law( now );
+    last_count_ = count_;
+    return have_packet;
+  }
+
+  return true;
+}
+
+string CoDelQueue::to_string() const
+{
+  return "codel [target=" + std::to_string( target_ns_ / 1000000 )
+    + ", interval=" + std::to_string( interval_ns_ / 1000000 ) + "]";
+}
+
+Link::Link( const string & trace_filename, unique_ptr<LinkQueue> && queue,
+	    const uint64_t propagation_delay_ns )
+  : Link( LinkTrace( trace_filename ), move( queue ), propagation_delay_ns )
+{}
+
+Link::Link( const LinkTrace & trace, unique_ptr<LinkQueue> && queue,
+	    const uint64_t propagation_delay_ns )
+  : trace_( trace ),
+    queue_( move( queue ) ),
+    propagation_delay_ns_( propagation_delay_ns ),
+    next_opportunity_index_( 0 ),
+    next_opportunity_( trace_.opportunity( 0 ) ),
+    in_transit_( false ),
+    packet_in_transit_(),
+    bytes_left_in_transit_( 0 ),
+    propagating_(),
+    dropped_packets_( 0 ),
+    log_( nullptr )
+{}
+
+/* write a log like mm-link's, starting with this header */
+void Link::set_log( ostream & log, const string & description, const uint64_t init_timestamp_ms )
+{
+  log_ = &log;
+  *log_ << "# " << description << endl
+	<< "# queue: " << queue_->to_string() << endl
+	<< "# init timestamp: " << init_timestamp_ms << endl
+	<< "# base timestamp: 0" << endl;
+}
+
+void Link::log_drops( const uint64_t now )
+{
+  const auto drops = queue_->take_drops();
+  dropped_packets_ += drops.first;
+  if ( log_ and drops.first ) {
+    *log_ << log_time( now ) << " d " << drops.first << " " << drops.second << "\n";
+  }
+}
+
+/* a packet arrives at time `now` */
+void Link::enqueue( LinkPacket && packet, const uint64_t now )
+{
+  packet.arrival_time = now;
+
+  if ( log_ ) {
+    *log_ << log_time( now ) << " + " << packet.size << "\n";
+  }
+
+  queue_->enqueue( move( packet ), now );
+  log_drops( now );
+}
+
+/* use every delivery opportunity up to `now` */
+void Link::advance( const uint64_t now )
+{
+  while ( next_opportunity_ <= now ) {
+    const uint64_t t = next_opportunity_;
+
+    if ( log_ ) {
+      *log_ << log_time( t ) << " # " << MTU << "\n";
+    }
+
+    /* send up to an MTU's worth of bytes (packets can span opportunities) */
+    size_t budget = MTU;
+    while ( budget ) {
+      if ( not in_transit_ ) {
+	const bool got_packet = queue_->dequeue( packet_in_transit_, t );
+	log_drops( t );
+	if ( not got_packet ) {
+	  break;
+	}
+	in_transit_ = true;
+	bytes_left_in_transit_ = packet_in_transit_.size;
+      }
+
+      const size_t sent = min( budget, bytes_left_in_transit_ );
+      budget -= sent;
+      bytes_left_in_transit_ -= sent;
+
+      if ( bytes_left_in_transit_ == 0 ) {
+	if ( log_ ) {
+	  *log_ << log_time( t ) << " - " << packet_in_transit_.size << " "
+		<< log_time( t ) - log_time( packet_in_transit_.arrival_time ) << "\n";
+	}
+	propagating_.emplace_back( t + propagation_delay_ns_, move( packet_in_transit_ ) );
+	in_transit_ = false;
+      }
+    }
+
+    next_opportunity_ = trace_.opportunity( ++next_opportunity_index_ );
+  }
+}
+
+/* take a packet that has finished propagating by `now` */
+bool Link::take_delivered( LinkPacket & packet, const uint64_t now )
+{
+  if ( propagating_.empty() or propagating_.front().first > now ) {
+    return false;
+  }
+
+  packet = move( propagating_.front().second );
+  propagating_.pop_front();
+  return true;
+}
+
+/* the next time anything will happen on its own */
+uint64_t Link::next_event_time() const
+{
+  uint64_t ret = numeric_limits<uint64_t>::max();
+
+  if ( in_transit_ or not queue_->empty() ) {
+    ret = next_opportunity_;
+  }
+
+  if ( not propagating_.empty() ) {
+    ret = min( ret, propagating_.front().first );
+  }
+
+  return ret;
+}
@@ -0,0 +1,199 @@
+#ifndef LINK_HH
+#define LINK_HH
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Trace-driven model of a bottleneck link, after mahimahi's mm-link and
+   mm-delay: packets wait in a queue, leave it using the delivery
+   opportunities listed in a trace, then take a fixed propagation delay.
+
+   The model doesn't read a clock: callers pass in the time (in ns, from
+   whatever origin they like), so it can run in real time, sped up, or
+   in simulation. */
+
+/* a packet in the emulated network */
+struct LinkPacket
+{
+  uint64_t arrival_time; /* when it entered the link */
+  size_t size;           /* bytes on the wire (what the trace's opportunities carry) */
+  std::string contents;  /* (may be empty in simulation) */
+  uint64_t tag;          /* for the caller's use */
+
+  LinkPacket( const size_t s_size = 0, std::string && s_contents = std::string(),
+	      const uint64_t s_tag = 0 )
+    : arrival_time( 0 ), size( s_size ), contents( std::move( s_contents ) ), tag( s_tag )
+  {}
+};
+
+/* mahimahi packet-delivery trace: each line is the time (in ms) of an
+   opportunity to deliver one MTU-sized packet; the trace repeats */
+class LinkTrace
+{
+private:
+  std::vector<uint64_t> opportunities_ns_;
+  uint64_t period_ns_;
+
+public:
+  LinkTrace( const std::string & filename );
+
+  /* the time of opportunity number `index` (counting through repeats) */
+  uint64_t opportunity( const uint64_t index ) const;
+
+  /* how long one pass through the trace lasts */
+  uint64_t period_ns() const { return period_ns_; }
+
+  /* average capacity, in bits per second */
+  double capacity_bps() const;
+};
+
+/* the link's queue discipline */
+class LinkQueue
+{
+protected:
+  std::deque<LinkPacket> packets_;
+  uint64_t bytes_;
+
+  /* drops since the last call to take_drops() */
+  uint64_t dropped_packets_, dropped_bytes_;
+
+  void drop( const LinkPacket & packet );
+  LinkPacket pop_front();
+
+public:
+  LinkQueue();
+  virtual ~LinkQueue() {}
+
+  /* returns false if the packet was dropped */
+  virtual bool enqueue( LinkPacket && packet, const uint64_t now ) = 0;
+
+  /* returns false if there was nothing (left) to dequeue */
+  virtual bool dequeue( LinkPacket & packet, const uint64_t now ) = 0;
+
+  /* description for the log header, as in mahimahi */
+  virtual std::string to_string() const = 0;
+
+  bool empty() const { return packets_.empty(); }
+  uint64_t bytes() const { return bytes_; }
+
+  /* how many packets and bytes were dropped since the last call */
+  std::pair<uint64_t, uint64_t> take_drops();
+
+  /* make a queue from a name ("infinite", "droptail" or "codel"),
+     limited to `packets` and/or `bytes` (zero means no limit) */
+  static std::unique_ptr<LinkQueue> make( const std::string & name,
+					  const uint64_t packets, const uint64_t bytes );
+};
+
+/* first come, first served, with arrivals dropped once the queue is full */
+class DropTailQueue : public LinkQueue
+{
+private:
+  uint64_t packet_limit_, byte_limit_;
+
+public:
+  DropTailQueue( const uint64_t packet_limit, const uint64_t byte_limit );
+
+  bool enqueue( LinkPacket && packet, const uint64_t now ) override;
+  bool dequeue( LinkPacket & packet, const uint64_t now ) override;
+  std::string to_string() const override;
+};
+
+/* Controlled Delay AQM (Nichols and Jacobson, RFC 8289): drops at the head
+   of the queue once packets have spent more than `target` in it for at
+   least `interval`, at a rate that rises until the delay comes down */
+class CoDelQueue : public DropTailQueue
+{
+private:
+  uint64_t target_ns_, interval_ns_;
+
+  uint64_t first_above_time_, drop_next_;
+  uint64_t count_, last_count_;
+  bool dropping_;
+
+  /* dequeue one packet, and say whether CoDel would drop it */
+  bool dequeue_and_judge( LinkPacket & packet, const uint64_t now, bool & ok_to_drop );
+  uint64_t control_law( const uint64_t t ) const;
+
+public:
+  CoDelQueue( const uint64_t packet_limit, const uint64_t byte_limit,
+	      const uint64_t target_ns = 5000000, const uint64_t interval_ns = 100000000 );
+
+  bool dequeue( LinkPacket & packet, const uint64_t now ) override;
+  std::string to_string() const override;
+};
+
+/* one direction of the link */
+class Link
+{
+private:
+  LinkTrace trace_;
+  std::unique_ptr<LinkQueue> queue_;
+  uint64_t propagation_delay_ns_;
+
+  /* the next delivery opportunity */
+  uint64_t next_opportunity_index_, next_opportunity_;
+
+  /* the packet being sent, and how much of it is left to send */
+  bool in_transit_;
+  LinkPacket packet_in_transit_;
+  size_t bytes_left_in_transit_;
+
+  /* packets that have left the queue and are propagating */
+  std::deque<std::pair<uint64_t, LinkPacket>> propagating_;
+
+  /* packets the queue has dropped, in total */
+  uint64_t dropped_packets_;
+
+  /* mahimahi-format log (if any) */
+  std::ostream * log_;
+
+  /* log times in ms after the origin (times passed to the link are in ns) */
+  static uint64_t log_time( const uint64_t t ) { return t / 1000000; }
+
+  void log_drops( const uint64_t now );
+
+public:
+  /* bytes delivered per opportunity */
+  static const size_t MTU = 1500;
+
+  Link( const std::string & trace_filename, std::unique_ptr<LinkQueue> && queue,
+	const uint64_t propagation_delay_ns );
+
+  /* (with a trace that has already been read) */
+  Link( const LinkTrace & trace, std::unique_ptr<LinkQueue> && queue,
+	const uint64_t propagation_delay_ns );
+
+  /* forbid copying (the log is shared) */
+  Link( const Link & other ) = delete;
+  const Link & operator=( const Link & other ) = delete;
+
+  /* write a log like mm-link's --uplink-log, starting with this header
+     (times are relative to 0, which is `init_timestamp_ms` in real time) */
+  void set_log( std::ostream & log, const std::string & description,
+		const uint64_t init_timestamp_ms );
+
+  /* a packet arrives at time `now` (call advance( now ) first) */
+  void enqueue( LinkPacket && packet, const uint64_t now );
+
+  /* use every delivery opportunity up to `now` */
+  void advance( const uint64_t now );
+
+  /* take a packet that has finished propagating by `now` (false if none) */
+  bool take_delivered( LinkPacket & packet, const uint64_t now );
+
+  /* the next time anything will happen on its own (or -1 if idle) */
+  uint64_t next_event_time() const;
+
+  /* accessors */
+  const LinkTrace & trace() const { return trace_; }
+  uint64_t queued_bytes() const { return queue_->bytes(); }
+  uint64_t dropped_packets() const { return dropped_packets_; }
+};
+
+#endif /* LINK_HH */
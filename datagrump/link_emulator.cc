@@ -0,0 +1,211 @@
+/* trace-driven link emulator: relays UDP between the sender and the
+   receiver through an emulated bottleneck in each direction (see link.hh),
+   as the contest's mm-delay/mm-link shells would, but without needing
+   mahimahi, network namespaces or root */
+
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include <signal.h>
+
+#include "link.hh"
+#include "poller.hh"
+#include "socket.hh"
+#include "timestamp.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* IPv4 and UDP headers: mahimahi's traces and logs count whole IP packets */
+static const size_t IP_UDP_HEADER_BYTES = 28;
+
+/* command-line options */
+struct EmulatorOptions
+{
+  uint64_t delay_ms = 20;       /* one-way propagation delay, in each direction */
+  string queue = "infinite";    /* queue discipline (see LinkQueue::make) */
+  uint64_t packets = 0, bytes = 0; /* ... and its limits (zero means none) */
+  string uplink_log {};         /* mm-link --uplink-log equivalent */
+  double speedup = 1;           /* run the traces this many times faster than real time */
+  bool once = false;            /* stop at the end of the uplink trace */
+};
+
+/* with no SA_RESTART, an interrupted poll() returns and we can shut down cleanly */
+static void handle_signal( int ) {}
+
+static bool parse_option( const string & option, EmulatorOptions & options )
+{
+  const size_t equals = option.find( '=' );
+  const string name = option.substr( 0, equals );
+  const string value = equals == string::npos ? "" : option.substr( equals + 1 );
+
+  try {
+    if ( option == "once" ) {
+      options.once = true;
+    } else if ( name == "delay" ) {
+      options.delay_ms = stoull( value );
+    } else if ( name == "queue" ) {
+      options.queue = value;
+    } else if ( name == "packets" ) {
+      options.packets = stoull( value );
+    } else if ( name == "bytes" ) {
+      options.bytes = stoull( value );
+    } else if ( name == "uplink-log" ) {
+      options.uplink_log = value;
+    } else if ( name == "speedup" ) {
+      options.speedup = stod( value );
+      return options.speedup > 0;
+    } else {
+      return false;
+    }
+  } catch ( const exception & ) {
+    return false;
+  }
+
+  return true;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  EmulatorOptions options;
+  bool usage_ok = argc >= 6;
+  for ( int i = 6; i < argc; i++ ) {
+    usage_ok = usage_ok and parse_option( argv[ i ], options );
+  }
+
+  if ( not usage_ok ) {
+    cerr << "Usage: " << argv[ 0 ] << " UPLINK_TRACE DOWNLINK_TRACE LISTEN_PORT RECEIVER_HOST RECEIVER_PORT"
+	 << " [delay=MS] [queue=infinite|droptail|codel] [packets=N] [bytes=N]"
+	 << " [uplink-log=FILE] [speedup=X] [once]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    const uint64_t delay_ns = options.delay_ms * 1000000;
+    Link uplink( argv[ 1 ], LinkQueue::make( options.queue, options.packets, options.bytes ), delay_ns );
+    Link downlink( argv[ 2 ], LinkQueue::make( options.queue, options.packets, options.bytes ), delay_ns );
+
+    ofstream log;
+    if ( not options.uplink_log.empty() ) {
+      log.open( options.uplink_log );
+      if ( not log.is_open() ) {
+	throw runtime_error( "could not open " + options.uplink_log );
+      }
+
+      timespec now;
+      SystemCall( "clock_gettime", clock_gettime( CLOCK_REALTIME, &now ) );
+      uplink.set_log( log, string( "link-emulator (uplink) [" ) + argv[ 1 ] + "] > " + options.uplink_log,
+		      now.tv_sec * 1000 + now.tv_nsec / 1000000 );
+    }
+
+    /* the sender talks to us as if we were the receiver */
+    UDPSocket sender_side;
+    sender_side.bind( Address( "::0", argv[ 3 ] ) );
+    Address sender_address;
+    bool have_sender = false;
+
+    /* (not connected: an ICMP error while the receiver isn't up yet would end the poll) */
+    UDPSocket receiver_side;
+    const Address receiver_address( argv[ 4 ], argv[ 5 ] );
+
+    cerr << "Relaying " << sender_side.local_address().to_string()
+	 << " to " << receiver_address.to_string()
+	 << " (uplink " << uplink.trace().capacity_bps() / 1e6 << " Mbit/s, downlink "
+	 << downlink.trace().capacity_bps() / 1e6 << " Mbit/s, " << options.delay_ms
+	 << " ms each way, speedup " << options.speedup << ")" << endl;
+
+    /* trace time: ns since we started, sped up */
+    const uint64_t start = timestamp_ns();
+    auto trace_now = [&] () { return uint64_t( ( timestamp_ns() - start ) * options.speedup ); };
+
+    /* packets go into the link as they arrive */
+    const unsigned int batch_size = 64;
+    Poller poller;
+    poller.add_action( Action( sender_side, Direction::In, [&] () {
+	  const uint64_t now = trace_now();
+	  uplink.advance( now );
+	  for ( const auto & recd : sender_side.recv_batch( batch_size ) ) {
+	    sender_address = recd.source_address;
+	    have_sender = true;
+	    uplink.enqueue( LinkPacket( recd.payload_length + IP_UDP_HEADER_BYTES, recd.payload_string() ), now );
+	  }
+	  return ResultType::Continue;
+	} ) );
+
+    poller.add_action( Action( receiver_side, Direction::In, [&] () {
+	  const uint64_t now = trace_now();
+	  downlink.advance( now );
+	  for ( const auto & recd : receiver_side.recv_batch( batch_size ) ) {
+	    downlink.enqueue( LinkPacket( recd.payload_length + IP_UDP_HEADER_BYTES, recd.payload_string() ), now );
+	  }
+	  return ResultType::Continue;
+	} ) );
+
+    struct sigaction action;
+    zero( action );
+    action.sa_handler = handle_signal;
+    SystemCall( "sigaction", sigaction( SIGINT, &action, nullptr ) );
+    SystemCall( "sigaction", sigaction( SIGTERM, &action, nullptr ) );
+
+    /* one timer, re-armed for whichever link has something to do next
+       (without the default 50 us of timer slack on each delivery) */
+    Poller::set_timer_slack( 1 );
+    Poller::TimerID wakeup = 0;
+    uint64_t wakeup_at = numeric_limits<uint64_t>::max();
+    const uint64_t end = options.once ? uplink.trace().period_ns() : numeric_limits<uint64_t>::max();
+
+    while ( true ) {
+      const uint64_t now = trace_now();
+      uplink.advance( now );
+      downlink.advance( now );
+
+      /* hand over everything that has finished propagating */
+      LinkPacket packet;
+      while ( uplink.take_delivered( packet, now ) ) {
+	receiver_side.sendto( receiver_address, packet.contents );
+      }
+      while ( downlink.take_delivered( packet, now ) ) {
+	if ( have_sender ) {
+	  sender_side.sendto( sender_address, packet.contents );
+	}
+      }
+
+      if ( now >= end ) {
+	break;
+      }
+
+      const uint64_t next = min( end, min( uplink.next_event_time(), downlink.next_event_time() ) );
+      if ( next != wakeup_at ) {
+	if ( wakeup_at != numeric_limits<uint64_t>::max() ) {
+	  poller.cancel_timer( wakeup );
+	}
+	wakeup_at = next;
+	if ( next != numeric_limits<uint64_t>::max() ) {
+	  const uint64_t real_delay = next > now ? ( next - now ) / options.speedup + 1 : 0;
+	  wakeup = poller.add_timer( real_delay, [&] () {
+	      wakeup_at = numeric_limits<uint64_t>::max(); /* (it fired) */
+	      return ResultType::Continue;
+	    } );
+	}
+      }
+
+      if ( poller.poll( -1 ).result == PollResult::Exit ) {
+	break;
+      }
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "file_descriptor.hh"
+#include "link_log.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* the file, mapped read-only for as long as this is in scope */
+class MappedFile
+{
+private:
+  FileDescriptor fd_;
+  size_t size_;
+  const char * data_;
+
+public:
+  MappedFile( const string & filename )
+    : fd_( SystemCall( "open " + filename, open( filename.c_str(), O_RDONLY ) ) ),
+      size_( 0 ),
+      data_( nullptr )
+  {
+    struct stat info;
+    SystemCall( "fstat", fstat( fd_.fd_num(), &info ) );
+    size_ = info.st_size;
+
+    if ( size_ == 0 ) {
+      return; /* (can't map nothing) */
+    }
+
+    void * const ret = mmap( nullptr, size_, PROT_READ, MAP_PRIVATE, fd_.fd_num(), 0 );
+    if ( ret == MAP_FAILED ) {
+      throw unix_error( "mmap" );
+    }
+    data_ = static_cast<const char *>( ret );
+
+    /* (just a hint) */
+    madvise( ret, size_, MADV_SEQUENTIAL );
+  }
+
+  ~MappedFile()
+  {
+    if ( data_ ) {
+      munmap( const_cast<char *>( data_ ), size_ );
+    }
+  }
+
+  const char * begin() const { return data_; }
+  const char * end() const { return data_ + size_; }
+
+  /* forbid copying */
+  MappedFile( const MappedFile & other ) = delete;
+  const MappedFile & operator=( const MappedFile & other ) = delete;
+};
+
+/* the log, one line at a time */
+class LogParser
+{
+private:
+  const char * position_, * const end_;
+  uint64_t line_;
+
+  void skip_spaces()
+  {
+    while ( position_ < end_ and ( *position_ == ' ' or *position_ == '\t' or *position_ == '\r' ) ) {
+      position_++;
+    }
+  }
+
+public:
+  LogParser( const char * begin, const char * end )
+    : position_( begin ), end_( end ), line_( 1 )
+  {}
+
+  bool done() const { return position_ >= end_; }
+
+  void fail( const string & what ) const
+  {
+    throw runtime_error( "link log line " + to_string( line_ ) + ": " + what );
+  }
+
+  /* a nonnegative decimal integer */
+  uint64_t number()
+  {
+    skip_spaces();
+    if ( position_ == end_ or *position_ < '0' or *position_ > '9' ) {
+      fail( "expected a number" );
+    }
+
+    uint64_t ret = 0;
+    while ( position_ < end_ and *position_ >= '0' and *position_ <= '9' ) {
+      ret = ret * 10 + ( *position_++ - '0' );
+    }
+    return ret;
+  }
+
+  /* the next non-blank character */
+  char symbol()
+  {
+    skip_spaces();
+    if ( position_ == end_ or *position_ == '\n' ) {
+      fail( "line ended early" );
+    }
+    return *position_++;
+  }
+
+  /* peek at the next non-blank character on this line (or '\n') */
+  char next()
+  {
+    skip_spaces();
+    return position_ == end_ ? '\n' : *position_;
+  }
+
+  /* move to the start of the next line */
+  void next_line()
+  {
+    while ( position_ < end_ and *position_++ != '\n' ) {}
+    line_++;
+  }
+
+  /* forbid copying */
+  LogParser( const LogParser & other ) = delete;
+  const LogParser & operator=( const LogParser & other ) = delete;
+};
+
+void read_link_log( const string & filename, LinkScorer & scorer )
+{
+  const MappedFile file( filename );
+  LogParser log( file.begin(), file.end() );
+
+  while ( not log.done() ) {
+    const char first = log.next();
+    if ( first == '#' or first == '\n' ) {
+      log.next_line();
+      continue;
+    }
+
+    const uint64_t t = log.number();
+    const char event = log.symbol();
+    switch ( event ) {
+    case '+':
+      scorer.arrival( t, log.number() );
+      break;
+    case '#':
+      scorer.opportunity( t, log.number() );
+      break;
+    case '-': {
+      const uint64_t bytes = log.number();
+      scorer.departure( t, bytes, log.number() );
+      break;
+    }
+    case 'd': {
+      const uint64_t packets = log.number();
+      log.number(); /* (bytes) */
+      scorer.drop( t, packets );
+      break;
+    }
+    default:
+      log.fail( "unknown event '" + string( 1, event ) + "'" );
+    }
+
+    if ( log.next() != '\n' ) {
+      log.fail( "unexpected text after the event" );
+    }
+    log.next_line();
+  }
+}
@@ -0,0 +1,20 @@
+#ifndef LINK_LOG_HH
+#define LINK_LOG_HH
+
+#include <string>
+
+#include "link_score.hh"
+
+/* Read an mm-link (or link-emulator) log into the scorer, in one pass
+   over the memory-mapped file. Header lines (starting with #) are
+   skipped; the events are
+
+     T + BYTES          (a packet arrived at the link)
+     T # BYTES          (a delivery opportunity)
+     T - BYTES DELAY    (a packet left, after DELAY ms in the queue)
+     T d PACKETS BYTES  (the queue dropped packets)
+
+   with T in ms. */
+void read_link_log( const std::string & filename, LinkScorer & scorer );
+
+#endif /* LINK_LOG_HH */
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <sstream>
+
+#include "link_score.hh"
+
+using namespace std;
+
+string LinkScore::header()
+{
+  return "duration_s\tcapacity_mbps\tthroughput_mbps\tutilization"
+    "\tp95_queueing_delay_ms\tp95_delay_ms\tpower"
+    "\tarrived_packets\tdeparted_packets\tdropped_packets";
+}
+
+string LinkScore::to_string() const
+{
+  ostringstream out;
+  out << duration_s << "\t" << capacity_mbps << "\t" << throughput_mbps << "\t" << utilization
+      << "\t" << p95_queueing_delay_ms << "\t" << p95_delay_ms << "\t" << power
+      << "\t" << arrived_packets << "\t" << departed_packets << "\t" << dropped_packets;
+  return out.str();
+}
+
+LinkScorer::LinkScorer( const uint64_t propagation_delay_ms, const uint64_t series_bin_ms )
+  : propagation_delay_ms_( propagation_delay_ms ),
+    seen_event_( false ),
+    first_ms_( 0 ),
+    last_ms_( 0 ),
+    capacity_bytes_( 0 ),
+    departed_bytes_( 0 ),
+    arrived_packets_( 0 ),
+    departed_packets_( 0 ),
+    dropped_packets_( 0 ),
+    delay_counts_(),
+    series_bin_ms_( series_bin_ms ),
+    series_()
+{}
+
+/* the time-series bin for time t (or null if there's no time series) */
+LinkScoreBin * LinkScorer::bin( const uint64_t t )
+{
+  if ( series_bin_ms_ == 0 ) {
+    return nullptr;
+  }
+
+  const uint64_t index = t / series_bin_ms_;
+  if ( index >= series_.size() ) {
+    series_.resize( index + 1 );
+  }
+  return &series_[ index ];
+}
+
+void LinkScorer::saw_time( const uint64_t t )
+{
+  if ( not seen_event_ ) {
+    first_ms_ = last_ms_ = t;
+    seen_event_ = true;
+  } else {
+    first_ms_ = min( first_ms_, t );
+    last_ms_ = max( last_ms_, t );
+  }
+}
+
+void LinkScorer::arrival( const uint64_t t, const uint64_t )
+{
+  saw_time( t );
+  arrived_packets_++;
+}
+
+void LinkScorer::opportunity( const uint64_t t, const uint64_t bytes )
+{
+  saw_time( t );
+  capacity_bytes_ += bytes;
+
+  if ( LinkScoreBin * const the_bin = bin( t ) ) {
+    the_bin->capacity_bytes += bytes;
+  }
+}
+
+void LinkScorer::departure( const uint64_t t, const uint64_t bytes, const uint64_t delay_ms )
+{
+  saw_time( t );
+  departed_bytes_ += bytes;
+  departed_packets_++;
+
+  if ( delay_ms >= delay_counts_.size() ) {
+    delay_counts_.resize( delay_ms + 1 );
+  }
+  delay_counts_[ delay_ms ]++;
+
+  if ( LinkScoreBin * const the_bin = bin( t ) ) {
+    the_bin->departed_bytes += bytes;
+    the_bin->max_queueing_delay_ms = max( the_bin->max_queueing_delay_ms, delay_ms );
+  }
+}
+
+void LinkScorer::drop( const uint64_t t, const uint64_t packets )
+{
+  saw_time( t );
+  dropped_packets_ += packets;
+}
+
+LinkScore LinkScorer::score() const
+{
+  LinkScore ret;
+  ret.arrived_packets = arrived_packets_;
+  ret.departed_packets = departed_packets_;
+  ret.dropped_packets = dropped_packets_;
+
+  /* (a log covers whole ms, so one with a single time lasts 1 ms) */
+  ret.duration_s = seen_event_ ? ( last_ms_ - first_ms_ + 1 ) / 1000.0 : 0;
+  if ( ret.duration_s == 0 ) {
+    return ret;
+  }
+
+  ret.capacity_mbps = capacity_bytes_ * 8 / ret.duration_s / 1e6;
+  ret.throughput_mbps = departed_bytes_ * 8 / ret.duration_s / 1e6;
+  ret.utilization = capacity_bytes_ ? double( departed_bytes_ ) / capacity_bytes_ : 0;
+
+  /* the smallest delay that at least 95% of departures stayed within */
+  const uint64_t rank = ( departed_packets_ * 95 + 99 ) / 100;
+  uint64_t seen = 0;
+  for ( size_t delay = 0; delay < delay_counts_.size(); delay++ ) {
+    seen += delay_counts_[ delay ];
+    if ( seen >= rank and rank > 0 ) {
+      ret.p95_queueing_delay_ms = delay;
+      break;
+    }
+  }
+
+  ret.p95_delay_ms = ret.p95_queueing_delay_ms + propagation_delay_ms_;
+  ret.power = ret.p95_delay_ms > 0 ? ret.throughput_mbps / ( ret.p95_delay_ms / 1000 ) : 0;
+
+  return ret;
+}
@@ -0,0 +1,74 @@
+#ifndef LINK_SCORE_HH
+#define LINK_SCORE_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* how well a sender used a bottleneck link, as mm-throughput-graph reports it */
+struct LinkScore
+{
+  double duration_s = 0;
+  double capacity_mbps = 0;   /* average, from the delivery opportunities */
+  double throughput_mbps = 0; /* average, from the departures */
+  double utilization = 0;     /* throughput / capacity */
+  double p95_queueing_delay_ms = 0;
+  double p95_delay_ms = 0;    /* ... plus the propagation delay */
+  double power = 0;           /* throughput (Mbit/s) per second of 95th-percentile delay */
+  uint64_t arrived_packets = 0, departed_packets = 0, dropped_packets = 0;
+
+  /* one line, in the order of header() */
+  std::string to_string() const;
+  static std::string header();
+};
+
+/* one bin of the time series (if asked for) */
+struct LinkScoreBin
+{
+  uint64_t capacity_bytes = 0, departed_bytes = 0;
+  uint64_t max_queueing_delay_ms = 0;
+};
+
+/* Accumulates the events of an mm-link style log (times in ms) in one
+   pass and in constant memory per ms of delay, so it can score a log as
+   it is read, or a simulation as it runs. */
+class LinkScorer
+{
+private:
+  uint64_t propagation_delay_ms_;
+
+  bool seen_event_;
+  uint64_t first_ms_, last_ms_;
+
+  uint64_t capacity_bytes_, departed_bytes_;
+  uint64_t arrived_packets_, departed_packets_, dropped_packets_;
+
+  /* departures, counted by queueing delay in ms */
+  std::vector<uint64_t> delay_counts_;
+
+  /* time series, by t / series_bin_ms_ (if that's nonzero) */
+  uint64_t series_bin_ms_;
+  std::vector<LinkScoreBin> series_;
+
+  LinkScoreBin * bin( const uint64_t t );
+
+  void saw_time( const uint64_t t );
+
+public:
+  /* (series_bin_ms: also keep a time series, with bins this long) */
+  LinkScorer( const uint64_t propagation_delay_ms, const uint64_t series_bin_ms = 0 );
+
+  /* the events of the log */
+  void arrival( const uint64_t t, const uint64_t bytes );
+  void opportunity( const uint64_t t, const uint64_t bytes );
+  void departure( const uint64_t t, const uint64_t bytes, const uint64_t delay_ms );
+  void drop( const uint64_t t, const uint64_t packets );
+
+  LinkScore score() const;
+
+  /* the time series: bin i covers [ i * series_bin_ms, ( i + 1 ) * series_bin_ms ) */
+  const std::vector<LinkScoreBin> & series() const { return series_; }
+  uint64_t series_bin_ms() const { return series_bin_ms_; }
+};
+
+#endif /* LINK_SCORE_HH */
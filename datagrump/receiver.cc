@@ -1,12 +1,326 @@
 /* simple UDP receiver that acknowledges every datagram */
 
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <fcntl.h>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
 
 #include "socket.hh"
 #include "contest_message.hh"
+#ifdef HAVE_LINUX_IO_URING_H
+#include "io_uring.hh"
+#endif
+#include "poller.hh"
+#include "stats_export.hh"
+#include "timestamp.hh"
+#include "util.hh"
 
 using namespace std;
+using namespace PollerShortNames;
+
+/* when to send a coalesced ack (see RangeAck) */
+struct AckPolicy
+{
+  unsigned int every = 0;      /* after this many datagrams from a sender (0: ack each one alone) */
+  uint64_t delay_ns = 1000000; /* ... or this long after the first one, if sooner */
+};
+
+/* datagrams acked by one worker (padded so that workers don't share a cache line) */
+struct WorkerCount
+{
+  atomic<uint64_t> datagrams;
+  char padding[ 64 - sizeof( atomic<uint64_t> ) ];
+
+  WorkerCount() : datagrams( 0 ), padding() {}
+};
+
+/* one worker's live statistics (see StatsExporter) */
+struct ReceiverStats
+{
+  Histogram one_way_delay_ns {};
+  Counter datagrams {}, acks {};
+  OneWayDelay one_way_delay {};
+
+  void received( const uint64_t send_timestamp, const uint64_t recv_timestamp )
+  {
+    datagrams.add();
+    one_way_delay_ns.record( one_way_delay.above_minimum( send_timestamp, recv_timestamp ) );
+  }
+};
+
+/* append the workers' statistics to a file once a second (if it's named) */
+static unique_ptr<StatsExporter> export_stats( const string & filename,
+					       const vector<unique_ptr<ReceiverStats>> & stats )
+{
+  if ( filename.empty() ) {
+    return nullptr;
+  }
+
+  vector<const Histogram *> one_way_delays;
+  vector<const Counter *> datagrams, acks;
+  for ( const auto & worker : stats ) {
+    one_way_delays.push_back( &worker->one_way_delay_ns );
+    datagrams.push_back( &worker->datagrams );
+    acks.push_back( &worker->acks );
+  }
+
+  FileDescriptor output( SystemCall( "open " + filename,
+				    open( filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644 ) ) );
+
+  unique_ptr<StatsExporter> exporter( new StatsExporter( move( output ) ) );
+  exporter->add( "datagrams", datagrams );
+  exporter->add( "acks", acks );
+  exporter->add( "one_way_delay_ns", one_way_delays );
+  exporter->start();
+  return exporter;
+}
+
+/* make a socket for incoming datagrams on the port */
+static unique_ptr<UDPSocket> listen_on( const char * const port, const bool reuseport )
+{
+  unique_ptr<UDPSocket> socket( new UDPSocket );
+
+  /* turn on timestamps on receipt */
+  socket->set_timestamps();
+
+  /* share the port with the other workers */
+  if ( reuseport ) {
+    socket->set_reuseport();
+  }
+
+  /* "bind" the socket to the user-specified local port number */
+  socket->bind( Address( "::0", port ) );
+
+  return socket;
+}
+
+/* Loop and acknowledge every incoming datagram back to its source */
+static void ack_forever( UDPSocket & socket, atomic<uint64_t> & count, ReceiverStats & stats )
+{
+  uint64_t sequence_number = 0;
+
+  /* how many datagrams to pull from the socket per system call */
+  const unsigned int batch_size = 64;
+
+  /* acks for the current batch, sent together with one system call
+     (the vector and its strings are reused, so steady state doesn't allocate) */
+  vector<pair<Address, string>> acks;
+
+  while ( true ) {
+    size_t ack_count = 0;
+
+    for ( const auto & recd : socket.recv_batch( batch_size ) ) {
+      /* parse the datagram in place */
+      ContestMessageView message( recd.payload, recd.payload_length );
+      stats.received( message.header.send_timestamp, recd.timestamp );
+
+      /* assemble the acknowledgment */
+      message.transform_into_ack( sequence_number++, recd.timestamp );
+
+      /* timestamp the ack just before sending */
+      message.set_send_timestamp();
+
+      if ( ack_count == acks.size() ) {
+	acks.emplace_back();
+      }
+      acks[ ack_count ].first = recd.source_address;
+      message.serialize( acks[ ack_count ].second );
+      ack_count++;
+    }
+
+    /* send the acks */
+    socket.sendto_batch( acks, ack_count );
+    count.fetch_add( ack_count, memory_order_relaxed );
+    stats.acks.add( ack_count );
+  }
+}
+
+/* how often to forget sources that have gone quiet (after one to two of these) */
+static const uint64_t SOURCE_EXPIRY_INTERVAL_NS = 10000000000;
+
+/* Loop and acknowledge incoming datagrams with RangeAcks, one per
+   `policy.every` datagrams from each source (or sooner, after `policy.delay_ns`) */
+static void ack_coalesced_forever( UDPSocket & socket, atomic<uint64_t> & count,
+				   ReceiverStats & stats, const AckPolicy & policy )
+{
+  /* datagrams not yet acked, for each source */
+  struct Pending
+  {
+    RangeAck ack {};
+    Poller::TimerID timer {};
+    bool waiting {};
+    bool heard {}; /* since the last expiry sweep */
+  };
+  unordered_map<Address, Pending> pending;
+
+  Poller poller;
+  Poller::set_timer_slack( 1 ); /* (the ack delay is in microseconds) */
+  string ack_datagram; /* reused for every ack */
+
+  const auto send_ack = [&] ( const Address & destination, Pending & source ) {
+    source.ack.serialize( ack_datagram );
+    socket.sendto( destination, ack_datagram );
+    stats.acks.add();
+    source.ack.clear();
+    if ( source.waiting ) {
+      poller.cancel_timer( source.timer );
+      source.waiting = false;
+    }
+  };
+
+  poller.add_action( Action( socket, Direction::In, [&] () {
+	uint64_t datagram_count = 0;
+	for ( const auto & recd : socket.recv_batch( 64 ) ) {
+	  const ContestMessage::Header header( recd.payload, recd.payload_length );
+
+	  /* (find first: emplace would allocate a node even for a known source) */
+	  auto it = pending.find( recd.source_address );
+	  if ( it == pending.end() ) {
+	    it = pending.emplace( recd.source_address, Pending() ).first;
+	  }
+	  auto & entry = *it;
+	  const Address & destination = entry.first;
+	  Pending & source = entry.second;
+	  source.ack.add( header.sequence_number, recd.timestamp );
+	  source.heard = true;
+	  stats.received( header.send_timestamp, recd.timestamp );
+	  datagram_count++;
+
+	  if ( source.ack.full() or source.ack.datagrams().size() >= policy.every ) {
+	    send_ack( destination, source );
+	  } else if ( not source.waiting ) {
+	    /* (the entry stays put: sources are only expired with no timer waiting) */
+	    source.waiting = true;
+	    source.timer = poller.add_timer( policy.delay_ns, [&] () {
+		entry.second.waiting = false;
+		send_ack( entry.first, entry.second );
+		return ResultType::Continue;
+	      } );
+	  }
+	}
+
+	count.fetch_add( datagram_count, memory_order_relaxed );
+	return ResultType::Continue;
+      } ) );
+
+  /* forget the sources not heard from since the last sweep */
+  poller.add_timer( SOURCE_EXPIRY_INTERVAL_NS, [&] () {
+      for ( auto it = pending.begin(); it != pending.end(); ) {
+	if ( it->second.heard or it->second.waiting ) {
+	  it->second.heard = false;
+	  ++it;
+	} else {
+	  it = pending.erase( it );
+	}
+      }
+      return ResultType::Continue;
+    }, SOURCE_EXPIRY_INTERVAL_NS );
+
+  while ( true ) {
+    poller.poll( -1 );
+  }
+}
+
+/* acknowledge incoming datagrams as the policy says */
+static void acknowledge_forever( UDPSocket & socket, atomic<uint64_t> & count,
+				 ReceiverStats & stats, const AckPolicy & policy )
+{
+  if ( policy.every ) {
+    ack_coalesced_forever( socket, count, stats, policy );
+  } else {
+    ack_forever( socket, count, stats );
+  }
+}
+
+/* run the calling thread only on this CPU */
+static void pin_to_cpu( const unsigned int cpu )
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CPU_SET( cpu, &cpus );
+
+  const int error = pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus );
+  if ( error ) {
+    throw unix_error( "pthread_setaffinity_np", error );
+  }
+}
+
+/* one socket and one pinned thread per worker, sharing the port,
+   reporting each worker's rate once a second */
+static void run_workers( const char * const port, const unsigned int worker_count, const bool steer,
+			 const AckPolicy & policy, const string & stats_file )
+{
+  /* bind them all before any traffic is steered to them (the group
+     is numbered in bind order) */
+  vector<unique_ptr<UDPSocket>> sockets;
+  for ( unsigned int i = 0; i < worker_count; i++ ) {
+    sockets.push_back( listen_on( port, true ) );
+  }
+
+  if ( steer ) {
+    sockets.front()->steer_reuseport_by_cpu( worker_count );
+  }
+
+  cerr << "Listening on " << sockets.front()->local_address().to_string()
+       << " with " << worker_count << " workers"
+       << ( steer ? " (steered by receiving CPU)" : "" ) << endl;
+
+  const unsigned int cpu_count = max( 1u, thread::hardware_concurrency() );
+  vector<WorkerCount> counts( worker_count );
+  atomic<bool> failed( false );
+
+  vector<unique_ptr<ReceiverStats>> stats;
+  for ( unsigned int i = 0; i < worker_count; i++ ) {
+    stats.emplace_back( new ReceiverStats );
+  }
+  const unique_ptr<StatsExporter> exporter = export_stats( stats_file, stats );
+
+  for ( unsigned int i = 0; i < worker_count; i++ ) {
+    thread( [&, i] () {
+	try {
+	  pin_to_cpu( i % cpu_count );
+	  acknowledge_forever( *sockets[ i ], counts[ i ].datagrams, *stats[ i ], policy );
+	} catch ( const exception & e ) {
+	  print_exception( e );
+	  failed = true;
+	}
+      } ).detach();
+  }
+
+  /* report the rates (the workers run until the process exits) */
+  vector<uint64_t> last( worker_count );
+  auto last_report = chrono::steady_clock::now();
+  while ( not failed ) {
+    this_thread::sleep_for( chrono::seconds( 1 ) );
+
+    const auto now = chrono::steady_clock::now();
+    const double elapsed = chrono::duration<double>( now - last_report ).count();
+    last_report = now;
+
+    uint64_t total = 0;
+    cerr << "datagrams/s:";
+    for ( unsigned int i = 0; i < worker_count; i++ ) {
+      const uint64_t count = counts[ i ].datagrams.load( memory_order_relaxed );
+      cerr << " " << uint64_t( ( count - last[ i ] ) / elapsed );
+      total += count - last[ i ];
+      last[ i ] = count;
+    }
+    cerr << " (total " << uint64_t( total / elapsed ) << ")" << endl;
+  }
+
+  /* (without unwinding: the other workers are still using the sockets) */
+  exit( EXIT_FAILURE );
+}
 
 int main( int argc, char *argv[] )
 {
@@ -15,38 +329,106 @@ int main( int argc, char *argv[] )
     abort();
   }
 
-  if ( argc != 2 ) {
-    cerr << "Usage: " << argv[ 0 ] << " PORT" << endl;
+  bool uring = false, steer = false;
+  unsigned int workers = 0;
+  AckPolicy policy;
+  string stats_file;
+  bool usage_ok = argc >= 2;
+  for ( int i = 2; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option == "uring" ) {
+#ifdef HAVE_LINUX_IO_URING_H
+      uring = true;
+#else
+      cerr << argv[ 0 ] << ": uring is not available (built without linux/io_uring.h)" << endl;
+      return EXIT_FAILURE;
+#endif
+    } else if ( option == "steer" ) {
+      steer = true;
+    } else if ( option.compare( 0, 8, "workers=" ) == 0 ) {
+      try {
+	workers = stoul( option.substr( 8 ) );
+      } catch ( const exception & ) {
+	usage_ok = false;
+      }
+      usage_ok = usage_ok and workers > 0;
+    } else if ( option.compare( 0, 10, "ack-every=" ) == 0 ) {
+      try {
+	policy.every = stoul( option.substr( 10 ) );
+      } catch ( const exception & ) {
+	usage_ok = false;
+      }
+      usage_ok = usage_ok and policy.every > 0 and policy.every <= RangeAck::MAX_DATAGRAMS;
+    } else if ( option.compare( 0, 10, "ack-delay=" ) == 0 ) {
+      try {
+	policy.delay_ns = stoul( option.substr( 10 ) ) * 1000;
+      } catch ( const exception & ) {
+	usage_ok = false;
+      }
+      usage_ok = usage_ok and policy.delay_ns > 0 and policy.delay_ns <= 1000000000;
+    } else if ( option.compare( 0, 6, "stats=" ) == 0 ) {
+      stats_file = option.substr( 6 );
+      usage_ok = usage_ok and not stats_file.empty();
+    } else {
+      usage_ok = false;
+    }
+  }
+
+  /* (the workers use batched system calls; steering needs workers) */
+  usage_ok = usage_ok and not ( uring and workers ) and ( workers or not steer );
+
+  /* (the io_uring loop sends each ack as it goes) */
+  usage_ok = usage_ok and not ( uring and policy.every );
+
+  if ( not usage_ok ) {
+    cerr << "Usage: " << argv[ 0 ] << " PORT [uring | workers=N [steer]]"
+	 << " [ack-every=N [ack-delay=US]] [stats=FILE]" << endl;
     return EXIT_FAILURE;
   }
 
+  if ( workers ) {
+    run_workers( argv[ 1 ], workers, steer, policy, stats_file );
+  }
+
   /* create UDP socket for incoming datagrams */
-  UDPSocket socket;
+  const unique_ptr<UDPSocket> socket = listen_on( argv[ 1 ], false );
 
-  /* turn on timestamps on receipt */
-  socket.set_timestamps();
+  cerr << "Listening on " << socket->local_address().to_string() << endl;
 
-  /* "bind" the socket to the user-specified local port number */
-  socket.bind( Address( "::0", argv[ 1 ] ) );
+  vector<unique_ptr<ReceiverStats>> stats;
+  stats.emplace_back( new ReceiverStats );
+  const unique_ptr<StatsExporter> exporter = export_stats( stats_file, stats );
 
-  cerr << "Listening on " << socket.local_address().to_string() << endl;
+#ifdef HAVE_LINUX_IO_URING_H
+  if ( uring ) {
+    uint64_t sequence_number = 0;
 
-  uint64_t sequence_number = 0;
+    /* receive with one multishot recvmsg, and queue each ack
+       to be submitted together with the rest of the batch */
+    IOUring ring;
+    IOUring::BufferGroup buffers( ring, 0, 256, 2048 );
 
-  /* Loop and acknowledge every incoming datagram back to its source */
-  while ( true ) {
-    const UDPSocket::received_datagram recd = socket.recv();
-    ContestMessage message = recd.payload;
+    ring.recv_multishot( *socket, buffers, [&] ( const UDPSocket::batched_datagram & recd ) {
+	ContestMessageView message( recd.payload, recd.payload_length );
+	stats.front()->received( message.header.send_timestamp, recd.timestamp );
+	message.transform_into_ack( sequence_number++, recd.timestamp );
+	message.set_send_timestamp();
 
-    /* assemble the acknowledgment */
-    message.transform_into_ack( sequence_number++, recd.timestamp );
+	/* (an ack has no payload, so it fits on the stack) */
+	char ack[ ContestMessage::Header::wire_size ];
+	message.serialize( ack );
+	ring.sendto( *socket, recd.source_address, ack, sizeof( ack ) );
+	stats.front()->acks.add();
+      } );
 
-    /* timestamp the ack just before sending */
-    message.set_send_timestamp();
+    while ( ring.run( -1 ).result != IOUring::Result::Type::Exit ) {}
 
-    /* send the ack */
-    socket.sendto( recd.source_address, message.to_string() );
+    return EXIT_SUCCESS;
   }
+#endif
+
+  atomic<uint64_t> count( 0 );
+  acknowledge_forever( *socket, count, *stats.front(), policy );
 
   return EXIT_SUCCESS;
 }
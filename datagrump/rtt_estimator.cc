@@ -0,0 +1,30 @@
+#include <algorithm>
+
+#include "rtt_estimator.hh"
+
+using namespace std;
+
+/* bounds on the timeout, in milliseconds */
+static const uint64_t MIN_TIMEOUT_MS = 20, MAX_TIMEOUT_MS = 1000;
+
+void RTTEstimator::update( const uint64_t rtt_ns )
+{
+  if ( srtt_ns_ == 0 ) {
+    srtt_ns_ = rtt_ns;
+    rttvar_ns_ = rtt_ns / 2;
+  } else {
+    const uint64_t deviation = rtt_ns > srtt_ns_ ? rtt_ns - srtt_ns_ : srtt_ns_ - rtt_ns;
+    rttvar_ns_ = ( 3 * rttvar_ns_ + deviation ) / 4;
+    srtt_ns_ = ( 7 * srtt_ns_ + rtt_ns ) / 8;
+  }
+}
+
+unsigned int RTTEstimator::timeout_ms( const unsigned int default_ms ) const
+{
+  if ( srtt_ns_ == 0 ) {
+    return default_ms;
+  }
+
+  const uint64_t rto_ms = ( srtt_ns_ + 4 * rttvar_ns_ ) / 1000000;
+  return min( MAX_TIMEOUT_MS, max( MIN_TIMEOUT_MS, rto_ms ) );
+}
@@ -0,0 +1,27 @@
+#ifndef RTT_ESTIMATOR_HH
+#define RTT_ESTIMATOR_HH
+
+#include <cstdint>
+
+/* smoothed round-trip time and its variation, and the timeout they
+   imply (as in TCP; RFC 6298) */
+class RTTEstimator
+{
+private:
+  uint64_t srtt_ns_, rttvar_ns_;
+
+public:
+  RTTEstimator() : srtt_ns_( 0 ), rttvar_ns_( 0 ) {}
+
+  /* add a sample (in nanoseconds) */
+  void update( const uint64_t rtt_ns );
+
+  /* how long to wait (in milliseconds) for an ack before giving up,
+     or the default if there have been no samples */
+  unsigned int timeout_ms( const unsigned int default_ms = 1000 ) const;
+
+  /* accessors */
+  uint64_t srtt_ns() const { return srtt_ns_; }
+};
+
+#endif /* RTT_ESTIMATOR_HH */
@@ -0,0 +1,82 @@
+/* score an uplink log locally, as mm-throughput-graph and the contest server would */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "link_log.hh"
+#include "link_score.hh"
+#include "util.hh"
+
+using namespace std;
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  uint64_t delay_ms = 20, series_ms = 0;
+  bool tsv = false;
+  bool usage_ok = argc >= 2;
+  for ( int i = 2; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    try {
+      if ( option == "tsv" ) {
+	tsv = true;
+      } else if ( option.compare( 0, 6, "delay=" ) == 0 ) {
+	delay_ms = stoull( option.substr( 6 ) );
+      } else if ( option.compare( 0, 7, "series=" ) == 0 ) {
+	series_ms = stoull( option.substr( 7 ) );
+	usage_ok = usage_ok and series_ms > 0;
+      } else {
+	usage_ok = false;
+      }
+    } catch ( const exception & ) {
+      usage_ok = false;
+    }
+  }
+
+  if ( not usage_ok ) {
+    cerr << "Usage: " << argv[ 0 ] << " LOGFILE [delay=PROPAGATION_DELAY_MS] [series=BIN_MS] [tsv]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    LinkScorer scorer( delay_ms, series_ms );
+    read_link_log( argv[ 1 ], scorer );
+    const LinkScore score = scorer.score();
+
+    /* the time series goes to stdout (then the summary to stderr) */
+    ostream & summary = series_ms ? cerr : cout;
+    if ( series_ms ) {
+      cout << "# time_s\tcapacity_mbps\tthroughput_mbps\tmax_queueing_delay_ms\n";
+      const double bin_s = series_ms / 1000.0;
+      for ( size_t i = 0; i < scorer.series().size(); i++ ) {
+	const LinkScoreBin & bin = scorer.series()[ i ];
+	cout << i * bin_s << "\t" << bin.capacity_bytes * 8 / bin_s / 1e6
+	     << "\t" << bin.departed_bytes * 8 / bin_s / 1e6
+	     << "\t" << bin.max_queueing_delay_ms << "\n";
+      }
+    }
+
+    if ( tsv ) {
+      summary << "# " << LinkScore::header() << "\n" << score.to_string() << endl;
+    } else {
+      summary << fixed << setprecision( 2 )
+	      << "Average capacity: " << score.capacity_mbps << " Mbits/s" << endl
+	      << "Average throughput: " << score.throughput_mbps << " Mbits/s ("
+	      << 100 * score.utilization << "% utilization)" << endl
+	      << "95th percentile per-packet queueing delay: " << score.p95_queueing_delay_ms << " ms" << endl
+	      << "95th percentile one-way delay (with " << delay_ms << " ms propagation): "
+	      << score.p95_delay_ms << " ms" << endl
+	      << "Power: " << score.power << " (Mbits/s per second of delay)" << endl;
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "scoreboard.hh"
+
+using namespace std;
+
+Scoreboard::Scoreboard( const unsigned int reorder_threshold )
+  : ring_( 256 ),
+    oldest_( 0 ),
+    scan_( 0 ),
+    next_( 0 ),
+    reorder_threshold_( reorder_threshold ),
+    highest_acked_( 0 ),
+    rack_rtt_ns_( 0 ),
+    min_rtt_ns_( numeric_limits<uint64_t>::max() ),
+    any_acked_( false ),
+    in_flight_( 0 ),
+    lost_count_( 0 ),
+    spurious_loss_count_( 0 )
+{
+  if ( reorder_threshold == 0 ) {
+    throw runtime_error( "Scoreboard: reorder threshold must be positive" );
+  }
+}
+
+void Scoreboard::make_room()
+{
+  if ( next_ - oldest_ < ring_.size() ) {
+    return;
+  }
+
+  /* first drop the datagrams given up as lost */
+  oldest_ = scan_;
+  if ( next_ - oldest_ < ring_.size() ) {
+    return;
+  }
+
+  /* then grow (in flight or pinned by an older one in flight) */
+  vector<Entry> bigger( 2 * ring_.size() );
+  for ( uint64_t i = oldest_; i < next_; i++ ) {
+    bigger[ i & ( bigger.size() - 1 ) ] = entry( i );
+  }
+  ring_.swap( bigger );
+}
+
+void Scoreboard::sent( const uint64_t sequence_number, const uint64_t send_timestamp )
+{
+  if ( sequence_number != next_ ) {
+    throw runtime_error( "Scoreboard: sequence number " + to_string( sequence_number )
+			 + " sent out of order" );
+  }
+
+  make_room();
+  entry( next_++ ) = { send_timestamp, State::InFlight };
+  in_flight_++;
+}
+
+void Scoreboard::advance()
+{
+  while ( scan_ < next_ and entry( scan_ ).state != State::InFlight ) {
+    scan_++;
+  }
+
+  while ( oldest_ < scan_ and entry( oldest_ ).state == State::Acked ) {
+    oldest_++;
+  }
+}
+
+void Scoreboard::mark_lost( Entry & lost )
+{
+  lost.state = State::Lost;
+  in_flight_--;
+  lost_count_++;
+}
+
+Scoreboard::AckType Scoreboard::acked( const uint64_t sequence_number, const uint64_t now )
+{
+  if ( sequence_number < oldest_ or sequence_number >= next_ ) {
+    return AckType::Stale;
+  }
+
+  Entry & acked = entry( sequence_number );
+  const State previous = acked.state;
+  switch ( previous ) {
+  case State::Acked:
+    return AckType::Stale;
+  case State::Lost:
+    spurious_loss_count_++;
+    break;
+  case State::InFlight:
+    in_flight_--;
+    break;
+  }
+  acked.state = State::Acked;
+
+  const uint64_t rtt = now > acked.send_timestamp ? now - acked.send_timestamp : 0;
+  min_rtt_ns_ = min( min_rtt_ns_, rtt );
+
+  /* (sequence numbers go out in order, so the highest was sent most recently) */
+  if ( not any_acked_ or sequence_number > highest_acked_ ) {
+    highest_acked_ = sequence_number;
+    rack_rtt_ns_ = rtt;
+    any_acked_ = true;
+  }
+
+  advance();
+  return previous == State::Lost ? AckType::Late : AckType::New;
+}
+
+bool Scoreboard::send_timestamp( const uint64_t sequence_number, uint64_t & timestamp ) const
+{
+  if ( sequence_number < oldest_ or sequence_number >= next_ ) {
+    return false;
+  }
+
+  timestamp = entry( sequence_number ).send_timestamp;
+  return true;
+}
+
+uint64_t Scoreboard::detect_losses( const uint64_t now )
+{
+  if ( not any_acked_ ) {
+    return 0;
+  }
+
+  const uint64_t reorder_window_ns = min_rtt_ns_ / 4;
+
+  uint64_t newly_lost = 0;
+  for ( uint64_t i = scan_; i < highest_acked_; i++ ) {
+    Entry & candidate = entry( i );
+    if ( candidate.state != State::InFlight ) {
+      continue;
+    }
+
+    if ( i + reorder_threshold_ <= highest_acked_
+	 or now >= candidate.send_timestamp + rack_rtt_ns_ + reorder_window_ns ) {
+      mark_lost( candidate );
+      newly_lost++;
+    } else {
+      break; /* (anything later was sent later, so it isn't lost either) */
+    }
+  }
+
+  advance();
+  return newly_lost;
+}
+
+uint64_t Scoreboard::declare_all_lost()
+{
+  uint64_t newly_lost = 0;
+  for ( uint64_t i = scan_; i < next_; i++ ) {
+    Entry & candidate = entry( i );
+    if ( candidate.state == State::InFlight ) {
+      mark_lost( candidate );
+      newly_lost++;
+    }
+  }
+
+  advance();
+  return newly_lost;
+}
@@ -0,0 +1,92 @@
+#ifndef SCOREBOARD_HH
+#define SCOREBOARD_HH
+
+#include <cstdint>
+#include <vector>
+
+/* The sender's record of every datagram between the oldest unresolved
+   one and the newest: in flight, acked, or given up as lost. A
+   datagram is lost once one sent `reorder_threshold` or more after it
+   has been acked, or once a datagram sent after it has been acked and
+   a round trip (plus a quarter of the minimum RTT for reordering) has
+   passed since it was sent (as in RACK; RFC 8985). Each ack covers one
+   sequence number, and no sequence number is sent twice (the datagrams
+   carry no data, so any new one stands in for a lost one), so every
+   ack's RTT is unambiguous. */
+class Scoreboard
+{
+public:
+  enum class State : uint8_t { InFlight, Acked, Lost };
+
+  /* what an ack told us: a datagram delivered, one we had already
+     given up as lost (a spurious loss), or nothing (a duplicate, or
+     an ack for a datagram so old that it has been forgotten) */
+  enum class AckType { New, Late, Stale };
+
+private:
+  struct Entry
+  {
+    uint64_t send_timestamp;
+    State state;
+  };
+
+  /* entries for [ oldest_, next_ ), at sequence_number % size (a power of 2);
+     everything before scan_ is resolved, but lost ones are kept (in case
+     they are acked after all) until the space is needed */
+  std::vector<Entry> ring_;
+  uint64_t oldest_, scan_, next_;
+
+  unsigned int reorder_threshold_;
+
+  /* the acked datagram sent most recently, and its RTT (for the time threshold) */
+  uint64_t highest_acked_, rack_rtt_ns_, min_rtt_ns_;
+  bool any_acked_;
+
+  uint64_t in_flight_;
+  uint64_t lost_count_, spurious_loss_count_;
+
+  Entry & entry( const uint64_t sequence_number )
+  {
+    return ring_[ sequence_number & ( ring_.size() - 1 ) ];
+  }
+
+  const Entry & entry( const uint64_t sequence_number ) const
+  {
+    return ring_[ sequence_number & ( ring_.size() - 1 ) ];
+  }
+
+  void mark_lost( Entry & entry );
+
+  /* move scan_ past resolved datagrams, and oldest_ past acked ones */
+  void advance();
+
+  /* make room for one more entry */
+  void make_room();
+
+public:
+  Scoreboard( const unsigned int reorder_threshold = 3 );
+
+  /* a datagram went out (sequence numbers must be consecutive from 0) */
+  void sent( const uint64_t sequence_number, const uint64_t send_timestamp );
+
+  /* an ack arrived at `now` */
+  AckType acked( const uint64_t sequence_number, const uint64_t now );
+
+  /* when was this datagram sent? (false if it has been forgotten) */
+  bool send_timestamp( const uint64_t sequence_number, uint64_t & timestamp ) const;
+
+  /* declare lost whatever the acks so far imply, and return how many */
+  uint64_t detect_losses( const uint64_t now );
+
+  /* give up on everything in flight (after a timeout), and return how many */
+  uint64_t declare_all_lost();
+
+  /* datagrams sent but neither acked nor lost */
+  uint64_t in_flight() const { return in_flight_; }
+
+  /* datagrams declared lost, and how many of those were acked after all */
+  uint64_t lost_count() const { return lost_count_; }
+  uint64_t spurious_loss_count() const { return spurious_loss_count_; }
+};
+
+#endif /* SCOREBOARD_HH */
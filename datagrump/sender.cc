@@ -1,40 +1,196 @@
 /* UDP sender for congestion-control contest */
 
+#include "config.h"
+
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <set>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "socket.hh"
 #include "contest_message.hh"
-#include "controller.hh"
+#include "controller_registry.hh"
+#include "event_trace.hh"
 #include "poller.hh"
+#ifdef HAVE_LINUX_IO_URING_H
+#include "io_uring.hh"
+#endif
+#include "scoreboard.hh"
+#include "stats_export.hh"
+#include "timestamp.hh"
+#include "util.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
-/* simple sender class to handle the accounting */
+/* command-line options for the sender */
+struct SenderOptions
+{
+  bool debug = false; /* print every send and ack */
+  std::string trace_file {}; /* ... or log them to a binary trace (see trace-decode) */
+  std::string stats_file {}; /* append live statistics to this file once a second */
+  bool batch = false; /* send each window-opening burst with sendmmsg() */
+  bool gso = false;   /* ... and coalesce it with UDP segmentation offload */
+  bool uring = false; /* do all socket I/O through io_uring */
+  bool pace = false;  /* space datagrams out at the controller's pacing_rate() */
+  bool fq = false;    /* ... by asking the fq qdisc to do it (SO_MAX_PACING_RATE) */
+
+  /* which congestion controller to run (see controller_registry.hh) */
+  std::string controller = "fixed";
+  uint64_t delay_target_ms = 100;
+
+  ControllerOptions controller_options( EventTrace * const trace ) const
+  {
+    ControllerOptions ret;
+    ret.trace = trace;
+    ret.delay_target_ns = delay_target_ms * 1000000;
+    return ret;
+  }
+};
+
+/* the sender's live statistics (see StatsExporter) */
+struct SenderStats
+{
+  Histogram rtt_ns {}, one_way_delay_ns {}, window {};
+  Counter sent {}, acked {}, lost {}, timeouts {};
+  Counter late_acks {}; /* for datagrams already declared lost */
+  OneWayDelay one_way_delay {};
+};
+
+/* simple sender class to handle the accounting
+   (compiled once for each congestion controller, so that
+   calls to the controller aren't virtual) */
+template <class ControllerType>
 class DatagrumpSender
 {
 private:
   UDPSocket socket_;
-  Controller controller_; /* your class */
+
+  /* log of each send, ack, window change and loss, and the controller's
+     own events (if debugging or tracing) */
+  std::unique_ptr<EventTrace> trace_;
+
+  ControllerType controller_; /* your class */
+  bool debug_;
+
+  /* live statistics (if exported), recorded here and read by the exporter's thread */
+  std::unique_ptr<SenderStats> stats_;
+  std::unique_ptr<StatsExporter> exporter_;
+
+#ifdef HAVE_LINUX_IO_URING_H
+  /* completion-based I/O instead of the Poller (if enabled) */
+  std::unique_ptr<IOUring> ring_;
+#endif
+
+  /* send each window-opening burst with one system call */
+  bool batch_;
+  std::vector<std::string> burst_; /* reused across bursts (never shrinks) */
+  uint64_t burst_count_, burst_datagrams_;
+
+  /* pace datagrams with Poller timers, or hand pacing to the qdisc */
+  bool pace_, fq_;
+  uint64_t next_send_ns_;
+  double fq_rate_; /* last rate given to the kernel */
+
+  /* achieved inter-send gaps while pacing (reset every report) */
+  uint64_t last_send_ns_, gap_count_, gap_sum_ns_, gap_min_ns_, gap_max_ns_;
+
+  std::string datagram_; /* wire representation, reused for every send */
 
   uint64_t sequence_number_; /* next outgoing sequence number */
 
-  /* if network does not reorder or lose datagrams,
-     this is the sequence number that the sender
-     next expects will be acknowledged by the receiver */
-  uint64_t next_ack_expected_;
+  /* last send or ack (the ack timeout runs from here) */
+  uint64_t last_activity_ns_;
+
+  /* which datagrams are in flight, acked, or lost */
+  Scoreboard scoreboard_;
+
+  RangeAck range_ack_; /* reused for each coalesced ack */
 
+  void datagram_was_sent( const uint64_t sequence_number, const uint64_t send_timestamp,
+			  const bool after_timeout );
+  void ack_was_received( const uint64_t timestamp, const uint64_t sequence_number,
+			 const uint64_t send_timestamp, const uint64_t recv_timestamp );
+  void datagrams_were_lost( const uint64_t count, const uint64_t timestamp );
+  void timed_out();
   void send_datagram( const bool after_timeout );
-  void got_ack( const uint64_t timestamp, const ContestMessage & msg );
+  void send_burst();
+  void send_paced( Poller & poller );
+  void report_gaps();
+  void got_datagram( const uint64_t timestamp, const char * data, const size_t length );
+  void got_ack( const uint64_t timestamp, const ContestMessageView & msg );
+  void got_range_ack( const uint64_t timestamp, const char * data, const size_t length );
   bool window_is_open();
+#ifdef HAVE_LINUX_IO_URING_H
+  int loop_uring();
+#endif
 
 public:
   DatagrumpSender( const char * const host, const char * const port,
-		   const bool debug );
+		   const SenderOptions & options );
   int loop();
 };
 
+/* open (or create) a file for the sender's output */
+static FileDescriptor open_for_writing( const string & filename, const int flags )
+{
+  return FileDescriptor( SystemCall( "open " + filename,
+				     open( filename.c_str(), O_WRONLY | O_CREAT | flags, 0644 ) ) );
+}
+
+/* the event log asked for, if any (written out by a background
+   thread, to keep I/O off the send and ack paths) */
+static EventTrace * open_trace( const SenderOptions & options )
+{
+  if ( not options.trace_file.empty() ) {
+    return new EventTrace( open_for_writing( options.trace_file, O_TRUNC ), false );
+  } else if ( options.debug ) {
+    return new EventTrace( FileDescriptor( SystemCall( "dup", dup( STDERR_FILENO ) ) ), true );
+  }
+  return nullptr;
+}
+
+/* the registered controllers' names, and a description of each for the usage message */
+struct ControllerNames
+{
+  set<string> names {};
+  string descriptions {};
+
+  template <class ControllerType>
+  void visit( const char * name, const char * description )
+  {
+    names.insert( name );
+    descriptions += string( "  " ) + name + ": " + description + "\n";
+  }
+};
+
+/* run the sender with the controller named in the options */
+class SenderLauncher
+{
+private:
+  const char * const host_, * const port_;
+  const SenderOptions & options_;
+
+public:
+  int exit_status;
+
+  SenderLauncher( const char * const host, const char * const port, const SenderOptions & options )
+    : host_( host ), port_( port ), options_( options ), exit_status( EXIT_FAILURE )
+  {}
+
+  template <class ControllerType>
+  void visit( const char * name, const char * )
+  {
+    if ( options_.controller == name ) {
+      DatagrumpSender<ControllerType> sender( host_, port_, options_ );
+      exit_status = sender.loop();
+    }
+  }
+};
+
 int main( int argc, char *argv[] )
 {
    /* check the command-line arguments */
@@ -42,33 +198,132 @@ int main( int argc, char *argv[] )
     abort();
   }
 
-  bool debug = false;
-  if ( argc == 4 and string( argv[ 3 ] ) == "debug" ) {
-    debug = true;
-  } else if ( argc == 3 ) {
-    /* do nothing */
-  } else {
-    cerr << "Usage: " << argv[ 0 ] << " HOST PORT [debug]" << endl;
+  ControllerNames registry;
+  for_each_controller( registry );
+
+  SenderOptions options;
+  bool usage_ok = argc >= 3;
+  for ( int i = 3; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option == "debug" ) {
+      options.debug = true;
+    } else if ( option.compare( 0, 6, "trace=" ) == 0 ) {
+      options.trace_file = option.substr( 6 );
+      usage_ok = usage_ok and not options.trace_file.empty();
+    } else if ( option.compare( 0, 6, "stats=" ) == 0 ) {
+      options.stats_file = option.substr( 6 );
+      usage_ok = usage_ok and not options.stats_file.empty();
+    } else if ( option == "batch" ) {
+      options.batch = true;
+    } else if ( option == "gso" ) {
+      options.batch = options.gso = true;
+    } else if ( option == "uring" ) {
+#ifdef HAVE_LINUX_IO_URING_H
+      options.uring = true;
+#else
+      cerr << argv[ 0 ] << ": uring is not available (built without linux/io_uring.h)" << endl;
+      return EXIT_FAILURE;
+#endif
+    } else if ( option == "pace" ) {
+      options.pace = true;
+    } else if ( option == "fq" ) {
+      options.fq = true;
+    } else if ( registry.names.count( option ) ) {
+      options.controller = option;
+    } else if ( option.compare( 0, 6, "delay=" ) == 0 ) {
+      options.controller = "delay";
+      try {
+	options.delay_target_ms = stoul( option.substr( 6 ) );
+      } catch ( const exception & ) {
+	usage_ok = false;
+      }
+      usage_ok = usage_ok and options.delay_target_ms > 0;
+    } else {
+      usage_ok = false;
+    }
+  }
+
+  if ( options.uring and options.batch ) {
+    usage_ok = false; /* io_uring already submits each burst with one system call */
+  }
+
+  /* BBR needs pacing, so use timer pacing unless something else was asked for */
+  if ( options.controller == "bbr"
+       and not ( options.fq or options.batch or options.uring ) ) {
+    options.pace = true;
+  }
+
+  if ( options.pace and ( options.fq or options.batch or options.uring ) ) {
+    usage_ok = false; /* timer pacing sends one datagram at a time */
+  }
+
+  if ( not usage_ok ) {
+    cerr << "Usage: " << argv[ 0 ] << " HOST PORT [debug] [trace=FILE] [stats=FILE] [batch | gso | uring] [pace | fq] [CONTROLLER] [delay=TARGET_MS]" << endl
+	 << "Controllers:" << endl << registry.descriptions;
     return EXIT_FAILURE;
   }
 
   /* create sender object to handle the accounting */
   /* all the interesting work is done by the Controller */
-  DatagrumpSender sender( argv[ 1 ], argv[ 2 ], debug );
-  return sender.loop();
+  SenderLauncher launcher( argv[ 1 ], argv[ 2 ], options );
+  for_each_controller( launcher );
+  return launcher.exit_status;
 }
 
-DatagrumpSender::DatagrumpSender( const char * const host,
-				  const char * const port,
-				  const bool debug )
+template <class ControllerType>
+DatagrumpSender<ControllerType>::DatagrumpSender( const char * const host,
+						  const char * const port,
+						  const SenderOptions & options )
   : socket_(),
-    controller_( debug ),
+    trace_( open_trace( options ) ),
+    controller_( options.controller_options( trace_.get() ) ),
+    debug_( options.debug ),
+    stats_(),
+    exporter_(),
+#ifdef HAVE_LINUX_IO_URING_H
+    ring_( options.uring ? new IOUring : nullptr ),
+#endif
+    batch_( options.batch ),
+    burst_(),
+    burst_count_( 0 ),
+    burst_datagrams_( 0 ),
+    pace_( options.pace ),
+    fq_( options.fq ),
+    next_send_ns_( 0 ),
+    fq_rate_( 0 ),
+    last_send_ns_( 0 ),
+    gap_count_( 0 ),
+    gap_sum_ns_( 0 ),
+    gap_min_ns_( -1 ),
+    gap_max_ns_( 0 ),
+    datagram_(),
     sequence_number_( 0 ),
-    next_ack_expected_( 0 )
+    last_activity_ns_( 0 ),
+    scoreboard_(),
+    range_ack_()
 {
   /* turn on timestamps when socket receives a datagram */
   socket_.set_timestamps();
 
+  if ( not options.stats_file.empty() ) {
+    stats_.reset( new SenderStats );
+    exporter_.reset( new StatsExporter( open_for_writing( options.stats_file, O_APPEND ) ) );
+    exporter_->add( "sent", stats_->sent );
+    exporter_->add( "acked", stats_->acked );
+    exporter_->add( "lost", stats_->lost );
+    exporter_->add( "timeouts", stats_->timeouts );
+    exporter_->add( "late_acks", stats_->late_acks );
+    exporter_->add( "rtt_ns", stats_->rtt_ns );
+    exporter_->add( "one_way_delay_ns", stats_->one_way_delay_ns );
+    exporter_->add( "window", stats_->window );
+    exporter_->start();
+  }
+
+  /* coalesce each burst into GSO super-buffers if the kernel allows */
+  if ( options.gso and not socket_.enable_gso() ) {
+    cerr << "Kernel does not support UDP GSO; sending datagrams individually" << endl;
+  }
+
   /* connect socket to the remote host */
   /* (note: this doesn't send anything; it just tags the socket
      locally with the remote address */
@@ -77,79 +332,365 @@ DatagrumpSender::DatagrumpSender( const char * const host,
   cerr << "Sending to " << socket_.peer_address().to_string() << endl;
 }
 
-void DatagrumpSender::got_ack( const uint64_t timestamp,
-			       const ContestMessage & ack )
+/* an ack of one datagram, or (from a coalescing receiver) of several */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::got_datagram( const uint64_t timestamp,
+						    const char * data, const size_t length )
+{
+  if ( RangeAck::is_range_ack( data, length ) ) {
+    got_range_ack( timestamp, data, length );
+  } else {
+    got_ack( timestamp, ContestMessageView( data, length ) );
+  }
+}
+
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::got_range_ack( const uint64_t timestamp,
+						     const char * data, const size_t length )
+{
+  range_ack_.parse( data, length );
+
+  for ( const auto & datagram : range_ack_.datagrams() ) {
+    /* (the ack doesn't carry the send timestamps, but the scoreboard has them) */
+    uint64_t send_timestamp;
+    if ( not scoreboard_.send_timestamp( datagram.sequence_number, send_timestamp ) ) {
+      continue;
+    }
+
+    ack_was_received( timestamp, datagram.sequence_number, send_timestamp, datagram.recv_timestamp );
+  }
+
+  /* (after the whole ack, so a datagram it covers is never called lost) */
+  datagrams_were_lost( scoreboard_.detect_losses( timestamp ), timestamp );
+}
+
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::got_ack( const uint64_t timestamp,
+					       const ContestMessageView & ack )
 {
   if ( not ack.is_ack() ) {
     throw runtime_error( "sender got something other than an ack from the receiver" );
   }
 
-  /* Update sender's counter */
-  next_ack_expected_ = max( next_ack_expected_,
-			    ack.header.ack_sequence_number + 1 );
+  /* Update the scoreboard and inform the congestion controller,
+     then see what the ack says about earlier datagrams */
+  ack_was_received( timestamp, ack.header.ack_sequence_number,
+		    ack.header.ack_send_timestamp, ack.header.ack_recv_timestamp );
+  datagrams_were_lost( scoreboard_.detect_losses( timestamp ), timestamp );
+}
+
+/* record an ack on the scoreboard, and if it is news, trace it,
+   count it in the statistics, and tell the controller */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::ack_was_received( const uint64_t timestamp,
+							const uint64_t sequence_number,
+							const uint64_t send_timestamp,
+							const uint64_t recv_timestamp )
+{
+  switch ( scoreboard_.acked( sequence_number, timestamp ) ) {
+  case Scoreboard::AckType::Stale:
+    return;
+  case Scoreboard::AckType::Late:
+    /* (already counted as lost, and not a new delivery) */
+    if ( stats_ ) {
+      stats_->late_acks.add();
+    }
+    return;
+  case Scoreboard::AckType::New:
+    break;
+  }
+
+  if ( trace_ ) {
+    trace_->acked( timestamp, sequence_number, send_timestamp, recv_timestamp );
+  }
 
-  /* Inform congestion controller */
-  controller_.ack_received( ack.header.ack_sequence_number,
-			    ack.header.ack_send_timestamp,
-			    ack.header.ack_recv_timestamp,
-			    timestamp );
+  if ( stats_ ) {
+    stats_->acked.add();
+    stats_->rtt_ns.record( timestamp > send_timestamp ? timestamp - send_timestamp : 0 );
+    stats_->one_way_delay_ns.record( stats_->one_way_delay.above_minimum( send_timestamp, recv_timestamp ) );
+    stats_->window.record( controller_.window_size() );
+  }
+
+  controller_.ack_received( sequence_number, send_timestamp, recv_timestamp, timestamp );
+}
+
+/* record a send on the scoreboard, and tell the controller */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::datagram_was_sent( const uint64_t sequence_number,
+							 const uint64_t send_timestamp,
+							 const bool after_timeout )
+{
+  scoreboard_.sent( sequence_number, send_timestamp );
+  last_activity_ns_ = send_timestamp;
+
+  if ( trace_ ) {
+    trace_->sent( send_timestamp, sequence_number, after_timeout );
+  }
+
+  if ( stats_ ) {
+    stats_->sent.add();
+  }
+
+  controller_.datagram_was_sent( sequence_number, send_timestamp, after_timeout );
+}
+
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::datagrams_were_lost( const uint64_t count,
+							   const uint64_t timestamp )
+{
+  if ( count == 0 ) {
+    return;
+  }
+
+  if ( stats_ ) {
+    stats_->lost.add( count );
+  }
+
+  if ( trace_ ) {
+    trace_->lost( timestamp, count, scoreboard_.lost_count(), scoreboard_.spurious_loss_count() );
+  }
+}
+
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::timed_out()
+{
+  const uint64_t now = timestamp_ns();
+  if ( trace_ ) {
+    trace_->timed_out( now, scoreboard_.in_flight() );
+  }
+
+  if ( stats_ ) {
+    stats_->timeouts.add();
+  }
+
+  datagrams_were_lost( scoreboard_.declare_all_lost(), now );
 }
 
-void DatagrumpSender::send_datagram( const bool after_timeout )
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::send_datagram( const bool after_timeout )
 {
   /* All messages use the same dummy payload */
   static const string dummy_payload( 1424, 'x' );
 
-  ContestMessage cm( sequence_number_++, dummy_payload );
+  ContestMessageView cm( sequence_number_++, dummy_payload.data(), dummy_payload.size() );
   cm.set_send_timestamp();
-  socket_.send( cm.to_string() );
+  cm.serialize( datagram_ );
+#ifdef HAVE_LINUX_IO_URING_H
+  if ( ring_ ) {
+    /* (submitted by the next run) */
+    ring_->write( socket_, datagram_.data(), datagram_.size() );
+  } else {
+    socket_.send( datagram_ );
+  }
+#else
+  socket_.send( datagram_ );
+#endif
+
+  datagram_was_sent( cm.header.sequence_number, cm.header.send_timestamp, after_timeout );
+}
+
+/* close the window with a single sendmmsg() */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::send_burst()
+{
+  static const string dummy_payload( 1424, 'x' );
+
+  /* assemble the whole burst, timestamping each datagram as it is queued */
+  size_t burst_size = 0;
+  while ( window_is_open() ) {
+    ContestMessageView cm( sequence_number_++, dummy_payload.data(), dummy_payload.size() );
+    cm.set_send_timestamp();
+
+    if ( burst_size == burst_.size() ) {
+      burst_.emplace_back();
+    }
+    cm.serialize( burst_[ burst_size++ ] );
+
+    datagram_was_sent( cm.header.sequence_number, cm.header.send_timestamp, false );
+  }
+
+  socket_.send_batch( burst_, burst_size );
 
-  /* Inform congestion controller */
-  controller_.datagram_was_sent( cm.header.sequence_number,
-				 cm.header.send_timestamp,
-				 after_timeout );
+  burst_count_++;
+  burst_datagrams_ += burst_size;
+
+  if ( debug_ ) {
+    cerr << "Sent burst of " << burst_size << " datagrams (average burst "
+	 << double( burst_datagrams_ ) / burst_count_ << ")" << endl;
+  }
 }
 
-bool DatagrumpSender::window_is_open()
+/* send one datagram, then wake up when the pacing rate allows another */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::send_paced( Poller & poller )
 {
-  return sequence_number_ - next_ack_expected_ < controller_.window_size();
+  send_datagram( false );
+
+  const uint64_t now = timestamp_ns();
+  if ( last_send_ns_ ) {
+    const uint64_t gap = now - last_send_ns_;
+    gap_count_++;
+    gap_sum_ns_ += gap;
+    gap_min_ns_ = min( gap_min_ns_, gap );
+    gap_max_ns_ = max( gap_max_ns_, gap );
+  }
+  last_send_ns_ = now;
+
+  const double rate = controller_.pacing_rate();
+  if ( rate <= 0 ) {
+    next_send_ns_ = now; /* pacing turned off: no need to wait */
+    return;
+  }
+
+  /* keep the cadence despite small wakeup delays, but don't bank
+     credit for time spent with the window closed */
+  const uint64_t gap = 1e9 / rate;
+  next_send_ns_ = next_send_ns_ + gap > now ? next_send_ns_ + gap : now + gap;
+  poller.add_timer( next_send_ns_ - now, [] () { return ResultType::Continue; } );
 }
 
-int DatagrumpSender::loop()
+/* print the achieved inter-send gaps since the last report */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::report_gaps()
 {
+  if ( gap_count_ == 0 ) {
+    return;
+  }
+
+  const double rate = controller_.pacing_rate();
+  cerr << "Paced " << gap_count_ << " gaps: target "
+       << ( rate > 0 ? 1e6 / rate : 0 ) << " us, mean "
+       << gap_sum_ns_ / 1e3 / gap_count_ << " us (min "
+       << gap_min_ns_ / 1e3 << ", max " << gap_max_ns_ / 1e3 << ")" << endl;
+
+  gap_count_ = gap_sum_ns_ = gap_max_ns_ = 0;
+  gap_min_ns_ = -1;
+}
+
+template <class ControllerType>
+bool DatagrumpSender<ControllerType>::window_is_open()
+{
+  const unsigned int window_size = controller_.window_size();
+  if ( trace_ ) {
+    trace_->window( window_size );
+  }
+
+  return scoreboard_.in_flight() < window_size;
+}
+
+template <class ControllerType>
+int DatagrumpSender<ControllerType>::loop()
+{
+#ifdef HAVE_LINUX_IO_URING_H
+  if ( ring_ ) {
+    return loop_uring();
+  }
+#endif
+
   /* read and write from the receiver using an event-driven "poller" */
   Poller poller;
 
+  /* how many acks to pull from the socket per system call */
+  const unsigned int ack_batch_size = 64;
+
   /* first rule: if the window is open, close it by
      sending more datagrams */
   poller.add_action( Action( socket_, Direction::Out, [&] () {
+	/* let the qdisc pace at the controller's current rate */
+	if ( fq_ and controller_.pacing_rate() != fq_rate_ ) {
+	  static const double datagram_bytes = 1472;
+	  fq_rate_ = controller_.pacing_rate();
+	  socket_.set_max_pacing_rate( fq_rate_ > 0 ? uint64_t( fq_rate_ * datagram_bytes ) : uint64_t( -1 ) );
+	}
+
 	/* Close the window */
-	while ( window_is_open() ) {
-	  send_datagram( false );
+	if ( pace_ and controller_.pacing_rate() > 0 ) {
+	  send_paced( poller );
+	} else if ( batch_ ) {
+	  send_burst();
+	} else {
+	  while ( window_is_open() ) {
+	    send_datagram( false );
+	  }
 	}
 	return ResultType::Continue;
       },
-      /* We're only interested in this rule when the window is open */
-      [&] () { return window_is_open(); } ) );
+      /* We're only interested in this rule when the window is open
+	 (and, if pacing, when it's time for the next datagram) */
+      [&] () { return window_is_open() and ( not pace_ or timestamp_ns() >= next_send_ns_ ); } ) );
 
   /* second rule: if sender receives an ack,
      process it and inform the controller
      (by using the sender's got_ack method) */
   poller.add_action( Action( socket_, Direction::In, [&] () {
-	const UDPSocket::received_datagram recd = socket_.recv();
-	const ContestMessage ack  = recd.payload;
-	got_ack( recd.timestamp, ack );
+	/* drain every ack that has already arrived */
+	for ( const auto & recd : socket_.recv_batch( ack_batch_size ) ) {
+	  got_datagram( recd.timestamp, recd.payload, recd.payload_length );
+	}
+	last_activity_ns_ = timestamp_ns();
 	return ResultType::Continue;
       } ) );
 
-  /* Run these two rules forever */
+  if ( pace_ ) {
+    /* the gaps are often a few microseconds, far less than the default timer slack */
+    Poller::set_timer_slack( 1 );
+
+    /* report the achieved pacing once a second */
+    poller.add_timer( 1000000000, [&] () {
+	report_gaps();
+	return ResultType::Continue;
+      }, 1000000000 );
+  }
+
+  /* Run these two rules forever, giving up on what's in flight if
+     nothing is sent or acked for the controller's timeout (tracked
+     here, since the pacing and report timers also end each poll) */
+  last_activity_ns_ = timestamp_ns();
   while ( true ) {
-    const auto ret = poller.poll( controller_.timeout_ms() );
+    const uint64_t deadline = last_activity_ns_ + uint64_t( controller_.timeout_ms() ) * 1000000;
+    const uint64_t now = timestamp_ns();
+    const auto ret = poller.poll( deadline > now ? ( deadline - now + 999999 ) / 1000000 : 0 );
     if ( ret.result == PollResult::Exit ) {
+      if ( batch_ and burst_count_ ) {
+	cerr << "Sent " << burst_datagrams_ << " datagrams in " << burst_count_
+	     << " bursts (average " << double( burst_datagrams_ ) / burst_count_ << ")" << endl;
+      }
       return ret.exit_status;
-    } else if ( ret.result == PollResult::Timeout ) {
-      /* After a timeout, send one datagram to try to get things moving again */
+    } else if ( timestamp_ns() >= last_activity_ns_ + uint64_t( controller_.timeout_ms() ) * 1000000 ) {
+      /* After a timeout, give up on what's in flight, and
+	 send one datagram to try to get things moving again */
+      timed_out();
+      send_datagram( true );
+    }
+  }
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+template <class ControllerType>
+int DatagrumpSender<ControllerType>::loop_uring()
+{
+  /* receive every ack with one long-lived multishot recvmsg */
+  IOUring::BufferGroup ack_buffers( *ring_, 0, 256, 2048 );
+  ring_->recv_multishot( socket_, ack_buffers, [&] ( const UDPSocket::batched_datagram & recd ) {
+      got_datagram( recd.timestamp, recd.payload, recd.payload_length );
+    } );
+
+  while ( true ) {
+    /* queue enough datagrams to close the window */
+    while ( window_is_open() ) {
+      send_datagram( false );
+    }
+
+    /* submit them, then wait for acks (or send completions) */
+    const auto ret = ring_->run( controller_.timeout_ms() );
+    if ( ret.result == IOUring::Result::Type::Exit ) {
+      return EXIT_SUCCESS;
+    } else if ( ret.result == IOUring::Result::Type::Timeout ) {
+      /* After a timeout, give up on what's in flight, and
+	 send one datagram to try to get things moving again */
+      timed_out();
       send_datagram( true );
     }
   }
 }
+#endif
@@ -0,0 +1,228 @@
+/* run congestion controllers against trace-driven links in simulation,
+   sweeping controllers, delay targets and traces across every core */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "controller_registry.hh"
+#include "simulation.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* one point of the sweep */
+struct Job
+{
+  size_t trace_index;
+  string controller;
+  uint64_t delay_target_ms;
+};
+
+/* a pair of traces, read once and shared by every run that uses them */
+struct TracePair
+{
+  string uplink_name, downlink_name;
+  LinkTrace uplink, downlink;
+};
+
+/* the registered controllers' names */
+struct ControllerNames
+{
+  set<string> names {};
+
+  template <class ControllerType>
+  void visit( const char * name, const char * )
+  {
+    names.insert( name );
+  }
+};
+
+/* run one job with the controller it names */
+class SimulationRunner
+{
+private:
+  const Job & job_;
+  const TracePair & traces_;
+  SimulationConfig config_;
+
+public:
+  LinkScore score;
+
+  SimulationRunner( const Job & job, const TracePair & traces, const SimulationConfig & config )
+    : job_( job ), traces_( traces ), config_( config ), score()
+  {
+    config_.controller_options.delay_target_ns = job.delay_target_ms * 1000000;
+  }
+
+  template <class ControllerType>
+  void visit( const char * name, const char * )
+  {
+    if ( job_.controller == name ) {
+      Simulation<ControllerType> simulation( traces_.uplink, traces_.downlink, config_ );
+      score = simulation.run();
+    }
+  }
+};
+
+/* split a comma-separated list */
+static vector<string> split( const string & list )
+{
+  vector<string> ret;
+  istringstream in( list );
+  string item;
+  while ( getline( in, item, ',' ) ) {
+    if ( not item.empty() ) {
+      ret.push_back( item );
+    }
+  }
+  return ret;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  ControllerNames registry;
+  for_each_controller( registry );
+
+  SimulationConfig config;
+  vector<string> controllers { "fixed" };
+  vector<uint64_t> delay_targets { 100 };
+  vector<string> trace_arguments;
+  unsigned int threads = max( 1u, thread::hardware_concurrency() );
+
+  bool usage_ok = true;
+  for ( int i = 1; i < argc; i++ ) {
+    const string argument { argv[ i ] };
+    const size_t equals = argument.find( '=' );
+    if ( equals == string::npos ) {
+      trace_arguments.push_back( argument );
+      continue;
+    }
+
+    const string name = argument.substr( 0, equals ), value = argument.substr( equals + 1 );
+    try {
+      if ( name == "controllers" ) {
+	controllers = split( value );
+	for ( const auto & controller : controllers ) {
+	  usage_ok = usage_ok and registry.names.count( controller );
+	}
+      } else if ( name == "targets" ) {
+	delay_targets.clear();
+	for ( const auto & target : split( value ) ) {
+	  delay_targets.push_back( stoull( target ) );
+	  usage_ok = usage_ok and delay_targets.back() > 0;
+	}
+      } else if ( name == "delay" ) {
+	config.propagation_delay_ns = stoull( value ) * 1000000;
+      } else if ( name == "queue" ) {
+	config.queue = value;
+      } else if ( name == "packets" ) {
+	config.queue_packets = stoull( value );
+      } else if ( name == "bytes" ) {
+	config.queue_bytes = stoull( value );
+      } else if ( name == "duration" ) {
+	config.duration_ns = stod( value ) * 1e9;
+      } else if ( name == "threads" ) {
+	threads = stoul( value );
+	usage_ok = usage_ok and threads > 0;
+      } else {
+	usage_ok = false;
+      }
+    } catch ( const exception & ) {
+      usage_ok = false;
+    }
+  }
+
+  usage_ok = usage_ok and not trace_arguments.empty()
+    and not controllers.empty() and not delay_targets.empty();
+
+  if ( not usage_ok ) {
+    cerr << "Usage: " << argv[ 0 ] << " [controllers=NAME,...] [targets=DELAY_TARGET_MS,...]"
+	 << " [delay=MS] [queue=infinite|droptail|codel] [packets=N] [bytes=N]"
+	 << " [duration=SECONDS] [threads=N] UPLINK_TRACE[:DOWNLINK_TRACE] ..." << endl
+	 << "Controllers:";
+    for ( const auto & name : registry.names ) {
+      cerr << " " << name;
+    }
+    cerr << endl;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    /* read every trace (once), and check the queue settings before starting */
+    vector<TracePair> traces;
+    for ( const auto & argument : trace_arguments ) {
+      const size_t colon = argument.find( ':' );
+      const string uplink = argument.substr( 0, colon );
+      const string downlink = colon == string::npos ? uplink : argument.substr( colon + 1 );
+      traces.push_back( { uplink, downlink, LinkTrace( uplink ), LinkTrace( downlink ) } );
+    }
+    LinkQueue::make( config.queue, config.queue_packets, config.queue_bytes );
+
+    /* every combination of trace, controller and delay target */
+    vector<Job> jobs;
+    for ( size_t trace = 0; trace < traces.size(); trace++ ) {
+      for ( const auto & controller : controllers ) {
+	for ( const auto & target : delay_targets ) {
+	  jobs.push_back( { trace, controller, target } );
+	}
+      }
+    }
+
+    /* each thread takes the next job until there are none left */
+    vector<LinkScore> scores( jobs.size() );
+    vector<string> errors( jobs.size() );
+    atomic<size_t> next_job( 0 );
+
+    const auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    threads = min<size_t>( threads, jobs.size() );
+    for ( unsigned int i = 0; i < threads; i++ ) {
+      workers.emplace_back( [&] () {
+	  for ( size_t job = next_job++; job < jobs.size(); job = next_job++ ) {
+	    try {
+	      SimulationRunner runner( jobs[ job ], traces[ jobs[ job ].trace_index ], config );
+	      for_each_controller( runner );
+	      scores[ job ] = runner.score;
+	    } catch ( const exception & e ) {
+	      errors[ job ] = e.what();
+	    }
+	  }
+	} );
+    }
+    for ( auto & worker : workers ) {
+      worker.join();
+    }
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    /* one tab-separated line per run, in the order of the sweep */
+    cout << "# uplink\tdownlink\tcontroller\tdelay_target_ms\t" << LinkScore::header() << "\n";
+    for ( size_t job = 0; job < jobs.size(); job++ ) {
+      if ( not errors[ job ].empty() ) {
+	throw runtime_error( "simulation of " + traces[ jobs[ job ].trace_index ].uplink_name
+			     + " with " + jobs[ job ].controller + " failed: " + errors[ job ] );
+      }
+      const TracePair & trace = traces[ jobs[ job ].trace_index ];
+      cout << trace.uplink_name << "\t" << trace.downlink_name << "\t" << jobs[ job ].controller
+	   << "\t" << jobs[ job ].delay_target_ms << "\t" << scores[ job ].to_string() << "\n";
+    }
+
+    cerr << "Simulated " << jobs.size() << " runs in " << elapsed.count()
+	 << " s on " << threads << " threads" << endl;
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+#ifndef SIMULATION_HH
+#define SIMULATION_HH
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "contest_message.hh"
+#include "controller.hh"
+#include "link.hh"
+#include "link_score.hh"
+#include "scoreboard.hh"
+
+/* how to set up one simulated run */
+struct SimulationConfig
+{
+  uint64_t propagation_delay_ns = 20000000; /* one way, in each direction (like mm-delay 20) */
+  std::string queue = "infinite";           /* queue discipline (see LinkQueue::make) */
+  uint64_t queue_packets = 0, queue_bytes = 0;
+  uint64_t duration_ns = 0;                 /* 0: one pass through the uplink trace */
+  ControllerOptions controller_options {};
+};
+
+/* Discrete-event simulation of the contest: the sender's accounting
+   (as in sender.cc) around a congestion controller, a receiver that
+   acks every datagram, and a trace-driven link in each direction, all
+   on a virtual clock. Nothing touches a socket or the real clock, so a
+   run takes as long as the computation, and the result is the same
+   every time. */
+template <class ControllerType>
+class Simulation
+{
+private:
+  /* bytes on the wire (IP and UDP headers included) */
+  static const size_t DATAGRAM_BYTES = 1472 + 28;
+  static const size_t ACK_BYTES = ContestMessage::Header::wire_size + 28;
+
+  ControllerType controller_;
+  Link uplink_, downlink_;
+  uint64_t propagation_delay_ns_, end_ns_;
+
+  LinkScorer scorer_;
+
+  /* virtual time, in ns since the start */
+  uint64_t now_;
+
+  /* sender state (see DatagrumpSender) */
+  uint64_t sequence_number_;
+  Scoreboard scoreboard_;
+  uint64_t next_send_ns_;        /* when pacing allows the next datagram */
+  uint64_t last_activity_ns_;    /* for the timeout: the last send or ack */
+  std::vector<uint64_t> send_timestamps_; /* by sequence number (what each ack carries) */
+
+  bool window_is_open()
+  {
+    return scoreboard_.in_flight() < controller_.window_size();
+  }
+
+  void send_datagram( const bool after_timeout )
+  {
+    const uint64_t sequence_number = sequence_number_++;
+    send_timestamps_.push_back( now_ );
+    scoreboard_.sent( sequence_number, now_ );
+    uplink_.enqueue( LinkPacket( DATAGRAM_BYTES, std::string(), sequence_number ), now_ );
+    scorer_.arrival( now_ / 1000000, DATAGRAM_BYTES );
+    last_activity_ns_ = now_;
+
+    controller_.datagram_was_sent( sequence_number, now_, after_timeout );
+  }
+
+  /* send what the window and the pacing rate allow */
+  void send()
+  {
+    while ( window_is_open() and now_ >= next_send_ns_ ) {
+      send_datagram( false );
+
+      const double rate = controller_.pacing_rate();
+      if ( rate > 0 ) {
+	/* (as in DatagrumpSender::send_paced) */
+	const uint64_t gap = std::max( 1.0, 1e9 / rate );
+	next_send_ns_ = next_send_ns_ + gap > now_ ? next_send_ns_ + gap : now_ + gap;
+      }
+    }
+  }
+
+  /* the receiver acks everything that has come across the uplink */
+  void receive()
+  {
+    LinkPacket packet;
+    while ( uplink_.take_delivered( packet, now_ ) ) {
+      const uint64_t departure = now_ - propagation_delay_ns_;
+      scorer_.departure( departure / 1000000, packet.size,
+			 departure / 1000000 - packet.arrival_time / 1000000 );
+
+      /* (the ack's arrival time on the downlink is when the receiver got the datagram) */
+      downlink_.enqueue( LinkPacket( ACK_BYTES, std::string(), packet.tag ), now_ );
+    }
+
+    while ( downlink_.take_delivered( packet, now_ ) ) {
+      last_activity_ns_ = now_;
+
+      /* (as in the sender, only news goes to the controller) */
+      if ( scoreboard_.acked( packet.tag, now_ ) == Scoreboard::AckType::New ) {
+	controller_.ack_received( packet.tag, send_timestamps_.at( packet.tag ),
+				  packet.arrival_time, now_ );
+      }
+      scoreboard_.detect_losses( now_ );
+    }
+  }
+
+public:
+  Simulation( const LinkTrace & uplink_trace, const LinkTrace & downlink_trace,
+	      const SimulationConfig & config )
+    : controller_( config.controller_options ),
+      uplink_( uplink_trace, LinkQueue::make( config.queue, config.queue_packets, config.queue_bytes ),
+	       config.propagation_delay_ns ),
+      downlink_( downlink_trace, LinkQueue::make( config.queue, config.queue_packets, config.queue_bytes ),
+		 config.propagation_delay_ns ),
+      propagation_delay_ns_( config.propagation_delay_ns ),
+      end_ns_( config.duration_ns ? config.duration_ns : uplink_trace.period_ns() ),
+      scorer_( config.propagation_delay_ns / 1000000 ),
+      now_( 0 ),
+      sequence_number_( 0 ),
+      scoreboard_(),
+      next_send_ns_( 0 ),
+      last_activity_ns_( 0 ),
+      send_timestamps_()
+  {}
+
+  /* run to the end, and score the uplink as mm-throughput-graph would */
+  LinkScore run()
+  {
+    while ( now_ < end_ns_ ) {
+      uplink_.advance( now_ );
+      downlink_.advance( now_ );
+      receive();
+      send();
+
+      /* after a timeout, give up on what's in flight, and
+	 send one datagram to try to get things moving again */
+      const uint64_t timeout_ns = uint64_t( controller_.timeout_ms() ) * 1000000;
+      if ( now_ >= last_activity_ns_ + timeout_ns ) {
+	scoreboard_.declare_all_lost();
+	send_datagram( true );
+      }
+
+      /* skip ahead to whatever happens next */
+      uint64_t next = std::min( end_ns_, last_activity_ns_ + timeout_ns );
+      next = std::min( next, std::min( uplink_.next_event_time(), downlink_.next_event_time() ) );
+      if ( next_send_ns_ > now_ and window_is_open() ) {
+	next = std::min( next, next_send_ns_ );
+      }
+      now_ = std::max( next, now_ + 1 );
+    }
+
+    /* the uplink's delivery opportunities during the run */
+    for ( uint64_t i = 0; uplink_.trace().opportunity( i ) < end_ns_; i++ ) {
+      scorer_.opportunity( uplink_.trace().opportunity( i ) / 1000000, Link::MTU );
+    }
+    scorer_.drop( ( end_ns_ - 1 ) / 1000000, uplink_.dropped_packets() );
+
+    return scorer_.score();
+  }
+};
+
+#endif /* SIMULATION_HH */
@@ -0,0 +1,118 @@
+#include <chrono>
+#include <stdexcept>
+
+#include "stats_export.hh"
+#include "timestamp.hh"
+#include "util.hh"
+
+using namespace std;
+
+StatsExporter::StatsExporter( FileDescriptor && output, const uint64_t interval_ns )
+  : histograms_(),
+    counters_(),
+    scratch_(),
+    output_( move( output ) ),
+    interval_ns_( interval_ns ),
+    last_export_ns_( 0 ),
+    line_(),
+    mutex_(),
+    wakeup_(),
+    stopping_( false ),
+    exporter_()
+{
+  if ( interval_ns_ == 0 ) {
+    throw runtime_error( "StatsExporter: interval must be positive" );
+  }
+}
+
+StatsExporter::~StatsExporter()
+{
+  if ( not exporter_.joinable() ) {
+    return;
+  }
+
+  {
+    unique_lock<mutex> lock( mutex_ );
+    stopping_ = true;
+  }
+  wakeup_.notify_all();
+  exporter_.join();
+}
+
+void StatsExporter::add( const string & name, const vector<const Histogram *> & sources )
+{
+  if ( exporter_.joinable() ) {
+    throw runtime_error( "StatsExporter: " + name + " added after start()" );
+  }
+  histograms_.push_back( { name, sources, Histogram::Snapshot() } );
+}
+
+void StatsExporter::add( const string & name, const vector<const Counter *> & sources )
+{
+  if ( exporter_.joinable() ) {
+    throw runtime_error( "StatsExporter: " + name + " added after start()" );
+  }
+  counters_.push_back( { name, sources, 0 } );
+}
+
+void StatsExporter::start()
+{
+  last_export_ns_ = timestamp_ns();
+
+  exporter_ = thread( [&] () {
+      try {
+	unique_lock<mutex> lock( mutex_ );
+	while ( not stopping_ ) {
+	  wakeup_.wait_for( lock, chrono::nanoseconds( interval_ns_ ), [&] () { return stopping_; } );
+	  export_once();
+	}
+      } catch ( const exception & e ) {
+	print_exception( e ); /* (the statistics stop, but not the program) */
+      }
+    } );
+}
+
+void StatsExporter::export_once()
+{
+  const uint64_t now = timestamp_ns();
+  const uint64_t interval = max( uint64_t( 1 ), now - last_export_ns_ );
+  last_export_ns_ = now;
+
+  line_ = "{\"time_ns\":" + to_string( now ) + ",\"interval_ns\":" + to_string( interval );
+
+  for ( auto & counter : counters_ ) {
+    uint64_t total = 0;
+    for ( const Counter * source : counter.sources ) {
+      total += source->value();
+    }
+
+    line_ += ",\"" + counter.name + "\":{\"total\":" + to_string( total )
+      + ",\"per_s\":" + to_string( uint64_t( ( total - counter.last ) * 1e9 / interval ) ) + "}";
+    counter.last = total;
+  }
+
+  for ( auto & histogram : histograms_ ) {
+    /* (keep the running total, and report what changed since last time) */
+    Histogram::Snapshot total;
+    for ( const Histogram * source : histogram.sources ) {
+      source->snapshot( scratch_ );
+      total += scratch_;
+    }
+
+    Histogram::Snapshot & interval_counts = scratch_;
+    interval_counts = total;
+    interval_counts -= histogram.last;
+    histogram.last = total;
+
+    line_ += ",\"" + histogram.name + "\":{\"count\":" + to_string( interval_counts.count )
+      + ",\"mean\":" + to_string( uint64_t( interval_counts.mean() ) )
+      + ",\"p50\":" + to_string( interval_counts.percentile( 0.5 ) )
+      + ",\"p90\":" + to_string( interval_counts.percentile( 0.9 ) )
+      + ",\"p99\":" + to_string( interval_counts.percentile( 0.99 ) )
+      + ",\"p999\":" + to_string( interval_counts.percentile( 0.999 ) )
+      + ",\"max\":" + to_string( interval_counts.max() ) + "}";
+  }
+
+  line_ += "}\n";
+  output_.write( line_ );
+}
@@ -0,0 +1,73 @@
+#ifndef STATS_EXPORT_HH
+#define STATS_EXPORT_HH
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "file_descriptor.hh"
+#include "histogram.hh"
+
+/* Live statistics: once an interval, a background thread snapshots the
+   registered histograms and counters (so the threads recording them
+   never wait) and appends one line of JSON to a file (or FIFO):
+
+   {"time_ns":T,"interval_ns":I,"COUNTER":{"total":N,"per_s":R},...,
+    "HISTOGRAM":{"count":N,"mean":M,"p50":V,"p90":V,"p99":V,"p999":V,"max":V},...}
+
+   Histogram figures cover just the interval; counters give both. */
+class StatsExporter
+{
+private:
+  /* (several sources under one name are added together, e.g. one per worker) */
+  struct HistogramEntry
+  {
+    std::string name;
+    std::vector<const Histogram *> sources;
+    Histogram::Snapshot last;
+  };
+
+  struct CounterEntry
+  {
+    std::string name;
+    std::vector<const Counter *> sources;
+    uint64_t last;
+  };
+
+  std::vector<HistogramEntry> histograms_;
+  std::vector<CounterEntry> counters_;
+  Histogram::Snapshot scratch_;
+
+  FileDescriptor output_;
+  uint64_t interval_ns_, last_export_ns_;
+  std::string line_; /* reused */
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  bool stopping_;
+  std::thread exporter_;
+
+  void export_once();
+
+public:
+  StatsExporter( FileDescriptor && output, const uint64_t interval_ns = 1000000000 );
+
+  /* stop the exporter (after one last line) */
+  ~StatsExporter();
+
+  /* register what to export (before start()) */
+  void add( const std::string & name, const std::vector<const Histogram *> & sources );
+  void add( const std::string & name, const std::vector<const Counter *> & sources );
+  void add( const std::string & name, const Histogram & source ) { add( name, std::vector<const Histogram *> { &source } ); }
+  void add( const std::string & name, const Counter & source ) { add( name, std::vector<const Counter *> { &source } ); }
+
+  void start();
+
+  /* forbid copying */
+  StatsExporter( const StatsExporter & other ) = delete;
+  const StatsExporter & operator=( const StatsExporter & other ) = delete;
+};
+
+#endif /* STATS_EXPORT_HH */
@@ -0,0 +1,86 @@
+/* print a sender's binary event trace (see event_trace.hh) as text or CSV */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+
+#include "event_trace.hh"
+#include "file_descriptor.hh"
+#include "util.hh"
+
+using namespace std;
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  bool csv = false;
+  bool usage_ok = argc >= 2;
+  for ( int i = 2; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option == "csv" ) {
+      csv = true;
+    } else {
+      usage_ok = false;
+    }
+  }
+
+  if ( not usage_ok ) {
+    cerr << "Usage: " << argv[ 0 ] << " TRACEFILE [csv]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    const string filename { argv[ 1 ] };
+    FileDescriptor file( SystemCall( "open " + filename, open( filename.c_str(), O_RDONLY ) ) );
+
+    if ( file.read( EventTrace::MAGIC.size() ) != EventTrace::MAGIC ) {
+      throw runtime_error( filename + ": not an event trace" );
+    }
+
+    /* whole records at a time (a read can end partway through one) */
+    const size_t record_size = sizeof( EventTrace::Record );
+    vector<char> buffer( 4096 * record_size );
+    size_t buffered = 0;
+    string output = csv ? EventTrace::csv_header() : string();
+
+    while ( true ) {
+      const size_t bytes_read = file.read( buffer.data() + buffered, buffer.size() - buffered );
+      buffered += bytes_read;
+
+      size_t offset = 0;
+      for ( ; offset + record_size <= buffered; offset += record_size ) {
+	EventTrace::Record record;
+	memcpy( &record, buffer.data() + offset, record_size );
+	if ( csv ) {
+	  EventTrace::append_csv( record, output );
+	} else {
+	  EventTrace::append_text( record, output );
+	}
+      }
+      memmove( buffer.data(), buffer.data() + offset, buffered - offset );
+      buffered -= offset;
+
+      cout << output;
+      output.clear();
+
+      if ( bytes_read == 0 ) {
+	break;
+      }
+    }
+
+    if ( buffered ) {
+      cerr << filename << ": ignoring " << buffered << " bytes of a truncated record" << endl;
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+#ifndef WINDOWED_FILTER_HH
+#define WINDOWED_FILTER_HH
+
+#include <cstdint>
+#include <functional>
+
+/* Running minimum or maximum of a signal over a sliding time window
+   (Kathleen Nichols' algorithm, as in Linux's lib/minmax.c). Keeps only
+   the best, second-best and third-best samples from successive sub-windows,
+   so each update takes constant time and memory.
+
+   Better(a, b) says whether sample a is strictly better than b:
+   std::greater<T> for a max filter, std::less<T> for a min filter. */
+template <typename T, typename Better>
+class WindowedFilter
+{
+private:
+  struct Sample
+  {
+    uint64_t time;
+    T value;
+  };
+
+  uint64_t window_;
+  Sample samples_[ 3 ];
+  bool empty_;
+
+  static bool at_least_as_good( const T & a, const T & b ) { return not Better()( b, a ); }
+
+  void reset( const Sample & sample )
+  {
+    samples_[ 0 ] = samples_[ 1 ] = samples_[ 2 ] = sample;
+    empty_ = false;
+  }
+
+public:
+  /* window is in the same units as the times given to update() */
+  WindowedFilter( const uint64_t window )
+    : window_( window ), samples_(), empty_( true )
+  {}
+
+  /* add a measurement taken at `time` (times must not go backwards) */
+  void update( const uint64_t time, const T & value )
+  {
+    const Sample sample { time, value };
+
+    /* new best, or nothing left in the window? */
+    if ( empty_ or at_least_as_good( value, samples_[ 0 ].value )
+	 or time - samples_[ 2 ].time > window_ ) {
+      reset( sample );
+      return;
+    }
+
+    if ( at_least_as_good( value, samples_[ 1 ].value ) ) {
+      samples_[ 2 ] = samples_[ 1 ] = sample;
+    } else if ( at_least_as_good( value, samples_[ 2 ].value ) ) {
+      samples_[ 2 ] = sample;
+    }
+
+    /* expire the best sample(s) once they leave the window, and make
+       sure the second and third choices come from later sub-windows */
+    const uint64_t age = time - samples_[ 0 ].time;
+    if ( age > window_ ) {
+      samples_[ 0 ] = samples_[ 1 ];
+      samples_[ 1 ] = samples_[ 2 ];
+      samples_[ 2 ] = sample;
+      if ( time - samples_[ 0 ].time > window_ ) {
+	samples_[ 0 ] = samples_[ 1 ];
+	samples_[ 1 ] = samples_[ 2 ];
+	samples_[ 2 ] = sample;
+      }
+    } else if ( samples_[ 1 ].time == samples_[ 0 ].time and age > window_ / 4 ) {
+      samples_[ 2 ] = samples_[ 1 ] = sample;
+    } else if ( samples_[ 2 ].time == samples_[ 1 ].time and age > window_ / 2 ) {
+      samples_[ 2 ] = sample;
+    }
+  }
+
+  /* forget everything (the next sample becomes the best) */
+  void clear() { empty_ = true; }
+
+  /* accessors */
+  bool empty() const { return empty_; }
+  const T & best() const { return samples_[ 0 ].value; }
+  uint64_t window() const { return window_; }
+};
+
+/* common cases */
+template <typename T> using WindowedMinFilter = WindowedFilter<T, std::less<T>>;
+template <typename T> using WindowedMaxFilter = WindowedFilter<T, std::greater<T>>;
+
+#endif /* WINDOWED_FILTER_HH */
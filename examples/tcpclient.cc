@@ -4,6 +4,7 @@
 #include "socket.hh"
 #include "util.hh"
 #include "poller.hh"
+#include "ring_buffer.hh"
 
 using namespace std;
 using namespace PollerShortNames;
@@ -35,14 +36,25 @@ int main( int argc, char *argv[] )
   socket.connect( server );
   cerr << "done." << endl;
 
+  /* don't let a slow server hold up the keyboard: writes that the
+     socket won't take right away are queued on it */
+  socket.set_blocking( false );
+
   /* now read and write from the server using an event-driven "poller" */
   Poller poller;
 
   /* first rule: if the socket has data ready (in the "In" direction),
      print it to the screen (cout) */
+  RingBuffer from_server;
   poller.add_action( Action( socket, Direction::In,
 			     [&] () {
-			       cout << socket.read();
+			       /* (printed straight from the buffer it was read into) */
+			       from_server.read_from( socket );
+			       while ( not from_server.empty() ) {
+				 const RingBuffer::Span span = from_server.front();
+				 cout.write( span.data, span.length );
+				 from_server.pop( span.length );
+			       }
 
 			       /* exit if the server closes the connection */
 			       if ( socket.eof() ) {
@@ -61,6 +73,9 @@ int main( int argc, char *argv[] )
 			       return ResultType::Continue;
 			     } ) );
 
+  /* third rule: send whatever is queued once the server will take it */
+  poller.add_flush_action( socket );
+
   /* run these two rules forever until it's time to quit */
   while ( true ) {
     const auto ret = poller.poll( -1 );
@@ -1,10 +1,9 @@
 /* simple TCP listener/server to demonstrate sourdough starter classes */
 /* Keith Winstein <keithw@cs.stanford.edu>, January 2015 */
 
-#include <thread>
 #include <iostream>
 
-#include "socket.hh"
+#include "tcp_server.hh"
 #include "util.hh"
 
 using namespace std;
@@ -21,49 +20,35 @@ int main( int argc, char *argv[] )
     return EXIT_FAILURE;
   }
 
-  /* create a TCP socket */
-  TCPSocket listening_socket;
-
-  /* it's ok to reuse the server's address as soon as the program quits
-     (this helps debugging, at the slight cost to robustness) */
-  listening_socket.set_reuseaddr();
-
-  /* "bind" the socket to the user-specified local port number */
-  listening_socket.bind( Address( "::0", argv[ 1 ] ) );
-
-  /* mark the socket as listening for incoming connections */
-  listening_socket.listen();
-  cerr << "Listening on local address: " << listening_socket.local_address().to_string() << endl;
-
-  /* Wait for clients to connect */
-  while ( true ) {
-
-    /* This line does a lot. It waits for a client to connect
-       ("listening_socket.accept()"). When that returns a new socket,
-       it starts a thread to handle that client and passes in the
-       result of accept() as the "client" parameter to the handler. */
-
-    thread client_handler( [] ( TCPSocket client ) {
-	cerr << "New connection from " << client.peer_address().to_string() << endl;
-
-	/* Print every line that the client sends */
-	while ( true ) {
-	  const string chunk = client.read();
-	  if ( client.eof() ) { break; }
-	  cerr << "Got " << chunk.size() << " bytes from "
-	       << client.peer_address().to_string() << ": " << chunk;
-	  client.write( "Received " + to_string( chunk.size() ) + " bytes from you.\n" );
-	}
-
-	cerr << client.peer_address().to_string() << " closed the connection." << endl; 
-      }, listening_socket.accept() );
-
-    /* Let the client handler continue to run without having
-       to keep track of it. The main thread can go back to accepting
-       new incoming connections. */
-
-    client_handler.detach();
-  }
+  /* what to do with each client: the server calls these from its
+     worker threads (one per core), each of which handles many clients
+     with an event loop, so they must not block */
+  TCPServer::Handlers handlers;
+
+  handlers.on_open = [] ( TCPServer::Connection & client ) {
+    cerr << "New connection from " << client.peer_address().to_string() << endl;
+  };
+
+  /* Print every line that the client sends */
+  handlers.on_data = [] ( TCPServer::Connection & client, const string & chunk ) {
+    cerr << "Got " << chunk.size() << " bytes from "
+	 << client.peer_address().to_string() << ": " << chunk;
+    client.send( "Received " + to_string( chunk.size() ) + " bytes from you.\n" );
+  };
+
+  handlers.on_close = [] ( TCPServer::Connection & client ) {
+    cerr << client.peer_address().to_string() << " closed the connection." << endl;
+  };
+
+  /* listen on the user-specified local port number (the server's
+     sockets reuse the address, which helps debugging at a slight cost
+     to robustness), and start the workers */
+  TCPServer server( Address( "::0", argv[ 1 ] ), handlers );
+  cerr << "Listening on local address: " << server.local_address().to_string()
+       << " (" << server.worker_count() << " workers)" << endl;
+
+  /* the workers run until the program is killed */
+  server.wait();
 
   return EXIT_SUCCESS;
 }
@@ -140,3 +140,14 @@ bool Address::operator==( const Address & other ) const
 {
   return 0 == memcmp( &addr_, &other.addr_, size_ );
 }
+
+/* hash (FNV-1a) */
+size_t hash<Address>::operator()( const Address & address ) const
+{
+  const unsigned char * const bytes = reinterpret_cast<const unsigned char *>( &address.to_sockaddr() );
+  uint64_t ret = 14695981039346656037ull;
+  for ( socklen_t i = 0; i < address.size(); i++ ) {
+    ret = ( ret ^ bytes[ i ] ) * 1099511628211ull;
+  }
+  return ret;
+}
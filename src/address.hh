@@ -1,6 +1,7 @@
 #ifndef ADDRESS_HH
 #define ADDRESS_HH
 
+#include <functional>
 #include <string>
 #include <utility>
 
@@ -49,4 +50,13 @@ public:
   bool operator==( const Address & other ) const;
 };
 
+/* hash of the same bytes operator== compares (for unordered containers) */
+namespace std {
+  template <>
+  struct hash<Address>
+  {
+    size_t operator()( const Address & address ) const;
+  };
+}
+
 #endif /* ADDRESS_HH */
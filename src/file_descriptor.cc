@@ -1,24 +1,47 @@
 #include "file_descriptor.hh"
 #include "util.hh"
 
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 using namespace std;
 
+/* is this fd already non-blocking (e.g. from accept4 or eventfd flags)? */
+static bool is_blocking( const int fd )
+{
+  const int flags = fcntl( fd, F_GETFL );
+  return flags < 0 or not ( flags & O_NONBLOCK );
+}
+
 /* construct from fd number */
 FileDescriptor::FileDescriptor( const int fd )
   : fd_( fd ),
     eof_( false ),
+    blocking_( is_blocking( fd ) ),
+    suppress_sigpipe_( false ),
     read_count_( 0 ),
-    write_count_( 0 )
+    write_count_( 0 ),
+    outbound_(),
+    outbound_offset_( 0 ),
+    queued_bytes_( 0 ),
+    peak_queued_bytes_( 0 )
 {}
 
 /* move constructor */
 FileDescriptor::FileDescriptor( FileDescriptor && other )
   : fd_( other.fd_ ),
     eof_( other.eof_ ),
+    blocking_( other.blocking_ ),
+    suppress_sigpipe_( other.suppress_sigpipe_ ),
     read_count_( other.read_count_ ),
-    write_count_( other.write_count_ )
+    write_count_( other.write_count_ ),
+    outbound_( move( other.outbound_ ) ),
+    outbound_offset_( other.outbound_offset_ ),
+    queued_bytes_( other.queued_bytes_ ),
+    peak_queued_bytes_( other.peak_queued_bytes_ )
 {
   /* mark other file descriptor as inactive */
   other.fd_ = -1;
@@ -46,40 +69,143 @@ string::const_iterator FileDescriptor::write( const string::const_iterator & beg
     throw runtime_error( "nothing to write" );
   }
 
-  ssize_t bytes_written = SystemCall( "write", ::write( fd_, &*begin, end - begin ) );
-  if ( bytes_written == 0 ) {
-    throw runtime_error( "write returned 0" );
-  }
+  const ssize_t bytes_written = suppress_sigpipe_
+    ? ::send( fd_, &*begin, end - begin, MSG_NOSIGNAL )
+    : ::write( fd_, &*begin, end - begin );
 
+  /* (as with reads, finding the fd full still counts as servicing it) */
   register_write();
 
+  if ( bytes_written < 0 ) {
+    if ( not blocking_ and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) {
+      return begin;
+    }
+    throw unix_error( "write" );
+  } else if ( bytes_written == 0 ) {
+    throw runtime_error( "write returned 0" );
+  }
+
   return begin + bytes_written;
 }
 
+size_t FileDescriptor::finish_read( const ssize_t result, const char * const call )
+{
+  register_read();
+
+  if ( result < 0 ) {
+    if ( not blocking_ and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) {
+      return 0; /* (nothing yet, but not EOF) */
+    }
+    throw unix_error( call );
+  } else if ( result == 0 ) {
+    set_eof();
+  }
+
+  return result;
+}
+
+size_t FileDescriptor::read( char * const buffer, const size_t capacity )
+{
+  return finish_read( ::read( fd_, buffer, capacity ), "read" );
+}
+
+size_t FileDescriptor::read( const iovec * const spans, const int span_count )
+{
+  return finish_read( ::readv( fd_, spans, span_count ), "readv" );
+}
+
 /* read method */
 string FileDescriptor::read( const size_t limit )
 {
   constexpr size_t BUFFER_SIZE = 1024 * 1024;   /* maximum size of a read */
-  char buffer[ BUFFER_SIZE ];
 
-  ssize_t bytes_read = SystemCall( "read", ::read( fd_, buffer, min( BUFFER_SIZE, limit ) ) );
-  if ( bytes_read == 0 ) {
-    set_eof();
+  /* (one per thread, allocated on its first read, instead of 1 MiB of stack per call) */
+  static thread_local vector<char> buffer;
+  if ( buffer.empty() ) {
+    buffer.resize( BUFFER_SIZE );
   }
 
-  register_read();
-
-  return string( buffer, bytes_read );
+  return string( buffer.data(), read( buffer.data(), min( BUFFER_SIZE, limit ) ) );
 }
 
 /* write method */
 string::const_iterator FileDescriptor::write( const std::string & buffer, const bool write_all )
 {
+  /* keep the order: nothing goes out directly while older bytes are queued */
+  if ( queued_bytes_ ) {
+    if ( not write_all ) {
+      return buffer.begin();
+    }
+    enqueue( buffer.begin(), buffer.end() );
+    flush();
+    return buffer.end();
+  }
+
   auto it = buffer.begin();
 
   do {
-    it = write( it, buffer.end() );
+    const auto next = write( it, buffer.end() );
+    if ( next == it ) {
+      /* non-blocking and full */
+      if ( write_all ) {
+	enqueue( it, buffer.end() );
+	return buffer.end();
+      }
+      return it;
+    }
+    it = next;
   } while ( write_all and (it != buffer.end()) );
 
   return it;
 }
+
+void FileDescriptor::enqueue( const string::const_iterator & begin, const string::const_iterator & end )
+{
+  outbound_.emplace_back( begin, end );
+  queued_bytes_ += end - begin;
+  peak_queued_bytes_ = max( peak_queued_bytes_, queued_bytes_ );
+}
+
+void FileDescriptor::flush()
+{
+  /* (nothing to write is nothing left undone, not a busy wait) */
+  if ( outbound_.empty() ) {
+    register_write();
+    return;
+  }
+
+  while ( not outbound_.empty() ) {
+    const string & front = outbound_.front();
+    const auto begin = front.begin() + outbound_offset_;
+    const auto next = write( begin, front.end() );
+    if ( next == begin ) {
+      return; /* full again */
+    }
+
+    queued_bytes_ -= next - begin;
+    if ( next == front.end() ) {
+      outbound_.pop_front();
+      outbound_offset_ = 0;
+    } else {
+      outbound_offset_ = next - front.begin();
+    }
+  }
+}
+
+void FileDescriptor::set_blocking( const bool blocking )
+{
+  int flags = SystemCall( "fcntl", fcntl( fd_, F_GETFL ) );
+  if ( blocking ) {
+    flags &= ~O_NONBLOCK;
+  } else {
+    flags |= O_NONBLOCK;
+  }
+  SystemCall( "fcntl", fcntl( fd_, F_SETFL, flags ) );
+
+  blocking_ = blocking;
+
+  /* (a blocking write can't overtake the queue, so send it now) */
+  if ( blocking_ ) {
+    flush();
+  }
+}
@@ -1,19 +1,39 @@
 #ifndef FILE_DESCRIPTOR_HH
 #define FILE_DESCRIPTOR_HH
 
+#include <deque>
 #include <limits>
 #include <string>
 
+#include <sys/uio.h>
+
 /* Unix file descriptors (sockets, files, etc.) */
 class FileDescriptor
 {
 private:
   int fd_;
   bool eof_;
+  bool blocking_;
+  bool suppress_sigpipe_;
 
   unsigned int read_count_, write_count_;
 
-  /* attempt to write a portion of a string */
+  /* non-blocking mode: bytes accepted by write() that the fd wouldn't
+     take yet, oldest first (the first `outbound_offset_` bytes of the
+     front string have already gone) */
+  std::deque<std::string> outbound_;
+  size_t outbound_offset_;
+  size_t queued_bytes_, peak_queued_bytes_;
+
+  /* queue [begin, end) to go out after everything already queued */
+  void enqueue( const std::string::const_iterator & begin,
+		const std::string::const_iterator & end );
+
+  /* count a read() or readv() that returned `result` */
+  size_t finish_read( const ssize_t result, const char * const call );
+
+  /* attempt to write a portion of a string
+     (returns begin if the fd is non-blocking and can't take any now) */
   std::string::const_iterator write( const std::string::const_iterator & begin,
 				     const std::string::const_iterator & end );
 
@@ -22,6 +42,11 @@ protected:
   void register_write() { write_count_++; }
   void set_eof() { eof_ = true; }
 
+  /* write with send( MSG_NOSIGNAL ) instead of write() (sockets only), so
+     writing to a peer that has gone away fails with EPIPE instead of
+     raising SIGPIPE */
+  void suppress_sigpipe() { suppress_sigpipe_ = true; }
+
 public:
   /* construct from fd number */
   FileDescriptor( const int fd );
@@ -38,10 +63,33 @@ public:
   unsigned int read_count() const { return read_count_; }
   unsigned int write_count() const { return write_count_; }
 
-  /* read and write methods */
+  /* read and write methods
+     (non-blocking: read() returns "" if nothing is ready, and write()
+     with write_all queues whatever the fd won't take right now) */
   std::string read( const size_t limit = std::numeric_limits<size_t>::max() );
+
+  /* read into the caller's buffer, without allocating, and return the length
+     (0 means EOF, or if non-blocking perhaps just nothing yet: see eof()) */
+  size_t read( char * const buffer, const size_t capacity );
+
+  /* same, filling the spans in order (see RingBuffer) */
+  size_t read( const iovec * const spans, const int span_count );
+
   std::string::const_iterator write( const std::string & buffer, const bool write_all = true );
 
+  /* make reads and writes return right away instead of waiting */
+  void set_blocking( const bool blocking );
+  bool blocking() const { return blocking_; }
+
+  /* write as much of the outbound queue as the fd will take now
+     (call when it is writable; see Poller::add_flush_action) */
+  void flush();
+
+  /* the outbound queue, for backpressure: how many bytes are waiting
+     now, and the most there have ever been */
+  size_t queued_bytes() const { return queued_bytes_; }
+  size_t peak_queued_bytes() const { return peak_queued_bytes_; }
+
   /* forbid copying FileDescriptor objects or assigning them */
   FileDescriptor( const FileDescriptor & other ) = delete;
   const FileDescriptor & operator=( const FileDescriptor & other ) = delete;
@@ -0,0 +1,465 @@
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "io_uring.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* glibc has no wrappers for the io_uring system calls */
+static int io_uring_setup( const unsigned int entries, io_uring_params & params )
+{
+  return syscall( __NR_io_uring_setup, entries, &params );
+}
+
+static int io_uring_enter( const int fd, const unsigned int to_submit,
+			   const unsigned int min_complete, const unsigned int flags,
+			   const void * arg, const size_t arg_size )
+{
+  return syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size );
+}
+
+static int io_uring_register( const int fd, const unsigned int opcode,
+			      const void * arg, const unsigned int nr_args )
+{
+  return syscall( __NR_io_uring_register, fd, opcode, arg, nr_args );
+}
+
+/* map part of the ring's shared memory */
+static char * map_ring( const int fd, const size_t size, const off_t offset )
+{
+  void * const ret = mmap( nullptr, size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, fd, offset );
+  if ( ret == MAP_FAILED ) {
+    throw unix_error( "mmap" );
+  }
+  return static_cast<char *>( ret );
+}
+
+static io_uring_params make_params( const unsigned int entries )
+{
+  /* leave room in the completion queue for multishot receives */
+  io_uring_params params;
+  zero( params );
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = 4 * entries;
+  return params;
+}
+
+IOUring::IOUring( const unsigned int entries )
+  : params_( make_params( entries ) ),
+    ring_fd_( SystemCall( "io_uring_setup", io_uring_setup( entries, params_ ) ) ),
+    sq_ring_size_(),
+    cq_ring_size_(),
+    sqes_size_(),
+    sq_ring_( nullptr ),
+    cq_ring_( nullptr ),
+    sqes_( nullptr ),
+    to_submit_( 0 ),
+    operations_(),
+    free_operations_(),
+    outstanding_( 0 )
+{
+  if ( not ( params_.features & IORING_FEAT_EXT_ARG ) ) {
+    throw runtime_error( "io_uring: kernel too old (no IORING_FEAT_EXT_ARG)" );
+  }
+
+  sq_ring_size_ = params_.sq_off.array + params_.sq_entries * sizeof( unsigned int );
+  cq_ring_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof( io_uring_cqe );
+  sqes_size_ = params_.sq_entries * sizeof( io_uring_sqe );
+
+  /* newer kernels share one mapping between the two rings */
+  if ( params_.features & IORING_FEAT_SINGLE_MMAP ) {
+    sq_ring_size_ = cq_ring_size_ = max( sq_ring_size_, cq_ring_size_ );
+  }
+
+  sq_ring_ = map_ring( ring_fd_.fd_num(), sq_ring_size_, IORING_OFF_SQ_RING );
+  cq_ring_ = ( params_.features & IORING_FEAT_SINGLE_MMAP )
+    ? sq_ring_
+    : map_ring( ring_fd_.fd_num(), cq_ring_size_, IORING_OFF_CQ_RING );
+  sqes_ = reinterpret_cast<io_uring_sqe *>( map_ring( ring_fd_.fd_num(), sqes_size_, IORING_OFF_SQES ) );
+}
+
+IOUring::~IOUring()
+{
+  munmap( sqes_, sqes_size_ );
+  if ( cq_ring_ != sq_ring_ ) {
+    munmap( cq_ring_, cq_ring_size_ );
+  }
+  munmap( sq_ring_, sq_ring_size_ );
+}
+
+/* set aside storage for the next operation, to be freed when it completes */
+IOUring::Operation & IOUring::new_operation( const CallbackType & callback )
+{
+  if ( free_operations_.empty() ) {
+    free_operations_.push_back( operations_.size() );
+    operations_.emplace_back( new Operation );
+  }
+
+  Operation & operation = *operations_.at( free_operations_.back() );
+  operation.callback = callback;
+  return operation;
+}
+
+/* get a submission entry for the operation from new_operation()
+   (submitting first if the queue is full) */
+io_uring_sqe & IOUring::next_sqe( const uint8_t opcode, const int fd )
+{
+  const unsigned int head = __atomic_load_n( sq_field( params_.sq_off.head ), __ATOMIC_ACQUIRE );
+  unsigned int * const tail = sq_field( params_.sq_off.tail );
+
+  if ( *tail - head == params_.sq_entries ) {
+    SystemCall( "io_uring_enter", enter( 0, -1 ) );
+  }
+
+  const unsigned int index = *tail & *sq_field( params_.sq_off.ring_mask );
+  io_uring_sqe & sqe = sqes_[ index ];
+  zero( sqe );
+  sqe.opcode = opcode;
+  sqe.fd = fd;
+
+  /* the operation is identified by its slot */
+  sqe.user_data = free_operations_.back();
+  free_operations_.pop_back();
+  outstanding_++;
+
+  sq_field( params_.sq_off.array )[ index ] = index;
+  __atomic_store_n( tail, *tail + 1, __ATOMIC_RELEASE );
+  to_submit_++;
+
+  return sqe;
+}
+
+/* tell the kernel about queued entries, and optionally wait for completions */
+int IOUring::enter( const unsigned int min_complete, const int timeout_ms )
+{
+  __kernel_timespec timeout;
+  zero( timeout );
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = ( timeout_ms % 1000 ) * 1000000LL;
+
+  io_uring_getevents_arg arg;
+  zero( arg );
+  arg.ts = timeout_ms >= 0 ? reinterpret_cast<uint64_t>( &timeout ) : 0;
+
+  unsigned int flags = IORING_ENTER_EXT_ARG;
+  if ( min_complete ) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  const int ret = io_uring_enter( ring_fd_.fd_num(), to_submit_, min_complete, flags,
+				  &arg, sizeof( arg ) );
+  if ( ret >= 0 ) {
+    to_submit_ -= min( to_submit_, static_cast<unsigned int>( ret ) );
+  }
+  return ret;
+}
+
+/* call back for every completion in the queue; returns how many there were */
+unsigned int IOUring::dispatch_completions()
+{
+  unsigned int * const head = cq_field( params_.cq_off.head );
+  const unsigned int mask = *cq_field( params_.cq_off.ring_mask );
+  io_uring_cqe * const cqes = reinterpret_cast<io_uring_cqe *>( cq_ring_ + params_.cq_off.cqes );
+
+  unsigned int count = 0;
+  while ( *head != __atomic_load_n( cq_field( params_.cq_off.tail ), __ATOMIC_ACQUIRE ) ) {
+    const io_uring_cqe cqe = cqes[ *head & mask ];
+    __atomic_store_n( head, *head + 1, __ATOMIC_RELEASE );
+    count++;
+
+    const Completion completion = { cqe.res, cqe.flags };
+    Operation & operation = *operations_.at( cqe.user_data );
+
+    if ( operation.callback ) {
+      operation.callback( completion );
+    } else if ( completion.result < 0 ) {
+      throw unix_error( "io_uring operation", -completion.result );
+    }
+
+    /* multishot operations keep their slot until the last completion */
+    if ( not completion.more() ) {
+      operation.callback = CallbackType();
+      operation.payload.clear();
+      free_operations_.push_back( cqe.user_data );
+      outstanding_--;
+    }
+  }
+
+  return count;
+}
+
+/* submit everything queued, wait for at least one completion
+   (or the timeout), and call back for each completion */
+IOUring::Result IOUring::run( const int timeout_ms )
+{
+  /* completions may already be waiting */
+  if ( dispatch_completions() ) {
+    if ( to_submit_ ) {
+      SystemCall( "io_uring_enter", enter( 0, -1 ) );
+    }
+    return Result::Type::Success;
+  }
+
+  /* Quit if there is nothing to wait for */
+  if ( outstanding_ == 0 ) {
+    return Result::Type::Exit;
+  }
+
+  const int ret = enter( 1, timeout_ms );
+  if ( ret < 0 ) {
+    if ( errno == ETIME ) {
+      return dispatch_completions() ? Result::Type::Success : Result::Type::Timeout;
+    } else if ( errno == EINTR ) {
+      return Result::Type::Exit;
+    }
+    throw unix_error( "io_uring_enter" );
+  }
+
+  /* (the return value counts submissions, so a timeout can look like success) */
+  return dispatch_completions() ? Result::Type::Success : Result::Type::Timeout;
+}
+
+void IOUring::read( FileDescriptor & fd, char * buffer, const size_t length,
+		    const CallbackType & callback )
+{
+  new_operation( callback );
+  io_uring_sqe & sqe = next_sqe( IORING_OP_READ, fd.fd_num() );
+  sqe.addr = reinterpret_cast<uint64_t>( buffer );
+  sqe.len = length;
+  sqe.off = -1; /* use (and advance) the file position, like read(2) */
+}
+
+void IOUring::recvmsg( FileDescriptor & fd, msghdr & header, const CallbackType & callback )
+{
+  new_operation( callback );
+  io_uring_sqe & sqe = next_sqe( IORING_OP_RECVMSG, fd.fd_num() );
+  sqe.addr = reinterpret_cast<uint64_t>( &header );
+  sqe.len = 1;
+}
+
+void IOUring::sendmsg( FileDescriptor & fd, const msghdr & header, const CallbackType & callback )
+{
+  new_operation( callback );
+  io_uring_sqe & sqe = next_sqe( IORING_OP_SENDMSG, fd.fd_num() );
+  sqe.addr = reinterpret_cast<uint64_t>( &header );
+  sqe.len = 1;
+}
+
+/* queue a write of the operation's own payload */
+void IOUring::queue_write( FileDescriptor & fd, Operation & operation )
+{
+  io_uring_sqe & sqe = next_sqe( IORING_OP_WRITE, fd.fd_num() );
+  sqe.addr = reinterpret_cast<uint64_t>( operation.payload.data() );
+  sqe.len = operation.payload.size();
+  sqe.off = -1;
+}
+
+/* queue a sendmsg of the operation's own payload */
+void IOUring::queue_sendto( UDPSocket & socket, const Address & destination, Operation & operation )
+{
+  operation.destination = destination;
+
+  operation.payload_iovec.iov_base = const_cast<char *>( operation.payload.data() );
+  operation.payload_iovec.iov_len = operation.payload.size();
+
+  zero( operation.header );
+  operation.header.msg_name = const_cast<sockaddr *>( &operation.destination.to_sockaddr() );
+  operation.header.msg_namelen = operation.destination.size();
+  operation.header.msg_iov = &operation.payload_iovec;
+  operation.header.msg_iovlen = 1;
+
+  io_uring_sqe & sqe = next_sqe( IORING_OP_SENDMSG, socket.fd_num() );
+  sqe.addr = reinterpret_cast<uint64_t>( &operation.header );
+  sqe.len = 1;
+}
+
+void IOUring::write( FileDescriptor & fd, string && payload, const CallbackType & callback )
+{
+  Operation & operation = new_operation( callback );
+  operation.payload = move( payload );
+  queue_write( fd, operation );
+}
+
+void IOUring::write( FileDescriptor & fd, const char * payload, const size_t length,
+		     const CallbackType & callback )
+{
+  Operation & operation = new_operation( callback );
+  operation.payload.assign( payload, length ); /* (reuses the operation's storage) */
+  queue_write( fd, operation );
+}
+
+void IOUring::sendto( UDPSocket & socket, const Address & destination, string && payload,
+		      const CallbackType & callback )
+{
+  Operation & operation = new_operation( callback );
+  operation.payload = move( payload );
+  queue_sendto( socket, destination, operation );
+}
+
+void IOUring::sendto( UDPSocket & socket, const Address & destination,
+		      const char * payload, const size_t length, const CallbackType & callback )
+{
+  Operation & operation = new_operation( callback );
+  operation.payload.assign( payload, length );
+  queue_sendto( socket, destination, operation );
+}
+
+/* registered ("fixed") buffers, pinned once instead of on every operation */
+void IOUring::register_buffers( const vector<iovec> & buffers )
+{
+  SystemCall( "io_uring_register", io_uring_register( ring_fd_.fd_num(), IORING_REGISTER_BUFFERS,
+						      buffers.data(), buffers.size() ) );
+}
+
+void IOUring::read_fixed( FileDescriptor & fd, const uint16_t buffer_index, char * buffer,
+			  const size_t length, const CallbackType & callback )
+{
+  new_operation( callback );
+  io_uring_sqe & sqe = next_sqe( IORING_OP_READ_FIXED, fd.fd_num() );
+  sqe.addr = reinterpret_cast<uint64_t>( buffer );
+  sqe.len = length;
+  sqe.off = -1;
+  sqe.buf_index = buffer_index;
+}
+
+void IOUring::write_fixed( FileDescriptor & fd, const uint16_t buffer_index, const char * buffer,
+			   const size_t length, const CallbackType & callback )
+{
+  new_operation( callback );
+  io_uring_sqe & sqe = next_sqe( IORING_OP_WRITE_FIXED, fd.fd_num() );
+  sqe.addr = reinterpret_cast<uint64_t>( buffer );
+  sqe.len = length;
+  sqe.off = -1;
+  sqe.buf_index = buffer_index;
+}
+
+/* receive datagrams until cancelled, each into a buffer from the group */
+void IOUring::recv_multishot( UDPSocket & socket, BufferGroup & buffers,
+			      const function<void(const UDPSocket::batched_datagram &)> & callback )
+{
+  static const size_t CONTROL_SIZE = 64; /* room for the timestamp */
+
+  Operation & operation = new_operation( CallbackType() );
+
+  /* the kernel only uses the lengths of this template to lay out each buffer */
+  zero( operation.header );
+  operation.header.msg_namelen = sizeof( Address::raw );
+  operation.header.msg_controllen = CONTROL_SIZE;
+
+  const msghdr & layout = operation.header;
+
+  operation.callback = [this, &socket, &buffers, callback, &layout] ( const Completion & completion ) {
+    if ( completion.result == -ENOBUFS ) {
+      /* ran out of buffers; the multishot receive has stopped */
+    } else if ( completion.result < 0 ) {
+      throw unix_error( "io_uring recvmsg", -completion.result );
+    } else {
+      if ( not ( completion.flags & IORING_CQE_F_BUFFER ) ) {
+	throw runtime_error( "io_uring recvmsg: completion without a buffer" );
+      }
+
+      const uint16_t buffer_id = completion.flags >> IORING_CQE_BUFFER_SHIFT;
+      char * const buffer = buffers.buffer( buffer_id );
+      const io_uring_recvmsg_out & out = *reinterpret_cast<io_uring_recvmsg_out *>( buffer );
+
+      /* the buffer holds the header, then the name, control data and payload */
+      msghdr header;
+      zero( header );
+      header.msg_name = buffer + sizeof( out );
+      header.msg_namelen = out.namelen;
+      header.msg_control = buffer + sizeof( out ) + layout.msg_namelen;
+      header.msg_controllen = out.controllen;
+      header.msg_flags = out.flags;
+
+      const char * const payload = buffer + sizeof( out ) + layout.msg_namelen + layout.msg_controllen;
+      const UDPSocket::batched_datagram datagram = UDPSocket::parse_datagram( header, payload,
+									       out.payloadlen );
+
+      callback( datagram );
+      buffers.recycle( buffer_id );
+    }
+
+    /* keep receiving */
+    if ( not completion.more() ) {
+      recv_multishot( socket, buffers, callback );
+    }
+  };
+
+  io_uring_sqe & sqe = next_sqe( IORING_OP_RECVMSG, socket.fd_num() );
+  sqe.addr = reinterpret_cast<uint64_t>( &operation.header );
+  sqe.len = 0;
+  sqe.ioprio = IORING_RECV_MULTISHOT;
+  sqe.flags = IOSQE_BUFFER_SELECT;
+  sqe.buf_group = buffers.group_id();
+}
+
+IOUring::BufferGroup::BufferGroup( IOUring & ring, const uint16_t group_id,
+				   const unsigned int count, const size_t buffer_size )
+  : ring_( ring ),
+    group_id_( group_id ),
+    count_( count ),
+    buffer_size_( buffer_size ),
+    storage_( new char[ count * buffer_size ] ),
+    buf_ring_( nullptr )
+{
+  if ( count == 0 or ( count & ( count - 1 ) ) or count > 32768 ) {
+    throw runtime_error( "io_uring buffer group size must be a power of two" );
+  }
+
+  /* the ring of buffer descriptors must be page-aligned */
+  void * const ring_memory = mmap( nullptr, count * sizeof( io_uring_buf ), PROT_READ | PROT_WRITE,
+				   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0 );
+  if ( ring_memory == MAP_FAILED ) {
+    throw unix_error( "mmap" );
+  }
+  buf_ring_ = static_cast<io_uring_buf_ring *>( ring_memory );
+
+  io_uring_buf_reg registration;
+  zero( registration );
+  registration.ring_addr = reinterpret_cast<uint64_t>( ring_memory );
+  registration.ring_entries = count;
+  registration.bgid = group_id;
+
+  try {
+    SystemCall( "io_uring_register", io_uring_register( ring_.ring_fd_.fd_num(),
+							IORING_REGISTER_PBUF_RING,
+							&registration, 1 ) );
+  } catch ( ... ) {
+    munmap( ring_memory, count * sizeof( io_uring_buf ) );
+    throw;
+  }
+
+  for ( unsigned int i = 0; i < count; i++ ) {
+    recycle( i );
+  }
+}
+
+IOUring::BufferGroup::~BufferGroup()
+{
+  io_uring_buf_reg registration;
+  zero( registration );
+  registration.bgid = group_id_;
+  io_uring_register( ring_.ring_fd_.fd_num(), IORING_UNREGISTER_PBUF_RING, &registration, 1 );
+
+  munmap( buf_ring_, count_ * sizeof( io_uring_buf ) );
+}
+
+/* give a buffer back to the kernel once its contents have been consumed */
+void IOUring::BufferGroup::recycle( const uint16_t buffer_id )
+{
+  /* (not buf_ring_->bufs, which C++ compilers place after an empty struct) */
+  io_uring_buf * const entries = reinterpret_cast<io_uring_buf *>( buf_ring_ );
+
+  const uint16_t tail = buf_ring_->tail;
+  io_uring_buf & entry = entries[ tail & ( count_ - 1 ) ];
+  entry.addr = reinterpret_cast<uint64_t>( buffer( buffer_id ) );
+  entry.len = buffer_size_;
+  entry.bid = buffer_id;
+
+  __atomic_store_n( &buf_ring_->tail, tail + 1, __ATOMIC_RELEASE );
+}
@@ -0,0 +1,163 @@
+#ifndef IO_URING_HH
+#define IO_URING_HH
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <linux/io_uring.h>
+
+#include "file_descriptor.hh"
+#include "socket.hh"
+
+/* completion-based I/O with io_uring: queue reads, writes, recvmsg and
+   sendmsg, then run() submits them all with one system call and calls
+   back as each one completes (an alternative to the readiness-based Poller) */
+class IOUring
+{
+public:
+  struct Completion
+  {
+    int result; /* bytes transferred, or -errno */
+    uint32_t flags;
+
+    /* will a multishot operation produce more completions? */
+    bool more() const { return flags & IORING_CQE_F_MORE; }
+  };
+
+  typedef std::function<void(const Completion &)> CallbackType;
+
+  struct Result
+  {
+    enum class Type { Success, Timeout, Exit } result;
+    Result( const Type & s_result ) : result( s_result ) {}
+  };
+
+  /* kernel-provided buffers for multishot receives (a registered buffer ring) */
+  class BufferGroup
+  {
+  private:
+    IOUring & ring_;
+    uint16_t group_id_;
+    unsigned int count_;
+    size_t buffer_size_;
+    std::unique_ptr<char[]> storage_;
+    io_uring_buf_ring * buf_ring_;
+
+  public:
+    /* count must be a power of two */
+    BufferGroup( IOUring & ring, const uint16_t group_id,
+		 const unsigned int count, const size_t buffer_size );
+    ~BufferGroup();
+
+    uint16_t group_id() const { return group_id_; }
+    size_t buffer_size() const { return buffer_size_; }
+    char * buffer( const uint16_t buffer_id ) { return storage_.get() + buffer_id * buffer_size_; }
+
+    /* give a buffer back to the kernel once its contents have been consumed */
+    void recycle( const uint16_t buffer_id );
+
+    /* forbid copying BufferGroup objects or assigning them */
+    BufferGroup( const BufferGroup & other ) = delete;
+    const BufferGroup & operator=( const BufferGroup & other ) = delete;
+  };
+
+private:
+  /* an operation the kernel hasn't finished with yet (and what it uses) */
+  struct Operation
+  {
+    CallbackType callback;
+    std::string payload;
+    Address destination;
+    msghdr header;
+    iovec payload_iovec;
+
+    Operation() : callback(), payload(), destination(), header(), payload_iovec() {}
+  };
+
+  io_uring_params params_;
+  FileDescriptor ring_fd_;
+
+  /* shared memory with the kernel */
+  size_t sq_ring_size_, cq_ring_size_, sqes_size_;
+  char * sq_ring_;
+  char * cq_ring_;
+  io_uring_sqe * sqes_;
+
+  unsigned int to_submit_;
+
+  std::vector<std::unique_ptr<Operation>> operations_;
+  std::vector<size_t> free_operations_;
+  size_t outstanding_;
+
+  /* pointer to a field of the submission or completion ring */
+  unsigned int * sq_field( const uint32_t offset ) { return reinterpret_cast<unsigned int *>( sq_ring_ + offset ); }
+  unsigned int * cq_field( const uint32_t offset ) { return reinterpret_cast<unsigned int *>( cq_ring_ + offset ); }
+
+  /* set aside storage for the next operation, to be freed when it completes */
+  Operation & new_operation( const CallbackType & callback );
+
+  /* get a submission entry for the operation from new_operation()
+     (submitting first if the queue is full) */
+  io_uring_sqe & next_sqe( const uint8_t opcode, const int fd );
+
+  /* queue an operation that sends the operation's own payload */
+  void queue_write( FileDescriptor & fd, Operation & operation );
+  void queue_sendto( UDPSocket & socket, const Address & destination, Operation & operation );
+
+  /* tell the kernel about queued entries, and optionally wait for completions */
+  int enter( const unsigned int min_complete, const int timeout_ms );
+
+  /* call back for every completion in the queue; returns how many there were */
+  unsigned int dispatch_completions();
+
+public:
+  IOUring( const unsigned int entries = 256 );
+  ~IOUring();
+
+  /* queue operations (the buffers must stay valid until completion) */
+  void read( FileDescriptor & fd, char * buffer, const size_t length,
+	     const CallbackType & callback );
+  void recvmsg( FileDescriptor & fd, msghdr & header, const CallbackType & callback );
+  void sendmsg( FileDescriptor & fd, const msghdr & header, const CallbackType & callback );
+
+  /* queue operations that keep their own copy of the payload */
+  void write( FileDescriptor & fd, std::string && payload,
+	      const CallbackType & callback = CallbackType() );
+  void sendto( UDPSocket & socket, const Address & destination, std::string && payload,
+	       const CallbackType & callback = CallbackType() );
+
+  /* ... or copy it into storage that is recycled along with the operation
+     (so a steady stream of writes doesn't allocate) */
+  void write( FileDescriptor & fd, const char * payload, const size_t length,
+	      const CallbackType & callback = CallbackType() );
+  void sendto( UDPSocket & socket, const Address & destination,
+	       const char * payload, const size_t length,
+	       const CallbackType & callback = CallbackType() );
+
+  /* registered ("fixed") buffers, pinned once instead of on every operation */
+  void register_buffers( const std::vector<iovec> & buffers );
+  void read_fixed( FileDescriptor & fd, const uint16_t buffer_index, char * buffer,
+		   const size_t length, const CallbackType & callback );
+  void write_fixed( FileDescriptor & fd, const uint16_t buffer_index, const char * buffer,
+		    const size_t length, const CallbackType & callback );
+
+  /* receive datagrams until cancelled, each into a buffer from the group
+     (rearmed automatically if the kernel runs out of buffers) */
+  void recv_multishot( UDPSocket & socket, BufferGroup & buffers,
+		       const std::function<void(const UDPSocket::batched_datagram &)> & callback );
+
+  /* submit everything queued, wait for at least one completion
+     (or the timeout), and call back for each completion */
+  Result run( const int timeout_ms );
+
+  /* accessors */
+  size_t outstanding() const { return outstanding_; }
+
+  /* forbid copying IOUring objects or assigning them */
+  IOUring( const IOUring & other ) = delete;
+  const IOUring & operator=( const IOUring & other ) = delete;
+};
+
+#endif /* IO_URING_HH */
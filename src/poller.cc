@@ -1,17 +1,284 @@
 #include <algorithm>
 #include <cassert>
+#include <limits>
 #include <numeric>
 
+#include <sys/prctl.h>
+
 #include "poller.hh"
+#include "timestamp.hh"
 #include "util.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
+Poller::Poller( const Backend backend )
+  : backend_( backend ),
+    actions_(),
+    timers_(),
+    timer_heap_(),
+    next_timer_id_( 0 ),
+    pollfds_(),
+    epoll_fd_( backend == Backend::Poll ? -1
+	       : SystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) ),
+    registrations_(),
+    registration_of_fd_(),
+    registration_of_action_(),
+    armed_(),
+    conditional_actions_(),
+    armed_count_( 0 ),
+    ready_( 1 ), /* epoll_wait needs room for at least one event */
+    removed_(),
+    removed_count_( 0 ),
+    polling_( false ),
+    pending_actions_()
+{}
+
+/* when a call to poll() should report a timeout */
+static uint64_t timeout_deadline( const int timeout_ms )
+{
+  return timeout_ms < 0 ? numeric_limits<uint64_t>::max() : timestamp_ns() + timeout_ms * uint64_t( 1000000 );
+}
+
+Poller::TimerID Poller::add_timer( const uint64_t delay_ns, const Action::CallbackType & callback,
+				   const uint64_t interval_ns )
+{
+  const TimerID id = next_timer_id_++;
+  const uint64_t deadline = timestamp_ns() + delay_ns;
+
+  timers_.emplace( id, Timer { deadline, interval_ns, callback } );
+  timer_heap_.emplace_back( deadline, id );
+  push_heap( timer_heap_.begin(), timer_heap_.end(), greater< pair< uint64_t, TimerID > >() );
+
+  return id;
+}
+
+void Poller::cancel_timer( const TimerID id )
+{
+  timers_.erase( id );
+}
+
+void Poller::set_timer_slack( const uint64_t slack_ns )
+{
+  SystemCall( "prctl", prctl( PR_SET_TIMERSLACK, static_cast<unsigned long>( slack_ns ), 0UL, 0UL, 0UL ) );
+}
+
+/* how long to wait: the caller's timeout, or less if a timer is due sooner */
+const timespec * Poller::wait_time( const int timeout_ms, timespec & storage ) const
+{
+  uint64_t wait_ns = timeout_ms < 0 ? numeric_limits<uint64_t>::max() : timeout_ms * uint64_t( 1000000 );
+
+  if ( not timer_heap_.empty() ) {
+    const uint64_t now = timestamp_ns(), deadline = timer_heap_.front().first;
+    wait_ns = min( wait_ns, deadline > now ? deadline - now : 0 );
+  }
+
+  if ( wait_ns == numeric_limits<uint64_t>::max() ) {
+    return nullptr; /* wait forever */
+  }
+
+  storage.tv_sec = wait_ns / 1000000000;
+  storage.tv_nsec = wait_ns % 1000000000;
+  return &storage;
+}
+
+/* run the callbacks of every timer whose deadline has passed */
+Poller::Result Poller::fire_timers()
+{
+  const uint64_t now = timestamp_ns();
+  const auto later = greater< pair< uint64_t, TimerID > >();
+
+  while ( not timer_heap_.empty() and timer_heap_.front().first <= now ) {
+    pop_heap( timer_heap_.begin(), timer_heap_.end(), later );
+    const uint64_t deadline = timer_heap_.back().first;
+    const TimerID id = timer_heap_.back().second;
+    timer_heap_.pop_back();
+
+    /* skip timers that were cancelled */
+    auto it = timers_.find( id );
+    if ( it == timers_.end() or it->second.deadline_ns != deadline ) {
+      continue;
+    }
+
+    /* the callback may add or cancel timers, so don't hold on to the entry */
+    const Action::CallbackType callback = move( it->second.callback );
+    const auto result = callback();
+
+    it = timers_.find( id );
+    if ( it == timers_.end() ) {
+      /* cancelled itself */
+    } else if ( it->second.interval_ns == 0 or result.result != ResultType::Continue ) {
+      timers_.erase( it );
+    } else {
+      /* reschedule, skipping any ticks we were too late for */
+      const uint64_t interval = it->second.interval_ns;
+      const uint64_t next = deadline + interval * ( ( now - deadline ) / interval + 1 );
+      it->second.deadline_ns = next;
+      it->second.callback = move( callback );
+      timer_heap_.emplace_back( next, id );
+      push_heap( timer_heap_.begin(), timer_heap_.end(), later );
+    }
+
+    if ( result.result == ResultType::Exit ) {
+      return Result( Result::Type::Exit, result.exit_status );
+    }
+  }
+
+  return Result::Type::Success;
+}
+
 void Poller::add_action( Poller::Action action )
 {
+  if ( polling_ ) {
+    pending_actions_.push_back( action );
+    return;
+  }
+
   actions_.push_back( action );
-  pollfds_.push_back( { action.fd.fd_num(), 0, 0 } );
+  removed_.push_back( false );
+
+  if ( backend_ == Backend::Poll ) {
+    pollfds_.push_back( { action.fd.fd_num(), 0, 0 } );
+    return;
+  }
+
+  /* find (or make) the registration for this fd */
+  const int fd_num = action.fd.fd_num();
+  auto it = registration_of_fd_.find( fd_num );
+  if ( it == registration_of_fd_.end() ) {
+    epoll_event event;
+    zero( event );
+    event.data.u32 = registrations_.size();
+    SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_ADD, fd_num, &event ) );
+
+    it = registration_of_fd_.emplace( fd_num, registrations_.size() ).first;
+    registrations_.push_back( { fd_num, 0, {} } );
+    ready_.resize( max( ready_.size(), registrations_.size() ) );
+  }
+
+  const size_t action_index = actions_.size() - 1;
+  registrations_.at( it->second ).actions.push_back( action_index );
+  registration_of_action_.push_back( it->second );
+  armed_.push_back( false );
+  if ( action.when_interested ) {
+    conditional_actions_.push_back( action_index );
+  }
+
+  update_interest( action_index );
+}
+
+void Poller::add_flush_action( FileDescriptor & fd )
+{
+  add_action( Action( fd, Direction::Out, [&fd] () {
+	fd.flush();
+	return ResultType::Continue;
+      },
+      [&fd] () { return fd.queued_bytes() > 0; } ) );
+}
+
+void Poller::remove_actions( const FileDescriptor & fd )
+{
+  if ( not pending_actions_.empty() ) {
+    vector< Action > kept;
+    for ( const auto & action : pending_actions_ ) {
+      if ( &action.fd != &fd ) {
+	kept.push_back( action );
+      }
+    }
+    swap( kept, pending_actions_ );
+  }
+
+  for ( size_t i = 0; i < actions_.size(); i++ ) {
+    if ( removed_[ i ] or &actions_[ i ].fd != &fd ) {
+      continue;
+    }
+
+    removed_[ i ] = true;
+    removed_count_++;
+    actions_[ i ].active = false;
+
+    if ( backend_ == Backend::Poll ) {
+      pollfds_.at( i ).fd = -1; /* (ignored by poll) */
+      pollfds_.at( i ).events = 0; /* (and not counted as something to wait for) */
+    } else if ( armed_.at( i ) ) {
+      armed_.at( i ) = false;
+      armed_count_--;
+    }
+  }
+
+  if ( backend_ == Backend::Poll ) {
+    return;
+  }
+
+  /* the registration stays (so stale events can find it) but is never re-armed */
+  const auto it = registration_of_fd_.find( fd.fd_num() );
+  if ( it != registration_of_fd_.end() ) {
+    SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_DEL, fd.fd_num(), nullptr ) );
+    registrations_.at( it->second ).fd = -1;
+    registrations_.at( it->second ).events = 0;
+    registration_of_fd_.erase( it );
+  }
+}
+
+/* rebuild without the removed actions, once they are the majority */
+void Poller::compact()
+{
+  if ( removed_count_ < 64 or removed_count_ * 2 < actions_.size() ) {
+    return;
+  }
+
+  vector< Action > live;
+  for ( size_t i = 0; i < actions_.size(); i++ ) {
+    if ( not removed_[ i ] ) {
+      live.push_back( actions_[ i ] );
+    }
+  }
+
+  for ( const auto & registration : registrations_ ) {
+    if ( registration.fd >= 0 ) {
+      SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_DEL, registration.fd, nullptr ) );
+    }
+  }
+
+  actions_.clear();
+  pollfds_.clear();
+  registrations_.clear();
+  registration_of_fd_.clear();
+  registration_of_action_.clear();
+  armed_.clear();
+  conditional_actions_.clear();
+  armed_count_ = 0;
+  removed_.clear();
+  removed_count_ = 0;
+
+  for ( const auto & action : live ) {
+    add_action( action );
+  }
+}
+
+/* after a callback: apply its result and re-check interest
+   (unless the callback removed the action); returns true if poll() should end */
+bool Poller::finish_callback( const size_t action_index, const Action::Result & result )
+{
+  if ( removed_.at( action_index ) ) {
+    return result.result == ResultType::Exit;
+  }
+
+  switch ( result.result ) {
+  case ResultType::Exit:
+    return true;
+  case ResultType::Cancel:
+    actions_.at( action_index ).active = false;
+  case ResultType::Continue:
+    break;
+  }
+
+  /* the callback may have cancelled the action or hit EOF */
+  if ( backend_ != Backend::Poll ) {
+    update_interest( action_index );
+  }
+
+  return false;
 }
 
 unsigned int Poller::Action::service_count() const
@@ -19,32 +286,121 @@ unsigned int Poller::Action::service_count() const
   return direction == Direction::In ? fd.read_count() : fd.write_count();
 }
 
+bool Poller::Action::interested() const
+{
+  if ( not active ) {
+    return false;
+  }
+
+  /* don't poll in on fds that have had EOF */
+  if ( direction == Direction::In and fd.eof() ) {
+    return false;
+  }
+
+  return not when_interested or when_interested();
+}
+
+/* re-check whether an action wants events, telling the kernel if that changed */
+void Poller::update_interest( const size_t action_index )
+{
+  const bool interested = actions_.at( action_index ).interested();
+  if ( interested == armed_.at( action_index ) ) {
+    return;
+  }
+
+  armed_.at( action_index ) = interested;
+  if ( interested ) {
+    armed_count_++;
+  } else {
+    armed_count_--;
+  }
+
+  /* recompute the union of the directions wanted on this fd */
+  Registration & registration = registrations_.at( registration_of_action_.at( action_index ) );
+  uint32_t events = 0;
+  for ( const auto & i : registration.actions ) {
+    if ( armed_.at( i ) ) {
+      events |= actions_.at( i ).direction;
+    }
+  }
+
+  if ( events == registration.events ) {
+    return;
+  }
+
+  registration.events = events;
+
+  epoll_event event;
+  zero( event );
+  event.events = events;
+  if ( events and backend_ == Backend::EpollEdgeTriggered ) {
+    event.events |= EPOLLET;
+  }
+  event.data.u32 = registration_of_action_.at( action_index );
+  SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_MOD, registration.fd, &event ) );
+}
+
 Poller::Result Poller::poll( const int & timeout_ms )
+{
+  compact();
+
+  polling_ = true;
+  Result result( Result::Type::Exit );
+  try {
+    result = backend_ == Backend::Poll ? poll_with_poll( timeout_ms ) : poll_with_epoll( timeout_ms );
+  } catch ( ... ) {
+    /* (keep what the callbacks that did run asked for, so the caller can poll again) */
+    add_pending_actions();
+    throw;
+  }
+  add_pending_actions();
+
+  return result;
+}
+
+/* add what the callbacks asked for */
+void Poller::add_pending_actions()
+{
+  polling_ = false;
+
+  vector< Action > pending;
+  swap( pending, pending_actions_ );
+  for ( const auto & action : pending ) {
+    add_action( action );
+  }
+}
+
+Poller::Result Poller::poll_with_poll( const int & timeout_ms )
 {
   assert( pollfds_.size() == actions_.size() );
 
+  const uint64_t deadline = timeout_deadline( timeout_ms );
+
   /* tell poll whether we care about each fd */
   for ( unsigned int i = 0; i < actions_.size(); i++ ) {
-    assert( pollfds_.at( i ).fd == actions_.at( i ).fd.fd_num() );
-    pollfds_.at( i ).events = (actions_.at( i ).active and actions_.at( i ).when_interested())
-      ? actions_.at( i ).direction : 0;
-
-    /* don't poll in on fds that have had EOF */
-    if ( actions_.at( i ).direction == Direction::In
-	 and actions_.at( i ).fd.eof() ) {
-      pollfds_.at( i ).events = 0;
+    if ( removed_[ i ] ) {
+      continue;
     }
+    assert( pollfds_.at( i ).fd == actions_.at( i ).fd.fd_num() );
+    pollfds_.at( i ).events = actions_.at( i ).interested() ? actions_.at( i ).direction : 0;
   }
 
-  /* Quit if no member in pollfds_ has a non-zero direction */
-  if ( not accumulate( pollfds_.begin(), pollfds_.end(), false,
-		       [] ( bool acc, pollfd x ) { return acc or x.events; } ) ) {
+  /* Quit if no member in pollfds_ has a non-zero direction (and no timer is pending) */
+  if ( timers_.empty()
+       and not accumulate( pollfds_.begin(), pollfds_.end(), false,
+			   [] ( bool acc, pollfd x ) { return acc or x.events; } ) ) {
     return Result::Type::Exit;
   }
 
   try {
-    if ( 0 == SystemCall( "poll", ::poll( &pollfds_[ 0 ], pollfds_.size(), timeout_ms ) ) ) {
-      return Result::Type::Timeout;
+    timespec wait_storage;
+    if ( 0 == SystemCall( "ppoll", ::ppoll( pollfds_.data(), pollfds_.size(),
+					    wait_time( timeout_ms, wait_storage ), nullptr ) ) ) {
+      const auto timer_result = fire_timers();
+      if ( timer_result.result == Result::Type::Exit ) {
+	return timer_result;
+      }
+      return timestamp_ns() >= deadline ? Result::Type::Timeout : Result::Type::Success;
     }
   } catch ( unix_error const& e ) {
     if ( e.code().value() == EINTR ) {
@@ -53,30 +409,140 @@ Poller::Result Poller::poll( const int & timeout_ms )
   }
 
   for ( unsigned int i = 0; i < pollfds_.size(); i++ ) {
+    /* (an earlier callback may have removed this one) */
+    if ( removed_[ i ] ) {
+      continue;
+    }
+
     if ( pollfds_[ i ].revents & (POLLERR | POLLHUP | POLLNVAL) ) {
-      return Result::Type::Exit;
+      if ( not actions_.at( i ).error_callback ) {
+	return Result::Type::Exit;
+      }
+
+      const auto result = actions_.at( i ).error_callback();
+      if ( finish_callback( i, result ) ) {
+	return Result( Result::Type::Exit, result.exit_status );
+      }
+      continue;
     }
 
     if ( pollfds_[ i ].revents & pollfds_[ i ].events ) {
       /* we only want to call callback if revents includes
-	 the event we asked for */
+	 the event we asked for, and an earlier callback in this
+	 batch (e.g. one that emptied the fd's queue) hasn't made
+	 the action lose interest */
+      if ( not actions_.at( i ).interested() ) {
+	continue;
+      }
+
       const auto count_before = actions_.at( i ).service_count();
-      auto result = actions_.at( i ).callback();
+      const auto result = actions_.at( i ).callback();
 
-      if ( count_before == actions_.at( i ).service_count() ) {
+      if ( not removed_[ i ] and count_before == actions_.at( i ).service_count() ) {
 	throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
       }
 
-      switch ( result.result ) {
-      case ResultType::Exit:
+      if ( finish_callback( i, result ) ) {
 	return Result( Result::Type::Exit, result.exit_status );
-      case ResultType::Cancel:
-	actions_.at( i ).active = false;
-      case ResultType::Continue:
-	break;
       }
     }
   }
 
-  return Result::Type::Success;
+  return fire_timers();
+}
+
+Poller::Result Poller::poll_with_epoll( const int & timeout_ms )
+{
+  /* only actions with a when_interested() condition can change
+     their minds between calls; everything else is already registered */
+  for ( const auto & i : conditional_actions_ ) {
+    update_interest( i );
+  }
+
+  /* Quit if no action is interested in anything (and no timer is pending) */
+  if ( armed_count_ == 0 and timers_.empty() ) {
+    return Result::Type::Exit;
+  }
+
+  const uint64_t deadline = timeout_deadline( timeout_ms );
+
+  int ready_count;
+  try {
+    timespec wait_storage;
+    ready_count = SystemCall( "epoll_pwait2", epoll_pwait2( epoll_fd_.fd_num(), ready_.data(), ready_.size(),
+							    wait_time( timeout_ms, wait_storage ), nullptr ) );
+  } catch ( unix_error const& e ) {
+    if ( e.code().value() == EINTR ) {
+      return Result::Type::Exit;
+    }
+    throw;
+  }
+
+  if ( ready_count == 0 ) {
+    const auto timer_result = fire_timers();
+    if ( timer_result.result == Result::Type::Exit ) {
+      return timer_result;
+    }
+    return timestamp_ns() >= deadline ? Result::Type::Timeout : Result::Type::Success;
+  }
+
+  for ( int r = 0; r < ready_count; r++ ) {
+    const uint32_t revents = ready_[ r ].events;
+    const size_t registration = ready_[ r ].data.u32;
+
+    /* (callbacks may add actions, so index afresh each time) */
+    if ( revents & (EPOLLERR | EPOLLHUP) ) {
+      size_t handler = actions_.size();
+      for ( const auto & i : registrations_.at( registration ).actions ) {
+	if ( not removed_[ i ] and actions_.at( i ).error_callback ) {
+	  handler = i;
+	  break;
+	}
+      }
+
+      if ( handler == actions_.size() ) {
+	/* (unless the fd was removed, with its actions, earlier in this batch) */
+	if ( registrations_.at( registration ).fd >= 0 ) {
+	  return Result::Type::Exit;
+	}
+	continue;
+      }
+
+      const auto result = actions_.at( handler ).error_callback();
+      if ( finish_callback( handler, result ) ) {
+	return Result( Result::Type::Exit, result.exit_status );
+      }
+      continue;
+    }
+
+    for ( size_t k = 0; k < registrations_.at( registration ).actions.size(); k++ ) {
+      const size_t i = registrations_.at( registration ).actions[ k ];
+
+      /* we only want to call callback if the action still
+	 wants the event that occurred */
+      if ( not ( armed_.at( i ) and (revents & actions_.at( i ).direction) ) ) {
+	continue;
+      }
+
+      /* (an earlier callback in this batch may have changed its mind,
+	 e.g. by emptying the fd's queue) */
+      if ( not actions_.at( i ).interested() ) {
+	update_interest( i );
+	continue;
+      }
+
+      const auto count_before = actions_.at( i ).service_count();
+      const auto result = actions_.at( i ).callback();
+
+      if ( not removed_[ i ] and count_before == actions_.at( i ).service_count() ) {
+	throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
+      }
+
+      if ( finish_callback( i, result ) ) {
+	return Result( Result::Type::Exit, result.exit_status );
+      }
+    }
+  }
+
+  return fire_timers();
 }
@@ -2,9 +2,11 @@
 #define POLLER_HH
 
 #include <functional>
+#include <unordered_map>
 #include <vector>
 
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include "file_descriptor.hh"
 
@@ -26,24 +28,29 @@ public:
     FileDescriptor & fd;
     enum PollDirection : short { In = POLLIN, Out = POLLOUT } direction;
     CallbackType callback;
-    std::function<bool(void)> when_interested;
+    std::function<bool(void)> when_interested; /* empty means "always" */
     bool active;
 
+    /* called if the fd has an error or hangup (empty means end poll()) */
+    CallbackType error_callback;
+
     Action( FileDescriptor & s_fd,
 	    const PollDirection & s_direction,
 	    const CallbackType & s_callback,
-	    const std::function<bool(void)> & s_when_interested = [] () { return true; } )
+	    const std::function<bool(void)> & s_when_interested = std::function<bool(void)>() )
       : fd( s_fd ), direction( s_direction ), callback( s_callback ),
-	when_interested( s_when_interested ), active( true ) {}
+	when_interested( s_when_interested ), active( true ), error_callback() {}
 
     unsigned int service_count() const;
+
+    /* should the poller wait on this action right now? */
+    bool interested() const;
   };
 
-private:
-  std::vector< Action > actions_;
-  std::vector< pollfd > pollfds_;
+  /* poll(2) rebuilds and scans every fd on each call; epoll(7) keeps
+     interest registered in the kernel and only visits the ready fds */
+  enum class Backend { Poll, Epoll, EpollEdgeTriggered };
 
-public:
   struct Result
   {
     enum class Type { Success, Timeout, Exit } result;
@@ -52,8 +59,99 @@ public:
       : result( s_result ), exit_status( s_status ) {}
   };
 
-  Poller() : actions_(), pollfds_() {}
+  /* handle for cancelling a timer */
+  typedef uint64_t TimerID;
+
+private:
+  Backend backend_;
+  std::vector< Action > actions_;
+
+  /* one-shot and periodic timers, in a min-heap ordered by deadline
+     (cancelled timers are dropped lazily when they reach the top) */
+  struct Timer
+  {
+    uint64_t deadline_ns;
+    uint64_t interval_ns; /* zero for one-shot timers */
+    Action::CallbackType callback;
+  };
+
+  std::unordered_map< TimerID, Timer > timers_;
+  std::vector< std::pair< uint64_t, TimerID > > timer_heap_;
+  TimerID next_timer_id_;
+
+  /* how long to wait: the caller's timeout, or less if a timer is due sooner */
+  const timespec * wait_time( const int timeout_ms, timespec & storage ) const;
+
+  /* run the callbacks of every timer whose deadline has passed */
+  Result fire_timers();
+
+  /* poll(2) backend */
+  std::vector< pollfd > pollfds_;
+
+  /* epoll(7) backend: one registration per fd, shared by its actions */
+  struct Registration
+  {
+    int fd;
+    uint32_t events; /* currently registered with the kernel */
+    std::vector< size_t > actions;
+  };
+
+  FileDescriptor epoll_fd_;
+  std::vector< Registration > registrations_;
+  std::unordered_map< int, size_t > registration_of_fd_;
+  std::vector< size_t > registration_of_action_;
+  std::vector< bool > armed_; /* per action: is its direction registered? */
+  std::vector< size_t > conditional_actions_; /* those with a when_interested() */
+  size_t armed_count_;
+  std::vector< epoll_event > ready_;
+
+  /* actions whose fd was removed (their slots are reclaimed by compact()) */
+  std::vector< bool > removed_;
+  size_t removed_count_;
+
+  /* actions added by callbacks, held until poll() returns (so that
+     actions_ isn't reallocated under a running callback) */
+  bool polling_;
+  std::vector< Action > pending_actions_;
+
+  /* once poll() is done with the callbacks */
+  void add_pending_actions();
+
+  /* re-check whether an action wants events, telling the kernel if that changed */
+  void update_interest( const size_t action_index );
+
+  /* handle a callback's result; returns true if poll() should end */
+  bool finish_callback( const size_t action_index, const Action::Result & result );
+
+  /* rebuild without the removed actions, once they are the majority */
+  void compact();
+
+  Result poll_with_poll( const int & timeout_ms );
+  Result poll_with_epoll( const int & timeout_ms );
+
+public:
+  Poller( const Backend backend = Backend::Poll );
   void add_action( Action action );
+
+  /* write the fd's outbound queue whenever it has one and the fd is writable */
+  void add_flush_action( FileDescriptor & fd );
+
+  /* stop polling the fd and forget its actions (the fd may be destroyed
+     as soon as this returns, even from inside one of its callbacks) */
+  void remove_actions( const FileDescriptor & fd );
+
+  /* call back after delay_ns, then every interval_ns if it is nonzero
+     (the callback can return Exit to end poll() or Cancel to stop repeating) */
+  TimerID add_timer( const uint64_t delay_ns, const Action::CallbackType & callback,
+		     const uint64_t interval_ns = 0 );
+  void cancel_timer( const TimerID id );
+
+  /* let the kernel wake the calling thread at most slack_ns after a
+     deadline (the default, 50 us, would swamp sub-millisecond timers;
+     this sets it for the whole thread, every Poller included) */
+  static void set_timer_slack( const uint64_t slack_ns );
+
+  /* wait for events or the timeout (timers are run as they come due) */
   Result poll( const int & timeout_ms );
 };
 
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "ring_buffer.hh"
+
+using namespace std;
+
+RingBuffer::RingBuffer( const size_t capacity )
+  : storage_( capacity ), head_( 0 ), size_( 0 )
+{
+  if ( capacity == 0 ) {
+    throw runtime_error( "RingBuffer: zero capacity" );
+  }
+}
+
+size_t RingBuffer::read_from( FileDescriptor & fd )
+{
+  if ( available() == 0 ) {
+    throw runtime_error( "RingBuffer: full" );
+  }
+
+  /* the free space starts after the newest byte, and may wrap */
+  const size_t tail = ( head_ + size_ ) % capacity();
+  const size_t first_length = min( available(), capacity() - tail );
+
+  iovec spans[ 2 ] = { { &storage_[ tail ], first_length },
+		       { &storage_[ 0 ], available() - first_length } };
+
+  const size_t bytes_read = fd.read( spans, spans[ 1 ].iov_len ? 2 : 1 );
+  size_ += bytes_read;
+  return bytes_read;
+}
+
+RingBuffer::Span RingBuffer::front() const
+{
+  return { &storage_[ head_ ], min( size_, capacity() - head_ ) };
+}
+
+void RingBuffer::pop( const size_t length )
+{
+  if ( length > size_ ) {
+    throw out_of_range( "RingBuffer: pop past the end" );
+  }
+
+  size_ -= length;
+
+  /* (start over at the beginning when empty, so the next read doesn't wrap) */
+  head_ = size_ ? ( head_ + length ) % capacity() : 0;
+}
+
+string RingBuffer::pop_string( const size_t length )
+{
+  if ( length > size_ ) {
+    throw out_of_range( "RingBuffer: pop past the end" );
+  }
+
+  string ret;
+  ret.reserve( length );
+  while ( ret.size() < length ) {
+    const Span span = front();
+    const size_t piece = min( span.length, length - ret.size() );
+    ret.append( span.data, piece );
+    pop( piece );
+  }
+
+  return ret;
+}
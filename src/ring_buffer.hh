@@ -0,0 +1,50 @@
+#ifndef RING_BUFFER_HH
+#define RING_BUFFER_HH
+
+#include <string>
+#include <vector>
+
+#include "file_descriptor.hh"
+
+/* fixed-size byte queue that refills from a file descriptor with one
+   readv() into its free space (two spans when that wraps around the
+   end), so the caller can use the bytes where they landed */
+class RingBuffer
+{
+public:
+  /* some contiguous bytes in the buffer */
+  struct Span
+  {
+    const char * data;
+    size_t length;
+  };
+
+private:
+  std::vector<char> storage_;
+  size_t head_; /* index of the oldest byte */
+  size_t size_;
+
+public:
+  explicit RingBuffer( const size_t capacity = 64 * 1024 );
+
+  /* read as much as fits, and return how many bytes arrived
+     (0 as for FileDescriptor::read; throws if the buffer is already full) */
+  size_t read_from( FileDescriptor & fd );
+
+  /* the oldest bytes, as far as they go before wrapping
+     (so all of them unless they wrap: then pop() these and call again) */
+  Span front() const;
+
+  /* discard the oldest `length` bytes */
+  void pop( const size_t length );
+
+  /* copy out and discard the oldest `length` bytes */
+  std::string pop_string( const size_t length );
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return storage_.size(); }
+  size_t available() const { return capacity() - size_; }
+  bool empty() const { return size_ == 0; }
+};
+
+#endif /* RING_BUFFER_HH */
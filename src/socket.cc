@@ -1,4 +1,10 @@
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
 
 #include "socket.hh"
 #include "util.hh"
@@ -75,18 +81,59 @@ void Socket::connect( const Address & address )
 				    address.size() ) );
 }
 
+/* largest datagram we expect to receive */
+static const size_t RECEIVE_MTU = 65536;
+
+/* room for the ancillary data (e.g. timestamp) of one datagram */
+static const size_t RECEIVE_CONTROL_SIZE = 256;
+
+/* most segments the kernel will accept in one GSO send */
+static const size_t GSO_MAX_SEGMENTS = 64;
+
+/* largest GSO super-buffer (must fit in one IPv6 UDP datagram) */
+static const size_t GSO_MAX_BYTES = 65000;
+
+/* check the flags of a received datagram and find its timestamp (if there is one),
+   and the GRO segment size if the kernel coalesced several datagrams */
+static uint64_t received_timestamp( msghdr & header, size_t & gro_segment_size )
+{
+  /* make sure we got the whole datagram */
+  if ( header.msg_flags & MSG_TRUNC ) {
+    throw runtime_error( "recvfrom (oversized datagram)" );
+  } else if ( header.msg_flags ) {
+    throw runtime_error( "recvfrom (unhandled flag)" );
+  }
+
+  uint64_t timestamp = -1;
+  gro_segment_size = 0;
+
+  /* find the timestamp header (if there is one) */
+  cmsghdr *ts_hdr = CMSG_FIRSTHDR( &header );
+  while ( ts_hdr ) {
+    if ( ts_hdr->cmsg_level == SOL_SOCKET
+	 and ts_hdr->cmsg_type == SO_TIMESTAMPNS ) {
+      const timespec * const kernel_time = reinterpret_cast<timespec *>( CMSG_DATA( ts_hdr ) );
+      timestamp = timestamp_ns( *kernel_time );
+    } else if ( ts_hdr->cmsg_level == SOL_UDP
+		and ts_hdr->cmsg_type == UDP_GRO ) {
+      gro_segment_size = *reinterpret_cast<int *>( CMSG_DATA( ts_hdr ) );
+    }
+    ts_hdr = CMSG_NXTHDR( &header, ts_hdr );
+  }
+
+  return timestamp;
+}
+
 /* receive datagram and where it came from */
 UDPSocket::received_datagram UDPSocket::recv()
 {
-  static const ssize_t RECEIVE_MTU = 65536;
-
   /* receive source address, timestamp and payload */
   Address::raw datagram_source_address;
   msghdr header; zero( header );
   iovec msg_iovec; zero( msg_iovec );
 
   char msg_payload[ RECEIVE_MTU ];
-  char msg_control[ RECEIVE_MTU ];
+  char msg_control[ RECEIVE_CONTROL_SIZE ];
 
   /* prepare to get the source address */
   header.msg_name = &datagram_source_address;
@@ -108,24 +155,11 @@ UDPSocket::received_datagram UDPSocket::recv()
 
   register_read();
 
-  /* make sure we got the whole datagram */
-  if ( header.msg_flags & MSG_TRUNC ) {
-    throw runtime_error( "recvfrom (oversized datagram)" );
-  } else if ( header.msg_flags ) {
-    throw runtime_error( "recvfrom (unhandled flag)" );
-  }
-
-  uint64_t timestamp = -1;
+  size_t gro_segment_size;
+  const uint64_t timestamp = received_timestamp( header, gro_segment_size );
 
-  /* find the timestamp header (if there is one) */
-  cmsghdr *ts_hdr = CMSG_FIRSTHDR( &header );
-  while ( ts_hdr ) {
-    if ( ts_hdr->cmsg_level == SOL_SOCKET
-	 and ts_hdr->cmsg_type == SO_TIMESTAMPNS ) {
-      const timespec * const kernel_time = reinterpret_cast<timespec *>( CMSG_DATA( ts_hdr ) );
-      timestamp = timestamp_ms( *kernel_time );
-    }
-    ts_hdr = CMSG_NXTHDR( &header, ts_hdr );
+  if ( gro_segment_size and gro_segment_size < size_t( recv_len ) ) {
+    throw runtime_error( "recvmsg (coalesced datagram: use recv_batch() with GRO)" );
   }
 
   received_datagram ret = { Address( datagram_source_address,
@@ -136,6 +170,102 @@ UDPSocket::received_datagram UDPSocket::recv()
   return ret;
 }
 
+/* make room for at least `capacity` datagrams and reset the headers */
+mmsghdr * UDPSocket::BatchStorage::prepare( const unsigned int capacity )
+{
+  if ( capacity > capacity_ ) {
+    /* left uninitialized so untouched pages are never faulted in */
+    payloads_.reset( new char[ capacity * RECEIVE_MTU ] );
+    controls_.reset( new char[ capacity * RECEIVE_CONTROL_SIZE ] );
+    addresses_.resize( capacity );
+    iovecs_.resize( capacity );
+    headers_.resize( capacity );
+    datagrams.reserve( capacity );
+    capacity_ = capacity;
+  }
+
+  /* recvmmsg() overwrites the lengths, so reset them each time */
+  for ( unsigned int i = 0; i < capacity; i++ ) {
+    iovecs_[ i ].iov_base = payloads_.get() + i * RECEIVE_MTU;
+    iovecs_[ i ].iov_len = RECEIVE_MTU;
+
+    msghdr & header = headers_[ i ].msg_hdr;
+    zero( header );
+    header.msg_name = &addresses_[ i ];
+    header.msg_namelen = sizeof( addresses_[ i ] );
+    header.msg_iov = &iovecs_[ i ];
+    header.msg_iovlen = 1;
+    header.msg_control = controls_.get() + i * RECEIVE_CONTROL_SIZE;
+    header.msg_controllen = RECEIVE_CONTROL_SIZE;
+  }
+
+  datagrams.clear();
+
+  return headers_.data();
+}
+
+/* receive up to `limit` datagrams with one system call */
+const vector<UDPSocket::batched_datagram> & UDPSocket::recv_batch( const unsigned int limit )
+{
+  if ( limit == 0 ) {
+    throw runtime_error( "recv_batch: limit must be positive" );
+  }
+
+  mmsghdr * const headers = batch_.prepare( limit );
+
+  /* block for the first datagram, then take whatever else is already queued */
+  const int count = SystemCall( "recvmmsg",
+				recvmmsg( fd_num(), headers, limit, MSG_WAITFORONE, nullptr ) );
+
+  register_read();
+
+  for ( int i = 0; i < count; i++ ) {
+    msghdr & header = headers[ i ].msg_hdr;
+    size_t gro_segment_size;
+    const uint64_t timestamp = received_timestamp( header, gro_segment_size );
+
+    const Address source_address( *static_cast<Address::raw *>( header.msg_name ),
+				  header.msg_namelen );
+    const char * const payload = static_cast<const char *>( header.msg_iov->iov_base );
+    const size_t length = headers[ i ].msg_len;
+
+    /* split a GRO super-buffer back into the datagrams that were coalesced
+       (all but the last are exactly gro_segment_size long) */
+    const size_t segment_size = gro_segment_size ? gro_segment_size : length;
+    size_t offset = 0;
+    do {
+      batched_datagram datagram = { source_address,
+				    timestamp,
+				    payload + offset,
+				    min( segment_size, length - offset ) };
+      batch_.datagrams.push_back( datagram );
+      offset += datagram.payload_length;
+    } while ( offset < length );
+  }
+
+  return batch_.datagrams;
+}
+
+/* interpret a datagram that was received some other way (e.g. through io_uring) */
+UDPSocket::batched_datagram UDPSocket::parse_datagram( msghdr & header, const char * payload,
+							const size_t length )
+{
+  size_t gro_segment_size;
+  const uint64_t timestamp = received_timestamp( header, gro_segment_size );
+
+  if ( gro_segment_size and gro_segment_size < length ) {
+    throw runtime_error( "recvmsg (coalesced datagram: use recv_batch() with GRO)" );
+  }
+
+  batched_datagram ret = { Address( *static_cast<Address::raw *>( header.msg_name ),
+				    header.msg_namelen ),
+			   timestamp,
+			   payload,
+			   length };
+
+  return ret;
+}
+
 /* send datagram to specified address */
 void UDPSocket::sendto( const Address & destination, const string & payload )
 {
@@ -170,6 +300,163 @@ void UDPSocket::send( const string & payload )
   }
 }
 
+/* send the prepared headers, calling sendmmsg() until all have gone out */
+size_t UDPSocket::send_prepared_batch( const string & name_of_function )
+{
+  size_t sent = 0, payloads_sent = 0;
+  while ( sent < send_headers_.size() ) {
+    int count;
+    try {
+      count = SystemCall( name_of_function,
+			  sendmmsg( fd_num(), send_headers_.data() + sent,
+				    send_headers_.size() - sent, 0 ) );
+    } catch ( const unix_error & e ) {
+      /* the kernel or device refused segmentation offload: fall back */
+      const int error = e.code().value();
+      if ( gso_ and send_headers_[ sent ].msg_hdr.msg_controllen
+	   and (error == EIO or error == EINVAL or error == EOPNOTSUPP) ) {
+	gso_ = false;
+	return payloads_sent;
+      }
+      throw;
+    }
+
+    register_write();
+
+    for ( int i = 0; i < count; i++ ) {
+      const mmsghdr & header = send_headers_[ sent + i ];
+      size_t length = 0;
+      for ( size_t j = 0; j < header.msg_hdr.msg_iovlen; j++ ) {
+	length += header.msg_hdr.msg_iov[ j ].iov_len;
+      }
+
+      if ( header.msg_len != length ) {
+	throw runtime_error( "datagram payload too big for " + name_of_function + "()" );
+      }
+
+      payloads_sent += header.msg_hdr.msg_iovlen;
+    }
+
+    sent += count;
+  }
+
+  return payloads_sent;
+}
+
+/* prepare headers for send_batch(), from payload `first` up to `count` */
+void UDPSocket::prepare_send_batch( const vector<string> & payloads,
+				    const size_t first, const size_t count )
+{
+  static const size_t CONTROL_SIZE = CMSG_SPACE( sizeof( uint16_t ) );
+
+  send_iovecs_.resize( count - first );
+  send_headers_.clear();
+
+  for ( size_t i = first; i < count; i++ ) {
+    iovec & iov = send_iovecs_[ i - first ];
+    iov.iov_base = const_cast<char *>( payloads[ i ].data() );
+    iov.iov_len = payloads[ i ].size();
+
+    /* with GSO, append to the previous datagram if it has room and all its
+       segments (so far) are the same size as this one or bigger */
+    if ( gso_ and not send_headers_.empty() ) {
+      msghdr & previous = send_headers_.back().msg_hdr;
+      const size_t segment_size = previous.msg_iov[ 0 ].iov_len;
+      const iovec & last = previous.msg_iov[ previous.msg_iovlen - 1 ];
+      const size_t total = segment_size * ( previous.msg_iovlen - 1 ) + last.iov_len;
+
+      if ( last.iov_len == segment_size
+	   and iov.iov_len <= segment_size
+	   and previous.msg_iovlen < GSO_MAX_SEGMENTS
+	   and total + iov.iov_len <= GSO_MAX_BYTES ) {
+	previous.msg_iovlen++;
+	continue;
+      }
+    }
+
+    send_headers_.emplace_back();
+    zero( send_headers_.back() );
+    send_headers_.back().msg_hdr.msg_iov = &iov;
+    send_headers_.back().msg_hdr.msg_iovlen = 1;
+  }
+
+  if ( not gso_ ) {
+    return;
+  }
+
+  /* tell the kernel the segment size of each coalesced datagram */
+  send_controls_.assign( send_headers_.size() * CONTROL_SIZE, 0 );
+  for ( size_t i = 0; i < send_headers_.size(); i++ ) {
+    msghdr & header = send_headers_[ i ].msg_hdr;
+    if ( header.msg_iovlen < 2 ) {
+      continue;
+    }
+
+    header.msg_control = &send_controls_[ i * CONTROL_SIZE ];
+    header.msg_controllen = CONTROL_SIZE;
+
+    cmsghdr * const segment_hdr = CMSG_FIRSTHDR( &header );
+    segment_hdr->cmsg_level = SOL_UDP;
+    segment_hdr->cmsg_type = UDP_SEGMENT;
+    segment_hdr->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+    *reinterpret_cast<uint16_t *>( CMSG_DATA( segment_hdr ) ) = header.msg_iov[ 0 ].iov_len;
+  }
+}
+
+/* send many datagrams to the connected address with one system call */
+void UDPSocket::send_batch( const vector<string> & payloads )
+{
+  send_batch( payloads, payloads.size() );
+}
+
+/* send the first `count` payloads to the connected address with one system call */
+void UDPSocket::send_batch( const vector<string> & payloads, const size_t count )
+{
+  if ( count > payloads.size() ) {
+    throw runtime_error( "send_batch: count exceeds number of payloads" );
+  }
+
+  size_t sent = 0;
+  while ( sent < count ) {
+    prepare_send_batch( payloads, sent, count );
+    sent += send_prepared_batch( "send_batch" );
+  }
+}
+
+/* send many datagrams, each to its own destination, with one system call */
+void UDPSocket::sendto_batch( const vector<pair<Address, string>> & datagrams )
+{
+  sendto_batch( datagrams, datagrams.size() );
+}
+
+/* send the first `count` datagrams, each to its own destination, with one system call */
+void UDPSocket::sendto_batch( const vector<pair<Address, string>> & datagrams, const size_t count )
+{
+  if ( count > datagrams.size() ) {
+    throw runtime_error( "sendto_batch: count exceeds number of datagrams" );
+  }
+
+  send_iovecs_.resize( count );
+  send_headers_.resize( count );
+
+  /* (no segmentation offload here, since each datagram may go somewhere else) */
+  for ( size_t i = 0; i < count; i++ ) {
+    const Address & destination = datagrams[ i ].first;
+    const string & payload = datagrams[ i ].second;
+
+    send_iovecs_[ i ].iov_base = const_cast<char *>( payload.data() );
+    send_iovecs_[ i ].iov_len = payload.size();
+
+    zero( send_headers_[ i ] );
+    send_headers_[ i ].msg_hdr.msg_name = const_cast<sockaddr *>( &destination.to_sockaddr() );
+    send_headers_[ i ].msg_hdr.msg_namelen = destination.size();
+    send_headers_[ i ].msg_hdr.msg_iov = &send_iovecs_[ i ];
+    send_headers_[ i ].msg_hdr.msg_iovlen = 1;
+  }
+
+  send_prepared_batch( "sendto_batch" );
+}
+
 /* mark the socket as listening for incoming connections */
 void TCPSocket::listen( const int backlog )
 {
@@ -183,6 +470,131 @@ TCPSocket TCPSocket::accept()
   return TCPSocket( FileDescriptor( SystemCall( "accept", ::accept( fd_num(), nullptr, nullptr ) ) ) );
 }
 
+template <typename Transfer>
+size_t TCPSocket::transmit( const string & name_of_function, const size_t count,
+			    const Transfer & transfer )
+{
+  if ( queued_bytes() ) {
+    return 0;
+  }
+
+  size_t sent = 0;
+  while ( sent < count ) {
+    const ssize_t bytes_sent = transfer( count - sent );
+    if ( bytes_sent < 0 ) {
+      if ( not blocking() and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) {
+	break;
+      }
+      throw unix_error( name_of_function );
+    }
+
+    register_write();
+
+    if ( bytes_sent == 0 ) {
+      break; /* end of the file, or the pipe's writer has closed */
+    }
+    sent += bytes_sent;
+  }
+
+  return sent;
+}
+
+/* send part of a file straight from the page cache */
+size_t TCPSocket::send_file( FileDescriptor & file, const off_t offset, const size_t count )
+{
+  off_t position = offset; /* (advanced by sendfile) */
+  return transmit( "sendfile", count, [&] ( const size_t bytes_left ) {
+      return ::sendfile( fd_num(), file.fd_num(), &position, bytes_left );
+    } );
+}
+
+/* move bytes from a pipe into the socket */
+size_t TCPSocket::splice_from( FileDescriptor & pipe, const size_t count )
+{
+  /* (the socket's own O_NONBLOCK covers its side; this covers the pipe's) */
+  const unsigned int flags = SPLICE_F_MOVE | ( blocking() ? 0 : SPLICE_F_NONBLOCK );
+  return transmit( "splice", count, [&] ( const size_t bytes_left ) {
+      return ::splice( pipe.fd_num(), nullptr, fd_num(), nullptr, bytes_left, flags );
+    } );
+}
+
+/* opt in to MSG_ZEROCOPY */
+bool TCPSocket::enable_zerocopy()
+{
+  try {
+    setsockopt( SOL_SOCKET, SO_ZEROCOPY, int( true ) );
+  } catch ( const unix_error & e ) {
+    if ( e.code().value() != ENOPROTOOPT and e.code().value() != EOPNOTSUPP ) {
+      throw;
+    }
+    return false;
+  }
+
+  zerocopy_ = true;
+  return true;
+}
+
+/* send from the buffer's own memory */
+size_t TCPSocket::send_zerocopy( const string & buffer )
+{
+  if ( not zerocopy_ ) {
+    throw runtime_error( "send_zerocopy: call enable_zerocopy() first" );
+  }
+
+  return transmit( "send", buffer.size(), [&] ( const size_t bytes_left ) {
+      const ssize_t bytes_sent = ::send( fd_num(), buffer.data() + buffer.size() - bytes_left,
+					 bytes_left, MSG_ZEROCOPY | MSG_NOSIGNAL );
+      if ( bytes_sent > 0 ) {
+	zerocopy_sends_++; /* (the kernel numbers each successful call) */
+      }
+      return bytes_sent;
+    } );
+}
+
+/* read completion notifications from the error queue */
+uint32_t TCPSocket::reap_zerocopy()
+{
+  while ( true ) {
+    union {
+      char buffer[ 256 ];
+      cmsghdr align;
+    } control;
+
+    msghdr header;
+    zero( header );
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof( control.buffer );
+
+    /* (the error queue never blocks) */
+    if ( ::recvmsg( fd_num(), &header, MSG_ERRQUEUE ) < 0 ) {
+      if ( errno == EAGAIN or errno == EWOULDBLOCK ) {
+	break;
+      }
+      throw unix_error( "recvmsg" );
+    }
+
+    for ( cmsghdr * cmsg = CMSG_FIRSTHDR( &header ); cmsg; cmsg = CMSG_NXTHDR( &header, cmsg ) ) {
+      if ( not ( ( cmsg->cmsg_level == SOL_IP and cmsg->cmsg_type == IP_RECVERR )
+		 or ( cmsg->cmsg_level == SOL_IPV6 and cmsg->cmsg_type == IPV6_RECVERR ) ) ) {
+	continue;
+      }
+
+      const sock_extended_err * const error = reinterpret_cast<sock_extended_err *>( CMSG_DATA( cmsg ) );
+      if ( error->ee_origin != SO_EE_ORIGIN_ZEROCOPY or error->ee_errno != 0 ) {
+	continue;
+      }
+
+      /* sends ee_info through ee_data are complete */
+      zerocopy_completed_ += error->ee_data - error->ee_info + 1;
+      if ( error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED ) {
+	zerocopy_copied_ = true;
+      }
+    }
+  }
+
+  return zerocopy_completed_;
+}
+
 /* set socket option */
 template <typename option_type>
 void Socket::setsockopt( const int level, const int option, const option_type & option_value )
@@ -197,8 +609,74 @@ void Socket::set_reuseaddr()
   setsockopt( SOL_SOCKET, SO_REUSEADDR, int( true ) );
 }
 
+/* let several sockets bind the same address */
+void Socket::set_reuseport()
+{
+  setsockopt( SOL_SOCKET, SO_REUSEPORT, int( true ) );
+}
+
+/* choose the group member by the CPU that received the packet */
+void Socket::steer_reuseport_by_cpu( const unsigned int group_size )
+{
+  if ( group_size == 0 ) {
+    throw runtime_error( "steer_reuseport_by_cpu: empty group" );
+  }
+
+  /* classic BPF: return ( cpu % group_size ) */
+  sock_filter code[] = {
+    BPF_STMT( BPF_LD | BPF_W | BPF_ABS, uint32_t( SKF_AD_OFF + SKF_AD_CPU ) ),
+    BPF_STMT( BPF_ALU | BPF_MOD | BPF_K, group_size ),
+    BPF_STMT( BPF_RET | BPF_A, 0 )
+  };
+
+  sock_fprog program;
+  program.len = sizeof( code ) / sizeof( code[ 0 ] );
+  program.filter = code;
+
+  setsockopt( SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, program );
+}
+
+/* ask the fq qdisc to pace this socket's traffic (no effect with other qdiscs) */
+void Socket::set_max_pacing_rate( const uint64_t bytes_per_second )
+{
+  setsockopt( SOL_SOCKET, SO_MAX_PACING_RATE, bytes_per_second );
+}
+
 /* turn on timestamps on receipt */
 void UDPSocket::set_timestamps()
 {
   setsockopt( SOL_SOCKET, SO_TIMESTAMPNS, int( true ) );
 }
+
+/* opt in to UDP generic segmentation offload in send_batch() */
+bool UDPSocket::enable_gso()
+{
+  try {
+    /* no default segment size; each send_batch() datagram carries its own */
+    setsockopt( SOL_UDP, UDP_SEGMENT, int( 0 ) );
+  } catch ( const unix_error & e ) {
+    if ( e.code().value() != ENOPROTOOPT ) {
+      throw;
+    }
+    return false;
+  }
+
+  gso_ = true;
+  return true;
+}
+
+/* opt in to UDP generic receive offload in recv_batch() */
+bool UDPSocket::enable_gro()
+{
+  try {
+    setsockopt( SOL_UDP, UDP_GRO, int( true ) );
+  } catch ( const unix_error & e ) {
+    if ( e.code().value() != ENOPROTOOPT ) {
+      throw;
+    }
+    return false;
+  }
+
+  gro_ = true;
+  return true;
+}
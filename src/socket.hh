@@ -2,6 +2,10 @@
 #define SOCKET_HH
 
 #include <functional>
+#include <memory>
+#include <vector>
+
+#include <sys/socket.h>
 
 #include "address.hh"
 #include "file_descriptor.hh"
@@ -38,48 +42,189 @@ public:
 
   /* allow local address to be reused sooner, at the cost of some robustness */
   void set_reuseaddr();
+
+  /* let several sockets bind the same address (the kernel spreads
+     incoming datagrams or connections among them by flow hash) */
+  void set_reuseport();
+
+  /* instead, send each to socket number ( receiving CPU % group_size ) of
+     the group, numbered in the order they were bound (call on any bound member) */
+  void steer_reuseport_by_cpu( const unsigned int group_size );
+
+  /* ask the fq qdisc to pace this socket's traffic (no effect with other qdiscs) */
+  void set_max_pacing_rate( const uint64_t bytes_per_second );
 };
 
 /* UDP socket */
 class UDPSocket : public Socket
 {
 public:
-  UDPSocket() : Socket( AF_INET6, SOCK_DGRAM ) {}
-
   struct received_datagram {
     Address source_address;
-    uint64_t timestamp;
+    uint64_t timestamp; /* ns since program start (see timestamp.hh) */
     std::string payload;
   };
 
+  /* datagram received by recv_batch(); the payload points into
+     the socket's batch storage and is valid until the next call */
+  struct batched_datagram {
+    Address source_address;
+    uint64_t timestamp; /* ns since program start (see timestamp.hh) */
+    const char * payload;
+    size_t payload_length;
+
+    std::string payload_string() const { return std::string( payload, payload_length ); }
+  };
+
+private:
+  /* storage for recvmmsg(), allocated once and reused across calls */
+  class BatchStorage
+  {
+  private:
+    unsigned int capacity_;
+    std::unique_ptr<char[]> payloads_;
+    std::unique_ptr<char[]> controls_;
+    std::vector<Address::raw> addresses_;
+    std::vector<iovec> iovecs_;
+    std::vector<mmsghdr> headers_;
+
+  public:
+    BatchStorage() : capacity_( 0 ), payloads_(), controls_(),
+		     addresses_(), iovecs_(), headers_(), datagrams() {}
+
+    std::vector<batched_datagram> datagrams;
+
+    /* make room for at least `capacity` datagrams and reset the headers */
+    mmsghdr * prepare( const unsigned int capacity );
+  } batch_;
+
+  /* storage for sendmmsg(), reused across calls */
+  std::vector<iovec> send_iovecs_;
+  std::vector<mmsghdr> send_headers_;
+  std::vector<char> send_controls_;
+
+  /* segmentation offload: whether send_batch() coalesces equal-sized
+     datagrams, and whether recv_batch() may see coalesced ones */
+  bool gso_, gro_;
+
+  /* prepare headers for send_batch(), from payload `first` up to `count` */
+  void prepare_send_batch( const std::vector<std::string> & payloads,
+			   const size_t first, const size_t count );
+
+  /* send the prepared headers, calling sendmmsg() until all have gone out;
+     returns the number of payloads sent (fewer if the kernel refused GSO) */
+  size_t send_prepared_batch( const std::string & name_of_function );
+
+public:
+  UDPSocket() : Socket( AF_INET6, SOCK_DGRAM ), batch_(), send_iovecs_(), send_headers_(),
+		send_controls_(), gso_( false ), gro_( false ) {}
+
   /* receive datagram, timestamp, and where it came from */
   received_datagram recv();
 
+  /* receive up to `limit` datagrams with one system call
+     (blocks until at least one is available) */
+  const std::vector<batched_datagram> & recv_batch( const unsigned int limit );
+
+  /* interpret a datagram that was received some other way (e.g. through io_uring) */
+  static batched_datagram parse_datagram( msghdr & header, const char * payload,
+					  const size_t length );
+
   /* send datagram to specified address */
   void sendto( const Address & peer, const std::string & payload );
 
   /* send datagram to connected address */
   void send( const std::string & payload );
 
+  /* send many datagrams to the connected address with one system call */
+  void send_batch( const std::vector<std::string> & payloads );
+
+  /* ... but only the first `count` (so the caller can keep reusing one vector) */
+  void send_batch( const std::vector<std::string> & payloads, const size_t count );
+
+  /* send many datagrams, each to its own destination, with one system call */
+  void sendto_batch( const std::vector<std::pair<Address, std::string>> & datagrams );
+  void sendto_batch( const std::vector<std::pair<Address, std::string>> & datagrams,
+		     const size_t count );
+
   /* turn on timestamps on receipt */
   void set_timestamps();
+
+  /* opt in to UDP generic segmentation offload in send_batch()
+     (returns false if the kernel doesn't support it) */
+  bool enable_gso();
+
+  /* opt in to UDP generic receive offload in recv_batch()
+     (returns false if the kernel doesn't support it) */
+  bool enable_gro();
+
+  bool gso_enabled() const { return gso_; }
+  bool gro_enabled() const { return gro_; }
 };
 
 /* TCP socket */
 class TCPSocket : public Socket
 {
 private:
+  /* MSG_ZEROCOPY: whether it's on, how many sends have used it, how many
+     of those the kernel has finished with, and whether it had to copy anyway */
+  bool zerocopy_;
+  uint32_t zerocopy_sends_, zerocopy_completed_;
+  bool zerocopy_copied_;
+
   /* private constructor used by accept() */
-  TCPSocket( FileDescriptor && fd ) : Socket( std::move( fd ), AF_INET6, SOCK_STREAM ) {}
+  TCPSocket( FileDescriptor && fd ) : Socket( std::move( fd ), AF_INET6, SOCK_STREAM ),
+				      zerocopy_( false ), zerocopy_sends_( 0 ),
+				      zerocopy_completed_( 0 ), zerocopy_copied_( false ) { suppress_sigpipe(); }
+
+  /* call `transfer( bytes_left )` until `count` bytes have gone out, or
+     (non-blocking) the socket is full, or the source runs dry */
+  template <typename Transfer>
+  size_t transmit( const std::string & name_of_function, const size_t count,
+		   const Transfer & transfer );
 
 public:
-  TCPSocket() : Socket( AF_INET6, SOCK_STREAM ) {}
+  TCPSocket() : Socket( AF_INET6, SOCK_STREAM ), zerocopy_( false ), zerocopy_sends_( 0 ),
+		zerocopy_completed_( 0 ), zerocopy_copied_( false ) { suppress_sigpipe(); }
 
   /* mark the socket as listening for incoming connections */
   void listen( const int backlog = 16 );
 
   /* accept a new incoming connection */
   TCPSocket accept();
+
+  /* The methods below send without copying through user space. Each
+     returns how many bytes went out: all `count` if the socket is
+     blocking (unless the source ends first), or as many as the socket
+     would take if not. They don't go through write()'s queue, so they
+     send nothing while it has bytes waiting (flush() it first). Unlike
+     write(), sendfile and splice can't be told not to raise SIGPIPE if
+     the peer has gone away: ignore it in programs that use them. */
+
+  /* send part of a file straight from the page cache (sendfile) */
+  size_t send_file( FileDescriptor & file, const off_t offset, const size_t count );
+
+  /* move bytes from a pipe into the socket (splice) */
+  size_t splice_from( FileDescriptor & pipe, const size_t count );
+
+  /* opt in to MSG_ZEROCOPY (returns false if the kernel doesn't support it) */
+  bool enable_zerocopy();
+
+  /* send the buffer with MSG_ZEROCOPY: the kernel transmits from the
+     string's memory, so it must stay alive and unchanged until
+     reap_zerocopy() reports the send complete */
+  size_t send_zerocopy( const std::string & buffer );
+
+  /* read completion notifications from the error queue (without blocking),
+     and return how many zerocopy sends the kernel is done with
+     (each send_zerocopy() may count for several, see zerocopy_sends()) */
+  uint32_t reap_zerocopy();
+
+  uint32_t zerocopy_sends() const { return zerocopy_sends_; }
+  bool zerocopy_pending() const { return zerocopy_completed_ != zerocopy_sends_; }
+
+  /* did the kernel copy the bytes after all (e.g. over loopback)? */
+  bool zerocopy_copied() const { return zerocopy_copied_; }
 };
 
 #endif /* SOCKET_HH */
@@ -0,0 +1,286 @@
+#include <unordered_map>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "poller.hh"
+#include "tcp_server.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* is this the error a non-blocking fd gives when it isn't ready? */
+static bool would_block( const unix_error & e )
+{
+  return e.code().value() == EAGAIN or e.code().value() == EWOULDBLOCK;
+}
+
+/* did the peer go away (rather than something going wrong here)? */
+static bool peer_gone( const unix_error & e )
+{
+  return e.code().value() == EPIPE or e.code().value() == ECONNRESET;
+}
+
+TCPServer::Connection::Connection( TCPSocket && socket, const unsigned int worker )
+  : socket_( move( socket ) ),
+    peer_( socket_.peer_address() ),
+    worker_( worker ),
+    closing_( false )
+{
+  socket_.set_blocking( false );
+}
+
+/* one event loop: a listening socket, its connections, and a way to be stopped */
+class TCPServer::Worker
+{
+private:
+  unsigned int index_;
+  const Handlers & handlers_;
+  TCPSocket listener_;
+  FileDescriptor wakeup_; /* (an eventfd) */
+  Poller poller_;
+
+  unordered_map<Connection *, unique_ptr<Connection>> connections_;
+
+  /* connections finished during this poll() (destroyed once it returns,
+     since their callbacks may still be on the stack) */
+  vector<unique_ptr<Connection>> finished_;
+
+  /* shared by this worker's connections: the socket reads into the
+     buffer, and the bytes go to on_data() in a string that keeps its
+     capacity, so a read doesn't allocate */
+  vector<char> read_buffer_;
+  string chunk_;
+
+  void accept_all();
+  void add( unique_ptr<Connection> && connection );
+  void finish( Connection & connection );
+
+  /* run a handler, finishing the connection if it asked to close or failed */
+  template <class Function>
+  void handle( Connection & connection, const Function & function )
+  {
+    try {
+      function();
+      if ( connection.closing() and connection.queued_bytes() == 0 ) {
+	finish( connection );
+      }
+    } catch ( const unix_error & e ) {
+      if ( not peer_gone( e ) ) {
+	print_exception( e );
+      }
+      finish( connection );
+    } catch ( const exception & e ) {
+      print_exception( e );
+      finish( connection );
+    }
+  }
+
+public:
+  Worker( const unsigned int index, const Address & address, const Handlers & handlers );
+
+  void run();
+  void stop();
+
+  Address local_address() const { return listener_.local_address(); }
+
+  /* forbid copying */
+  Worker( const Worker & other ) = delete;
+  const Worker & operator=( const Worker & other ) = delete;
+};
+
+TCPServer::Worker::Worker( const unsigned int index, const Address & address,
+			   const Handlers & handlers )
+  : index_( index ),
+    handlers_( handlers ),
+    listener_(),
+    wakeup_( SystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) ),
+    poller_( Poller::Backend::Epoll ),
+    connections_(),
+    finished_(),
+    read_buffer_( 64 * 1024 ),
+    chunk_()
+{
+  listener_.set_reuseaddr();
+  listener_.set_reuseport();
+  listener_.bind( address );
+  listener_.listen( SOMAXCONN );
+  listener_.set_blocking( false );
+
+  poller_.add_action( Action( listener_, Direction::In, [&] () {
+	accept_all();
+	return ResultType::Continue;
+      } ) );
+
+  poller_.add_action( Action( wakeup_, Direction::In, [&] () {
+	wakeup_.read( sizeof( uint64_t ) );
+	return ResultType::Exit;
+      } ) );
+}
+
+/* take every connection that is waiting */
+void TCPServer::Worker::accept_all()
+{
+  while ( true ) {
+    try {
+      add( unique_ptr<Connection>( new Connection( listener_.accept(), index_ ) ) );
+    } catch ( const unix_error & e ) {
+      if ( would_block( e ) ) {
+	return;
+      } else if ( e.code().value() == ECONNABORTED or e.code().value() == ENOTCONN ) {
+	continue; /* (gone before we got to it) */
+      }
+
+      /* e.g. out of file descriptors: try again on the next poll */
+      print_exception( e );
+      return;
+    }
+  }
+}
+
+void TCPServer::Worker::add( unique_ptr<Connection> && new_connection )
+{
+  Connection * const connection = new_connection.get();
+  connections_.emplace( connection, move( new_connection ) );
+
+  const auto error_callback = [this, connection] () {
+    finish( *connection );
+    return ResultType::Continue;
+  };
+
+  Action reader( connection->socket(), Direction::In, [this, connection] () {
+      handle( *connection, [&] () {
+	  const size_t length = connection->socket().read( read_buffer_.data(), read_buffer_.size() );
+	  if ( connection->socket().eof() ) {
+	    finish( *connection );
+	  } else if ( handlers_.on_data and length ) {
+	    chunk_.assign( read_buffer_.data(), length );
+	    handlers_.on_data( *connection, chunk_ );
+	  }
+	} );
+      return ResultType::Continue;
+    } );
+  reader.error_callback = error_callback;
+  poller_.add_action( reader );
+
+  Action writer( connection->socket(), Direction::Out, [this, connection] () {
+      handle( *connection, [&] () { connection->flush(); } );
+      return ResultType::Continue;
+    },
+    [connection] () { return connection->queued_bytes() > 0; } );
+  writer.error_callback = error_callback;
+  poller_.add_action( writer );
+
+  if ( handlers_.on_open ) {
+    handle( *connection, [&] () { handlers_.on_open( *connection ); } );
+  }
+}
+
+void TCPServer::Worker::finish( Connection & connection )
+{
+  const auto it = connections_.find( &connection );
+  if ( it == connections_.end() ) {
+    return; /* (already finished) */
+  }
+
+  poller_.remove_actions( connection.socket() );
+
+  if ( handlers_.on_close ) {
+    try {
+      handlers_.on_close( connection );
+    } catch ( const exception & e ) {
+      print_exception( e );
+    }
+  }
+
+  finished_.push_back( move( it->second ) );
+  connections_.erase( it );
+}
+
+void TCPServer::Worker::run()
+{
+  while ( true ) {
+    try {
+      if ( poller_.poll( -1 ).result == PollResult::Exit ) {
+	break;
+      }
+    } catch ( const exception & e ) {
+      /* (the handlers' own errors are caught in handle(), so this is
+	 the poller's; report it and keep serving the other connections) */
+      print_exception( e );
+    }
+    finished_.clear();
+  }
+
+  /* stopped: close what's left */
+  while ( not connections_.empty() ) {
+    finish( *connections_.begin()->second );
+  }
+  finished_.clear();
+}
+
+/* (may be called from any thread) */
+void TCPServer::Worker::stop()
+{
+  const uint64_t one = 1;
+  SystemCall( "write", ::write( wakeup_.fd_num(), &one, sizeof( one ) ) );
+}
+
+TCPServer::TCPServer( const Address & address, const Handlers & handlers,
+		      const unsigned int worker_count )
+  : handlers_( handlers ), workers_(), threads_()
+{
+  if ( worker_count == 0 ) {
+    throw runtime_error( "TCPServer: no workers" );
+  }
+
+  /* (the first bind picks the port, if the address didn't) */
+  workers_.emplace_back( new Worker( 0, address, handlers_ ) );
+  const Address bound = workers_.front()->local_address();
+  for ( unsigned int i = 1; i < worker_count; i++ ) {
+    workers_.emplace_back( new Worker( i, bound, handlers_ ) );
+  }
+
+  for ( auto & worker : workers_ ) {
+    Worker * const the_worker = worker.get();
+    threads_.emplace_back( [the_worker] () {
+	try {
+	  the_worker->run();
+	} catch ( const exception & e ) {
+	  print_exception( e );
+	}
+      } );
+  }
+}
+
+TCPServer::~TCPServer()
+{
+  try {
+    stop();
+  } catch ( const exception & e ) { /* don't throw from destructor */
+    print_exception( e );
+  }
+  wait();
+}
+
+void TCPServer::stop()
+{
+  for ( auto & worker : workers_ ) {
+    worker->stop();
+  }
+}
+
+void TCPServer::wait()
+{
+  for ( auto & thread : threads_ ) {
+    if ( thread.joinable() ) {
+      thread.join();
+    }
+  }
+}
+
+Address TCPServer::local_address() const
+{
+  return workers_.front()->local_address();
+}
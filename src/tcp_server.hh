@@ -0,0 +1,90 @@
+#ifndef TCP_SERVER_HH
+#define TCP_SERVER_HH
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "address.hh"
+#include "socket.hh"
+
+/* TCP server with a fixed pool of event-loop workers: each worker is a
+   thread running its own Poller, with its own listening socket on the
+   shared port (SO_REUSEPORT), so the kernel spreads new connections
+   among them. A connection stays on the worker that accepted it, and
+   its handlers run on that worker's thread, so they must not block. */
+class TCPServer
+{
+public:
+  /* one client (owned by the worker that accepted it) */
+  class Connection
+  {
+  private:
+    TCPSocket socket_;
+    Address peer_;
+    unsigned int worker_;
+
+    /* close once the queued bytes have gone out */
+    bool closing_;
+
+  public:
+    Connection( TCPSocket && socket, const unsigned int worker );
+
+    /* send the bytes, queueing whatever the socket won't take right now */
+    void send( const std::string & data ) { socket_.write( data ); }
+
+    /* close the connection (after sending anything queued) */
+    void close() { closing_ = true; }
+
+    /* write as much of the queue as the socket will take */
+    void flush() { socket_.flush(); }
+
+    /* accessors */
+    TCPSocket & socket() { return socket_; }
+    const Address & peer_address() const { return peer_; }
+    unsigned int worker() const { return worker_; }
+    size_t queued_bytes() const { return socket_.queued_bytes(); }
+    bool closing() const { return closing_; }
+  };
+
+  /* what to do with each connection (called on its worker's thread) */
+  struct Handlers
+  {
+    std::function<void(Connection &)> on_open {};
+    std::function<void(Connection &, const std::string &)> on_data {};
+    std::function<void(Connection &)> on_close {};
+  };
+
+private:
+  class Worker;
+
+  Handlers handlers_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+
+public:
+  /* listen on the address and start the workers */
+  TCPServer( const Address & address, const Handlers & handlers,
+	     const unsigned int worker_count = std::max( 1u, std::thread::hardware_concurrency() ) );
+
+  /* stop the workers (closing every connection) */
+  ~TCPServer();
+
+  /* ask the workers to stop (from any thread) */
+  void stop();
+
+  /* wait for the workers to stop */
+  void wait();
+
+  Address local_address() const;
+  unsigned int worker_count() const { return workers_.size(); }
+
+  /* forbid copying */
+  TCPServer( const TCPServer & other ) = delete;
+  const TCPServer & operator=( const TCPServer & other ) = delete;
+};
+
+#endif /* TCP_SERVER_HH */
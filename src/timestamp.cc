@@ -1,36 +1,144 @@
+#include <algorithm>
 #include <ctime>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
 #include "timestamp.hh"
 #include "util.hh"
 
-/* nanoseconds per millisecond */
-static const uint64_t MILLION = 1000000;
+using namespace std;
 
 /* nanoseconds per second */
-static const uint64_t BILLION = 1000 * MILLION;
+static const uint64_t BILLION = 1000000000;
+
+/* how long to measure the TSC rate before trusting it */
+static const uint64_t TSC_WARMUP_NS = 10000000;
+
+/* how often the TSC fast path re-anchors itself to the system clock */
+static const uint64_t TSC_RECALIBRATION_NS = BILLION;
+
+/* how many times to read the system clock when anchoring the TSC */
+static const unsigned int TSC_ANCHOR_TRIES = 3;
 
 /* helper functions */
-static timespec current_time()
+static timespec current_time( const clockid_t clock )
 {
   timespec ret;
-  SystemCall( "clock_gettime", clock_gettime( CLOCK_REALTIME, &ret ) );
+  SystemCall( "clock_gettime", clock_gettime( clock, &ret ) );
   return ret;
 }
 
-static uint64_t timestamp_ms_raw( const timespec & ts )
+static uint64_t timestamp_ns_raw( const timespec & ts )
+{
+  return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+/* monotonic time at the start of the program */
+static uint64_t epoch()
+{
+  const static uint64_t EPOCH = timestamp_ns_raw( current_time( CLOCK_MONOTONIC ) );
+  return EPOCH;
+}
+
+/* Current time in nanoseconds since the start of the program (vDSO) */
+static uint64_t monotonic_ns()
 {
-  const uint64_t nanos = ts.tv_sec * BILLION + ts.tv_nsec;
-  return nanos / MILLION;
+  const uint64_t start = epoch(); /* (initialized first on the first call) */
+  return timestamp_ns_raw( current_time( CLOCK_MONOTONIC ) ) - start;
 }
 
-/* Current time in milliseconds since the start of the program */
-uint64_t timestamp_ms()
+#if defined(__x86_64__) || defined(__i386__)
+/* does the TSC tick at a constant rate in all power states? */
+static bool invariant_tsc()
 {
-  return timestamp_ms( current_time() );
+  unsigned int eax, ebx, ecx, edx;
+  if ( not __get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx ) ) {
+    return false;
+  }
+  return edx & ( 1 << 8 );
 }
 
-uint64_t timestamp_ms( const timespec & ts )
+/* TSC-based clock, calibrated against the monotonic clock: the TSC rate
+   is measured over the whole life of the thread (after a short warmup
+   that uses the system clock), and the anchor point is refreshed every
+   second so that errors can't accumulate */
+static uint64_t tsc_ns()
 {
-  const static uint64_t EPOCH = timestamp_ms_raw( current_time() );
-  return timestamp_ms_raw( ts ) - EPOCH;
+  struct Calibration {
+    uint64_t first_tsc, first_ns;   /* start of the rate measurement */
+    uint64_t anchor_tsc, anchor_ns; /* most recent reading of both clocks */
+    uint64_t recalibration_ticks;   /* zero until warmed up */
+    double ns_per_tick;
+    uint64_t last_ns;               /* never go backwards */
+  };
+
+  thread_local Calibration cal = { 0, 0, 0, 0, 0, 0, 0 };
+
+  uint64_t tsc = __rdtsc();
+  uint64_t ns = 0;
+
+  if ( cal.recalibration_ticks and tsc - cal.anchor_tsc < cal.recalibration_ticks ) {
+    /* fast path */
+    ns = cal.anchor_ns + uint64_t( ( tsc - cal.anchor_tsc ) * cal.ns_per_tick );
+  } else {
+    /* (re-)anchor to the system clock, bracketing the reading with the TSC
+       and keeping the tightest of a few tries (we may be preempted mid-read) */
+    uint64_t best_spread = numeric_limits<uint64_t>::max();
+    for ( unsigned int i = 0; i < TSC_ANCHOR_TRIES; i++ ) {
+      const uint64_t before = __rdtsc();
+      const uint64_t reading = monotonic_ns();
+      const uint64_t after = __rdtsc();
+      if ( after - before < best_spread ) {
+	best_spread = after - before;
+	tsc = before + best_spread / 2;
+	ns = reading;
+      }
+    }
+
+    if ( cal.first_tsc == 0 ) {
+      cal.first_tsc = tsc;
+      cal.first_ns = ns;
+    } else if ( ns - cal.first_ns >= TSC_WARMUP_NS and tsc > cal.first_tsc ) {
+      cal.ns_per_tick = double( ns - cal.first_ns ) / ( tsc - cal.first_tsc );
+      cal.recalibration_ticks = TSC_RECALIBRATION_NS / cal.ns_per_tick;
+    }
+    cal.anchor_tsc = tsc;
+    cal.anchor_ns = ns;
+  }
+
+  cal.last_ns = ns = max( ns, cal.last_ns );
+  return ns;
+}
+#endif
+
+/* Current time in nanoseconds since the start of the program */
+uint64_t timestamp_ns()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  const static bool USE_TSC = invariant_tsc();
+  if ( USE_TSC ) {
+    return tsc_ns();
+  }
+#endif
+
+  return monotonic_ns();
+}
+
+/* Convert a CLOCK_REALTIME time to nanoseconds since the start of the program */
+uint64_t timestamp_ns( const timespec & ts )
+{
+  /* offset between the two clocks, measured once (so later steps
+     of the real-time clock will show up as an error here) */
+  const static uint64_t REALTIME_OFFSET = timestamp_ns_raw( current_time( CLOCK_REALTIME ) )
+    - timestamp_ns_raw( current_time( CLOCK_MONOTONIC ) );
+
+  /* a time before the start of the program (e.g. a datagram that
+     arrived before the first call, or a step of the real-time clock)
+     counts as the start, rather than wrapping around to the far future */
+  const uint64_t time = timestamp_ns_raw( ts ), start = REALTIME_OFFSET + epoch();
+  return time > start ? time - start : 0;
 }
@@ -4,8 +4,21 @@
 #include <ctime>
 #include <cstdint>
 
-/* Current time in milliseconds since the start of the program */
-uint64_t timestamp_ms();
-uint64_t timestamp_ms( const timespec & ts );
+/* All timestamps share one timescale: the monotonic clock,
+   counted from the start of the program */
+
+/* Current time in nanoseconds since the start of the program
+   (uses the TSC where it is invariant, otherwise the vDSO clock) */
+uint64_t timestamp_ns();
+
+/* Convert a CLOCK_REALTIME time (e.g. a kernel SO_TIMESTAMPNS receive
+   timestamp) to nanoseconds since the start of the program
+   (0 for a time before the start) */
+uint64_t timestamp_ns( const timespec & ts );
+
+/* Coarser views of the same timescale */
+inline uint64_t timestamp_us() { return timestamp_ns() / 1000; }
+inline uint64_t timestamp_ms() { return timestamp_ns() / 1000000; }
+inline uint64_t timestamp_ms( const timespec & ts ) { return timestamp_ns( ts ) / 1000000; }
 
 #endif /* TIMESTAMP_HH */
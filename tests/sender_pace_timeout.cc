@@ -0,0 +1,78 @@
+/* regression test: a pacing sender whose datagrams all go unacked must
+   still time out once per timeout (1 s before any RTT sample), even
+   though its pacing and report timers keep ending each poll() early */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "socket.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* how long to run the sender, and the fewest timeouts to accept (one a second) */
+static const unsigned int RUN_MS = 5500, MIN_TIMEOUTS = 4;
+
+/* run the sender against `sink` and count its timeouts */
+static unsigned int count_timeouts( const UDPSocket & sink, const string & option )
+{
+  char log_name[] = "/tmp/sender_pace_timeout.XXXXXX";
+  FileDescriptor log( SystemCall( "mkstemp", mkstemp( log_name ) ) );
+  SystemCall( "unlink", unlink( log_name ) );
+
+  const string port = to_string( sink.local_address().port() );
+  const pid_t child = SystemCall( "fork", fork() );
+  if ( child == 0 ) {
+    /* (the debug output, including each timeout, goes to stderr) */
+    dup2( log.fd_num(), STDERR_FILENO );
+    execl( "../datagrump/sender", "sender", "::1", port.c_str(), "debug", option.c_str(), nullptr );
+    _exit( EXIT_FAILURE );
+  }
+
+  this_thread::sleep_for( chrono::milliseconds( RUN_MS ) );
+  SystemCall( "kill", kill( child, SIGTERM ) );
+  SystemCall( "waitpid", waitpid( child, nullptr, 0 ) );
+
+  SystemCall( "lseek", lseek( log.fd_num(), 0, SEEK_SET ) );
+  string output;
+  while ( not log.eof() ) {
+    output += log.read();
+  }
+
+  unsigned int timeouts = 0;
+  for ( size_t i = output.find( "timed out" ); i != string::npos; i = output.find( "timed out", i + 1 ) ) {
+    timeouts++;
+  }
+  return timeouts;
+}
+
+int main()
+{
+  try {
+    /* a receiver that never acks */
+    UDPSocket sink;
+    sink.bind( Address( "::1", 0 ) );
+
+    /* (timer pacing, and BBR, which turns it on by itself) */
+    for ( const string option : { "pace", "bbr" } ) {
+      const unsigned int timeouts = count_timeouts( sink, option );
+      if ( timeouts < MIN_TIMEOUTS ) {
+	cerr << option << ": " << timeouts << " timeouts in " << RUN_MS << " ms, expected at least "
+	     << MIN_TIMEOUTS << endl;
+	return EXIT_FAILURE;
+      }
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
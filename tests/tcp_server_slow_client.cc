@@ -0,0 +1,119 @@
+/* regression test: a TCPServer worker writing to a slow, non-blocking
+   client gets readable and writable events in the same wakeup, and must
+   keep serving (and close the connection when the client goes away)
+   rather than giving up on a spurious "busy wait" */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <sys/socket.h>
+
+#include "socket.hh"
+#include "tcp_server.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+static const unsigned int REQUESTS = 20, REPLIES_PER_REQUEST = 3000;
+static const string REPLY( 100, 'x' );
+
+/* read whatever has arrived (the client is non-blocking) */
+static size_t drain( TCPSocket & client )
+{
+  const size_t length = client.read( 65536 ).size();
+  if ( client.eof() ) {
+    throw runtime_error( "server closed the connection" );
+  }
+  return length;
+}
+
+/* send the requests slowly, read the replies slowly, and hang up */
+static bool exchange( const Address & address )
+{
+  TCPSocket client;
+  client.connect( address );
+  client.set_blocking( false );
+
+  const auto deadline = steady_clock::now() + seconds( 30 );
+  const size_t expected = size_t( REQUESTS ) * REPLIES_PER_REQUEST * REPLY.size();
+  size_t received = 0;
+
+  for ( unsigned int i = 0; i < REQUESTS; i++ ) {
+    client.write( "request\n" );
+    client.flush();
+    this_thread::sleep_for( milliseconds( 3 ) );
+    received += drain( client );
+  }
+
+  while ( received < expected ) {
+    if ( steady_clock::now() > deadline ) {
+      cerr << "received " << received << " of " << expected << " bytes" << endl;
+      return false;
+    }
+    this_thread::sleep_for( microseconds( 200 ) );
+    received += drain( client );
+  }
+
+  return true;
+}
+
+/* wait for the worker to see the connection go */
+static bool wait_for( const atomic<unsigned int> & closes, const unsigned int count )
+{
+  const auto deadline = steady_clock::now() + seconds( 5 );
+  while ( closes < count ) {
+    if ( steady_clock::now() > deadline ) {
+      cerr << "on_close called " << closes << " times, expected " << count << endl;
+      return false;
+    }
+    this_thread::sleep_for( milliseconds( 1 ) );
+  }
+  return true;
+}
+
+int main()
+{
+  try {
+    atomic<unsigned int> closes( 0 );
+
+    TCPServer::Handlers handlers;
+    handlers.on_open = [] ( TCPServer::Connection & connection ) {
+      /* a small send buffer, so the replies queue up */
+      const int size = 4096;
+      SystemCall( "setsockopt", setsockopt( connection.socket().fd_num(), SOL_SOCKET, SO_SNDBUF,
+					    &size, sizeof( size ) ) );
+    };
+    handlers.on_data = [] ( TCPServer::Connection & connection, const string & chunk ) {
+      this_thread::sleep_for( milliseconds( 2 ) );
+
+      /* (requests can arrive together: answer each) */
+      for ( const char c : chunk ) {
+	if ( c != '\n' ) {
+	  continue;
+	}
+	for ( unsigned int i = 0; i < REPLIES_PER_REQUEST; i++ ) {
+	  connection.send( REPLY );
+	}
+      }
+    };
+    handlers.on_close = [&closes] ( TCPServer::Connection & ) { closes++; };
+
+    TCPServer server( Address( "::1", "0" ), handlers, 1 );
+
+    /* (a second connection checks that the worker is still running) */
+    for ( unsigned int count = 1; count <= 2; count++ ) {
+      if ( not exchange( server.local_address() ) or not wait_for( closes, count ) ) {
+	return EXIT_FAILURE;
+      }
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}